@@ -0,0 +1,113 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the misbehaviour scenarios of a general. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include "Adversary.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+Adversary::Adversary() {
+    clear(&(this->info));
+    this->randState = 1;
+}
+
+// Sets the scenario, for a general and an instance.
+// Every general (and every instance) draws a sequence of its own, which is the same in every run.
+void Adversary::init(const AdversaryInfo &info, uint32_t myId, uint32_t instance) {
+    this->info = info;
+    this->randState = info.seed ^ (myId * 2654435761u) ^ (instance * 40503u);
+}
+
+// Does the transport lose, duplicate or reorder datagrams?
+bool Adversary::hasTransportFaults() const {
+    return this->info.lossRate > 0 || this->info.dupRate > 0 || this->info.reorderRate > 0;
+}
+
+// Picks what happens to the next datagram sent.
+int Adversary::transportFault() {
+    double draw = (double) random() / ((double) RAND_MAX + 1);
+    if(draw < this->info.lossRate) {
+        return TRANSPORT_LOSE;
+    }
+    draw -= this->info.lossRate;
+    if(draw < this->info.dupRate) {
+        return TRANSPORT_DUPLICATE;
+    }
+    draw -= this->info.dupRate;
+    if(draw < this->info.reorderRate) {
+        return TRANSPORT_REORDER;
+    }
+    return TRANSPORT_SEND;
+}
+
+// Draws a random number (between 0 and RAND_MAX).
+uint32_t Adversary::random() {
+    return rand_r(&(this->randState));
+}
+
+// Sets a scenario with no misbehaviour.
+void Adversary::clear(AdversaryInfo *info) {
+    info->behaviours = 0;
+    info->relayDelay = DEFAULT_RELAY_DELAY;
+    info->floodRate = DEFAULT_FLOOD_RATE;
+    info->lossRate = 0;
+    info->dupRate = 0;
+    info->reorderRate = 0;
+    info->seed = 1;
+}
+
+// Reads a scenario from a comma separated list of
+// equivocate, drop, delay[=<ms>], forge, flood[=<chains per round>], loss=<%>, dup=<%> and reorder=<%>.
+// Returns false if the list is not understood.
+bool Adversary::parse(const char *list, AdversaryInfo *info) {
+    string items(list);
+    size_t begin = 0;
+    while(begin <= items.size()) {
+        size_t end = items.find(',', begin);
+        if(end == string::npos) {
+            end = items.size();
+        }
+        string item = items.substr(begin, end - begin);
+        begin = end + 1;
+
+        size_t equals = item.find('=');
+        string name = item.substr(0, equals);
+        bool hasArg = (equals != string::npos);
+        double arg = hasArg ? atof(item.c_str() + equals + 1) : 0;
+        if(hasArg && arg < 0) {
+            return false;
+        }
+
+        if(name == "equivocate" && !hasArg) {
+            info->behaviours |= EQUIVOCATE;
+        } else if(name == "drop" && !hasArg) {
+            info->behaviours |= DROP_RELAYS;
+        } else if(name == "delay") {
+            info->behaviours |= DELAY_RELAYS;
+            if(hasArg) {
+                info->relayDelay = (long) (arg * 1000);
+            }
+        } else if(name == "forge" && !hasArg) {
+            info->behaviours |= FORGE_RELAYS;
+        } else if(name == "flood") {
+            info->behaviours |= FLOOD;
+            if(hasArg) {
+                info->floodRate = (int) arg;
+            }
+        } else if(name == "loss" && hasArg && arg <= 100) {
+            info->lossRate = arg / 100;
+        } else if(name == "dup" && hasArg && arg <= 100) {
+            info->dupRate = arg / 100;
+        } else if(name == "reorder" && hasArg && arg <= 100) {
+            info->reorderRate = arg / 100;
+        } else {
+            return false;
+        }
+    }
+    return info->lossRate + info->dupRate + info->reorderRate <= 1;
+}
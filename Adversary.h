@@ -0,0 +1,69 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class Adversary. |
+|
+| An adversary makes a general misbehave, to measure the algorithm |
+| when things go wrong: a traitor commander equivocates, a traitor |
+| relay drops, delays or forges the chains it relays, or floods the |
+| others with chains that do not verify, and the transport loses, |
+| duplicates and reorders datagrams. Every random choice is drawn |
+| from a generator seeded by the scenario, the general and the |
+| instance, so a scenario injects the same faults every time it runs. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef ADVERSARY_H
+#define ADVERSARY_H
+
+#include <string>
+#include <stdint.h>
+
+#define EQUIVOCATE 0x01   // The commander signs the other order for every odd lieutenant.
+#define DROP_RELAYS 0x02  // Chains are acknowledged but never relayed.
+#define DELAY_RELAYS 0x04 // Chains are relayed late in the round.
+#define FORGE_RELAYS 0x08 // Chains are relayed with a corrupted signature.
+#define FLOOD 0x10        // Chains with made up values and signatures are sent to everyone in every round.
+
+#define DEFAULT_RELAY_DELAY 300000 // in microseconds
+#define DEFAULT_FLOOD_RATE 16      // Made up chains sent to each general per round.
+
+#define TRANSPORT_SEND 0      // The datagram goes out as it is.
+#define TRANSPORT_LOSE 1      // The datagram is not sent.
+#define TRANSPORT_DUPLICATE 2 // The datagram is sent twice.
+#define TRANSPORT_REORDER 3   // The datagram is held back and sent after the next one.
+
+// A misbehaviour scenario.
+typedef struct {
+    uint32_t behaviours; // Traitor behaviours (EQUIVOCATE, DROP_RELAYS, ...).
+    long relayDelay;     // Microseconds relays are held back by with DELAY_RELAYS.
+    int floodRate;       // Made up chains sent to each general per round with FLOOD.
+    double lossRate;     // Fraction of the datagrams sent that are lost.
+    double dupRate;      // Fraction of the datagrams sent that are duplicated.
+    double reorderRate;  // Fraction of the datagrams sent that are reordered.
+    uint32_t seed;       // Seed of the random choices.
+} AdversaryInfo;
+
+// Class definition.
+class Adversary {
+
+    private:
+        AdversaryInfo info;     // The scenario.
+        unsigned int randState; // State of the generator of the random choices.
+
+    public:
+        Adversary(); // Constructor to initialize variables.
+
+        void init(const AdversaryInfo &, uint32_t, uint32_t); // Sets the scenario, for a general and an instance.
+        bool has(uint32_t behaviour) const { return (this->info.behaviours & behaviour) != 0; } // Does the general behave so?
+        bool hasTransportFaults() const;                       // Does the transport lose, duplicate or reorder datagrams?
+        bool isActive() const { return this->info.behaviours != 0 || hasTransportFaults(); } // Does the general misbehave at all?
+        long relayDelay() const { return this->info.relayDelay; } // Microseconds relays are held back by.
+        int floodRate() const { return this->info.floodRate; }    // Made up chains sent to each general per round.
+        int transportFault();                                  // Picks what happens to the next datagram sent.
+        uint32_t random();                                     // Draws a random number.
+
+        static void clear(AdversaryInfo *);                    // Sets a scenario with no misbehaviour.
+        static bool parse(const char *, AdversaryInfo *);      // Reads a scenario from a comma separated list.
+};
+
+#endif
@@ -0,0 +1,111 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the arena allocator. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstdio>
+#include <sys/mman.h>
+#include "Arena.h"
+
+using namespace std;
+
+// Rounds a size up to a multiple of a power of two.
+static size_t roundUp(size_t size, size_t multiple) {
+    return (size + multiple - 1) & ~(multiple - 1);
+}
+
+// Constructor to initialize variables.
+Arena::Arena() {
+    this->blocks = NULL;
+    this->current = NULL;
+    this->blockSize = ARENA_BLOCK_SIZE;
+    this->hugePages = false;
+}
+
+// Destructor to unmap all the blocks.
+Arena::~Arena() {
+    Block *block = this->blocks;
+    while(block) {
+        Block *next = block->next;
+        munmap(block, block->size);
+        block = next;
+    }
+}
+
+// Sets the block size and whether blocks are backed by huge pages.
+// Must be called before the first allocation.
+void Arena::init(size_t blockSize, bool hugePages) {
+    this->blockSize = blockSize;
+    this->hugePages = hugePages;
+}
+
+// Maps a new block that can hold at least the given number of bytes.
+Arena::Block *Arena::mapBlock(size_t bytes) throw(string) {
+    size_t size = roundUp(sizeof(Block), ARENA_ALIGNMENT) + bytes;
+    if(size < this->blockSize) {
+        size = this->blockSize;
+    }
+
+    void *addr = MAP_FAILED;
+    if(this->hugePages) {
+        size = roundUp(size, HUGE_PAGE_SIZE);
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(addr == MAP_FAILED) {
+            // No huge pages reserved. Ask for transparent huge pages instead.
+            addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(addr != MAP_FAILED) {
+                madvise(addr, size, MADV_HUGEPAGE);
+            }
+        }
+    } else {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+
+    if(addr == MAP_FAILED) {
+        perror("Failed to map an arena block: mmap() failed");
+        throw string("\nCould not allocate memory for the arena.");
+    }
+
+    Block *block = (Block *) addr;
+    block->next = NULL;
+    block->size = size;
+    block->used = roundUp(sizeof(Block), ARENA_ALIGNMENT);
+    return block;
+}
+
+// Returns memory for the given number of bytes, valid until the next reset.
+void *Arena::allocate(size_t bytes) throw(string) {
+    bytes = roundUp(bytes, ARENA_ALIGNMENT);
+
+    // Move along the blocks kept from before the last reset till one has room.
+    while(this->current && this->current->used + bytes > this->current->size) {
+        if(this->current->next == NULL) {
+            break;
+        }
+        this->current = this->current->next;
+        this->current->used = roundUp(sizeof(Block), ARENA_ALIGNMENT);
+    }
+
+    if(this->current == NULL || this->current->used + bytes > this->current->size) {
+        Block *block = mapBlock(bytes);
+        if(this->current) {
+            this->current->next = block;
+        } else {
+            this->blocks = block;
+        }
+        this->current = block;
+    }
+
+    void *mem = (char *) this->current + this->current->used;
+    this->current->used += bytes;
+    return mem;
+}
+
+// Releases everything allocated, keeping the blocks for reuse.
+void Arena::reset() {
+    this->current = this->blocks;
+    if(this->current) {
+        this->current->used = roundUp(sizeof(Block), ARENA_ALIGNMENT);
+    }
+}
@@ -0,0 +1,51 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class Arena. |
+|
+| An arena hands out memory by bumping a pointer through large blocks |
+| and releases everything it handed out in one reset. The blocks are |
+| kept across resets, so a general that resets its arena at every |
+| round boundary does no heap allocation in steady state. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <string>
+#include <cstddef>
+
+#define ARENA_BLOCK_SIZE 65536          // Default size of a block.
+#define ARENA_ALIGNMENT 16              // Alignment of every allocation.
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024) // Size of a huge page on x86-64.
+
+// Class definition.
+class Arena {
+
+    private:
+        // Header at the start of every block.
+        struct Block {
+            Block *next; // Next block in the list.
+            size_t size; // Size of the block, including this header.
+            size_t used; // Bytes handed out from the block, including this header.
+        };
+
+        Block *blocks;    // All the blocks of the arena.
+        Block *current;   // Block that allocations are currently served from.
+        size_t blockSize; // Size of a new block.
+        bool hugePages;   // Should the blocks be backed by huge pages?
+
+        Block *mapBlock(size_t) throw(std::string); // Maps a new block that can hold at least the given number of bytes.
+        Arena(const Arena &);                        // Not copyable.
+        Arena &operator=(const Arena &);             // Not assignable.
+
+    public:
+        Arena();  // Constructor to initialize variables.
+        ~Arena(); // Destructor to unmap all the blocks.
+
+        void init(size_t, bool);                     // Sets the block size and whether blocks are backed by huge pages.
+        void *allocate(size_t) throw(std::string);   // Returns memory for the given number of bytes, valid until the next reset.
+        void reset();                                // Releases everything allocated, keeping the blocks for reuse.
+};
+
+#endif
@@ -0,0 +1,130 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the chain trie: the signature chains of a |
+| general, stored once per distinct prefix. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstring>
+#include <arpa/inet.h>
+#include "ChainTrie.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+ChainTrie::ChainTrie() {
+    this->roots = NULL;
+    this->freeNodes = NULL;
+}
+
+// Sets the block size of the node memory and whether it is backed by huge pages.
+// Must be called before the first chain is added.
+void ChainTrie::init(size_t blockSize, bool hugePages) {
+    this->arena.init(blockSize, hugePages);
+}
+
+// Returns the node of a signature appended to a chain (NULL for a chain that starts with it), with a reference on it.
+// A chain that was already held is shared: only a new signature takes a node, which holds a reference on its parent.
+ChainNode *ChainTrie::extend(ChainNode *parent, const struct sig *sign) throw(string) {
+    ChainNode **first = (parent != NULL) ? &(parent->child) : &(this->roots);
+    for(ChainNode *node = *first; node != NULL; node = node->sibling) {
+        if(memcmp(&(node->sign), sign, sizeof(struct sig)) == 0) {
+            node->refs++;
+            return node;
+        }
+    }
+
+    ChainNode *node = this->freeNodes;
+    if(node != NULL) {
+        this->freeNodes = node->sibling;
+    } else {
+        node = (ChainNode *) this->arena.allocate(sizeof(ChainNode));
+    }
+    memcpy(&(node->sign), sign, sizeof(struct sig));
+    node->parent = parent;
+    node->child = NULL;
+    node->sibling = *first;
+    node->depth = (parent != NULL) ? parent->depth + 1 : 1;
+    node->refs = 1;
+    *first = node;
+    if(parent != NULL) {
+        parent->refs++;
+    }
+    return node;
+}
+
+// Returns the node ending a received chain (in host byte order), with a reference on it.
+// Only the signatures that extend what is held are copied.
+ChainNode *ChainTrie::insert(const SignedMessage *msg) throw(string) {
+    ChainNode *tip = NULL;
+    for(uint32_t i = 0; i < msg->total_sigs; i++) {
+        struct sig sign;
+        sign.id = htonl(msg->sigs[i].id);
+        memcpy(sign.signature, msg->sigs[i].signature, SIG_SIZE);
+
+        ChainNode *next = extend(tip, &sign);
+        if(tip != NULL) {
+            release(tip); // Its child holds it now.
+        }
+        tip = next;
+    }
+    return tip;
+}
+
+// Takes a reference on a node.
+void ChainTrie::retain(ChainNode *node) {
+    node->refs++;
+}
+
+// Drops a reference on a node. A node no longer referenced is freed, and so is its parent in turn.
+void ChainTrie::release(ChainNode *node) {
+    while(node != NULL && --(node->refs) == 0) {
+        ChainNode **link = (node->parent != NULL) ? &(node->parent->child) : &(this->roots);
+        while(*link != node) {
+            link = &((*link)->sibling);
+        }
+        *link = node->sibling;
+
+        ChainNode *parent = node->parent;
+        node->sibling = this->freeNodes;
+        this->freeNodes = node;
+        node = parent;
+    }
+}
+
+// Drops every chain at once, for a new instance. The blocks of the arena are kept, so that the
+// nodes of the next instance are carved from the memory of the last one.
+void ChainTrie::reset() {
+    this->roots = NULL;
+    this->freeNodes = NULL;
+    this->arena.reset();
+}
+
+// Points iovecs at the header and the signatures (root first) of a chain.
+// There must be room for the depth of the chain plus one. Returns the number of iovecs used.
+int ChainTrie::gather(const Chain &chain, struct iovec *iov) {
+    int count = chain.tip->depth + 1;
+    iov[0].iov_base = (void *) chain.header;
+    iov[0].iov_len = sizeof(SignedMessage);
+    int i = count - 1;
+    for(const ChainNode *node = chain.tip; node != NULL; node = node->parent, i--) {
+        iov[i].iov_base = (void *) &(node->sign);
+        iov[i].iov_len = sizeof(struct sig);
+    }
+    return count;
+}
+
+// Returns the length of the message of a chain.
+size_t ChainTrie::length(const Chain &chain) {
+    return sizeof(SignedMessage) + chain.tip->depth * sizeof(struct sig);
+}
+
+// Has a general signed a chain?
+bool ChainTrie::hasSigned(const Chain &chain, uint32_t generalId) {
+    for(const ChainNode *node = chain.tip; node != NULL; node = node->parent) {
+        if(ntohl(node->sign.id) == generalId) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,64 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class ChainTrie. |
+|
+| A chain trie holds the signature chains of a general as a prefix |
+| trie: a chain is the path from a root (a signature of the commander) |
+| to its last signature, and a relay adds one node under the chain it |
+| extends instead of copying it. Nodes are reference counted, so a |
+| chain is freed once neither a message nor the evidence holds it. |
+| A message is sent straight from its path, one iovec per signature. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef CHAIN_TRIE_H
+#define CHAIN_TRIE_H
+
+#include <string>
+#include <sys/uio.h>
+#include "message_format.h"
+#include "Arena.h"
+
+// A signature of the trie. The chain it ends is the path from the root to it.
+typedef struct ChainNode {
+    struct sig sign;           // The signature (its id in network byte order, as it is sent).
+    struct ChainNode *parent;  // The signature before it (NULL for the signature of the commander).
+    struct ChainNode *child;   // First chain extending it.
+    struct ChainNode *sibling; // Next chain extending its parent (or the next free node).
+    uint32_t depth;            // Number of signatures of the chain it ends.
+    uint32_t refs;             // References held on it: its children, and the chains that end with it.
+} ChainNode;
+
+// A chain held for sending, or as evidence: the header of its message and its last signature.
+typedef struct {
+    ChainNode *tip;                     // Last signature of the chain.
+    char header[sizeof(SignedMessage)]; // The SignedMessage without its signatures, in network byte order (total_sigs is the depth of tip).
+} Chain;
+
+// Class definition.
+class ChainTrie {
+
+    private:
+        Arena arena;          // Memory of the nodes.
+        ChainNode *roots;     // Chains of distinct commander signatures.
+        ChainNode *freeNodes; // Nodes released, for reuse.
+
+        ChainTrie(const ChainTrie &);            // Not copyable.
+        ChainTrie &operator=(const ChainTrie &); // Not assignable.
+
+    public:
+        ChainTrie(); // Constructor to initialize variables.
+
+        void init(size_t, bool);                                            // Sets the block size of the node memory and whether it is backed by huge pages.
+        ChainNode *extend(ChainNode *, const struct sig *) throw(std::string); // Returns the node of a signature appended to a chain, with a reference on it.
+        ChainNode *insert(const SignedMessage *) throw(std::string);         // Returns the node ending a received chain (in host byte order), with a reference on it.
+        void retain(ChainNode *);                                           // Takes a reference on a node.
+        void release(ChainNode *);                                          // Drops a reference on a node, freeing the chain up to where it is shared.
+        void reset();                                                       // Drops every chain at once, keeping the memory of the nodes.
+
+        static int gather(const Chain &, struct iovec *);      // Points iovecs at the header and the signatures of a chain. Returns their number.
+        static size_t length(const Chain &);                   // Returns the length of the message of a chain.
+        static bool hasSigned(const Chain &, uint32_t);         // Has a general signed a chain?
+};
+
+#endif
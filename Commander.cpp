@@ -11,8 +11,13 @@ using namespace std;
 
 // Constructor to initialize the variables and,
 // call the parameterized constructor of the base class.
-Commander::Commander(GeneralInfo *generalInfo, uint32_t order) throw(string) : General(generalInfo) {
-    this->order = order;
+// An order is proposed as the payload General::orderPayload() returns for it.
+Commander::Commander(GeneralInfo *generalInfo, const vector<uint8_t> &value) throw(string) : General(generalInfo) {
+    this->value = value;
+    this->payloadMsg = NULL;
+    this->equivocating = false;
+    this->presigner = generalInfo->presigner;
+    this->sending = NULL;
     this->state = INIT;
 }
 
@@ -21,58 +26,93 @@ int Commander::run() throw(string) {
     selectValue();
     if(this->state == VALUE_SELECTED) {
         send();
-        return this->order;
+        servePayload();
+        return classify(this->decision);
     } else {
-        throw string("\nInvalid order selected by commander. Should be either 0 or 1.");
+        throw string("\nInvalid value selected by commander. Should be an order or a payload of 1 byte up to 8 MB.");
     }
 }
 
-// Selects the value/order to be sent.
+// Selects the value/payload to be sent.
+// The commander decides on his own value, and agreement is on its digest.
 void Commander::selectValue() {
-    if(this->order == RETREAT || this->order == ATTACK) {
+    if(!this->value.empty()) {
+        this->payloadMsg = this->payloads.put(&(this->value[0]), this->value.size(), NULL);
+    }
+    if(this->payloadMsg) {
+        memcpy(this->decision, this->payloadMsg->digest, DIGEST_SIZE);
+        this->decided = true;
         this->state = VALUE_SELECTED;
     }
 }
 
+// Signs what the commander proposes for a digest in his instance.
+// The signature is taken from the presigner when it was signed ahead, so that round 1 does not wait for it.
+void Commander::signOrder(const uint8_t *digest, struct sig *sign) throw(string) {
+    if(this->presigner != NULL && this->presigner->take(this->instance, digest, sign)) {
+        this->state = SIGNED;
+        return;
+    }
+
+    uint8_t value[SIGNED_VALUE_SIZE];
+    signedValue(this->instance, digest, value);
+    signMessage(value, SIGNED_VALUE_SIZE, sign);
+}
+
 // Sends the order to all generals.
+// The payload is sent to every lieutenant once. The signed order only carries its digest.
 void Commander::send() throw(string) {
-    // Digitally sign the order and obtain the pointer to the signature.
-    struct sig *sign = signMessage(&(this->order), sizeof(this->order));
-    
+    // The payload of an order is known to everyone and need not be sent.
+    bool isOrder = (classify(this->decision) != OPAQUE_VALUE);
+    // In gossip mode it goes to the same generals as the signed order. The others ask for it.
+    const vector<uint32_t> &order = shuffledPeers();
+    for(size_t i = 0; i < order.size() && (this->fanout == 0 || i < (size_t) this->fanout) && !isOrder; i++) {
+        sendPayload(this->payloadMsg, order[i]);
+    }
+
+    // Digitally sign the digest of the payload: the signature starts the chain of the order/message to be sent.
+    struct sig sign;
+    signOrder(this->decision, &sign);
+
     if(this->state == SIGNED) {
-        // Prepare the order/message to be sent.
-        SignedMessage *message = (SignedMessage *) malloc(sizeof(SignedMessage) + sizeof(struct sig));
-        message->type = TYPE_SEND;
-        message->total_sigs = this->round;
-        message->order = this->order;
-        memcpy(message->sigs, sign, sizeof(struct sig));
-        message = hton_sm(message);
-
-        if(sign) {
-            delete sign;
+        sign.id = htonl(sign.id);
+        Chain message = makeChain(this->chains.extend(NULL, &sign), this->value.size(), this->decision);
+        keepEvidence(message);
+
+        // An equivocating commander signs the other order too, for the odd lieutenants.
+        if(this->adversary.has(EQUIVOCATE)) {
+            vector<uint8_t> other;
+            uint8_t otherDigest[DIGEST_SIZE];
+            orderPayload((classify(this->decision) == RETREAT) ? ATTACK : RETREAT, other);
+            PayloadStore::digest(&other[0], other.size(), otherDigest);
+
+            signOrder(otherDigest, &sign);
+            sign.id = htonl(sign.id);
+            this->equivocation = makeChain(this->chains.extend(NULL, &sign), other.size(), otherDigest);
+            this->equivocating = true;
+            keepEvidence(this->equivocation);
         }
+        flood();
 
         long int diff = 0;
         struct timeval start;
-        gettimeofday(&start, NULL); // Record the start time.
+        currentTime(&start); // Record the start time.
+        startRetransmits(start);
+        this->sending = &message;
 
         // Try sending till message has been sent to all the generals or the round gets over.
         while(this->state != ALL_SENT && diff < ROUND_TIMEOUT) {
             sendOrder(message);
             
-            for(int i = 0; i < this->numGenerals; i++) {
-                if(this->sendQueue[i] == NOT_SENT) {
-                    cerr<<"\nCould not send message to: "<<this->hostNames[i];
-                    this->state = ALL_NOT_SENT;
-
-                    break;
-                }
+            if(this->peers.countSendStatus(NOT_SENT) > 0) {
+                cerr<<"\nCould not send message to: "<<this->hostNames[this->peers.nextWithSendStatus(SEND_STATUS_BIT(NOT_SENT), NO_PEER) - 1];
+                this->state = ALL_NOT_SENT;
             }
 
             if(this->state == ALL_NOT_SENT) {
                 // Record the current time and calculate the difference from the time we started checking for ACKs.
                 struct timeval end;
-                gettimeofday(&end, NULL);
+                currentTime(&end);
                 diff = ((end.tv_sec * 1000000 + end.tv_usec) - (start.tv_sec * 1000000 + start.tv_usec));
                 continue;
             }
@@ -80,81 +120,140 @@ void Commander::send() throw(string) {
             this->state = ALL_SENT;
         }
 
-        // Wait for ACKs till time out occurs.
-        while(this->state != ALL_ACKS_RECEIVED && diff < ROUND_TIMEOUT) {
+        // Wait for ACKs till time out occurs. The generals whose ACK is overdue are sent to again as their timers expire.
+        // In blind mode there are no ACKs to wait for: only the copies of the order still to go out are waited on.
+        while(this->state != ALL_ACKS_RECEIVED && deliveryPending() && diff < ROUND_TIMEOUT) {
             waitForAck();
 
-            // Try sending to generals from whom ACK has not been received.
-            // If all ACKs have been received none of the cases will be matched in the switch statement in sendOrder().
-            sendOrder(message);
-
             // Record the current time and calculate the difference from the time we started checking for ACKs.
             struct timeval end;
-            gettimeofday(&end, NULL);
+            currentTime(&end);
             diff = ((end.tv_sec * 1000000 + end.tv_usec) - (start.tv_sec * 1000000 + start.tv_usec));
         }
 
-        if(message) {
-            free(message);
+        // Only the signed message is released. What was sent of the payload is kept to serve requests for it.
+        this->sending = NULL;
+        this->fragmenter.forget(message.header);
+        this->chains.release(message.tip);
+        if(this->equivocating) {
+            this->fragmenter.forget(this->equivocation.header);
+            this->chains.release(this->equivocation.tip);
+            this->equivocating = false;
         }
     } else {
         cerr<<"Message could not be signed";
     }
 }
 
+// Sends the order again to a general whose ACK is overdue.
+void Commander::resend(uint32_t generalId) {
+    if(this->sending != NULL) {
+        sendMessage(*(this->sending), generalId);
+    }
+}
+
+// Picks the message a general is sent: an equivocating commander sends the other order to the odd lieutenants.
+const Chain &Commander::messageFor(const Chain &message, uint32_t generalId) {
+    return (this->equivocating && generalId % 2 == 1) ? this->equivocation : message;
+}
+
 // Waits for incoming ACKs.
 void Commander::waitForAck() {
-    int numbytes, bufferLen = sizeof(Ack);
+    int numbytes, bufferLen = MAX_DATAGRAM_SIZE; // A bundle of the messages sent to a commander.
     long int diff = 0;
     struct timeval start;
-    char *buffer = new char[bufferLen];
+    uint32_t datagram[MAX_DATAGRAM_SIZE / sizeof(uint32_t)];
+    char *buffer = (char *) datagram;
 
     // Record the start time.
-    gettimeofday(&start, NULL);
+    currentTime(&start);
 
     // Loop until all ACKs are recived or timeout period elapses.
     while(this->state != ALL_ACKS_RECEIVED && diff < ACK_TIMEOUT) {
         struct sockaddr_in peerAddress;
-        socklen_t addrLen = sizeof(peerAddress);
+        retransmitDue();
 
         // Receive data from the socket.
-        if((numbytes = recvfrom(this->listenSocketFD, buffer, bufferLen, MSG_DONTWAIT, (struct sockaddr *) &peerAddress, &addrLen)) == -1) {
+        if((numbytes = receive(buffer, bufferLen, MSG_DONTWAIT, &peerAddress)) == -1) {
             if(errno != EWOULDBLOCK) {
-                perror("Failed to receive a message: recvfrom() failed");
+                perror("Failed to receive a message: recvmsg() failed");
             }
 
             // Record the current time and calculate the difference from the time we started checking for ACKs.
             struct timeval end;
-            gettimeofday(&end, NULL);
+            currentTime(&end);
             diff = ((end.tv_sec * 1000000 + end.tv_usec) - (start.tv_sec * 1000000 + start.tv_usec));
 
             continue;
         }
 
-        Ack *ackData = ntoh_ack((Ack *) buffer); // Recast the bytes read from the socket.
-
-        // Check if it is an expected ACK.
-        if(ackData && ackData->type == TYPE_ACK && ackData->round == this->round) {
-            this->numMsgsSent--;
-            uint32_t peerId = this->ipToId[peerAddress.sin_addr.s_addr];
-            this->sendQueue[peerId] = ACKED;
+        uint32_t peerId = isOfInstance(buffer, numbytes) ? this->peers.lookup(peerAddress) : NO_PEER;
+        if(peerId != NO_PEER) {
+            handleDatagram(buffer, numbytes, peerId, peerAddress);
+            recordHandled(peerId);
         }
 
-        if(this->numMsgsSent == 0) {
+        if(!deliveryPending()) {
             this->state = ALL_ACKS_RECEIVED;
         }
 
         // Record the current time and calculate the difference from the time we started checking for ACKs.
         struct timeval end;
-        gettimeofday(&end, NULL);
+        currentTime(&end);
         diff = ((end.tv_sec * 1000000 + end.tv_usec) - (start.tv_sec * 1000000 + start.tv_usec));
     }
 
-    if(buffer) {
-        delete[] buffer;
+    if(deliveryPending()) {
+        this->state = ALL_ACKS_NOT_RECEIVED;
     }
+}
 
-    if(this->numMsgsSent > 0) {
-        this->state = ALL_ACKS_NOT_RECEIVED;
+// Calls the handler for the type of a datagram (or message of a bundle) received from a general:
+// an ACK of the order, an ACK of a fragment of the payload or a request for the payload.
+void Commander::handleDatagram(char *buffer, size_t numBytes, uint32_t peerId, const struct sockaddr_in &peerAddress) {
+    uint32_t type = (numBytes >= sizeof(uint32_t)) ? ntohl(*(uint32_t *) buffer) : 0;
+    if(type == TYPE_ACK && numBytes == sizeof(Ack)) {
+        Ack *ackData = ntoh_ack((Ack *) buffer); // Recast the bytes read from the socket.
+        if(ackData->round == (uint32_t) this->round) {
+            recordAck(peerId, ackData->hold_usec);
+        }
+    } else if(type == TYPE_FRAGMENT_ACK && numBytes == sizeof(FragmentAck)) {
+        this->fragmenter.handleAck((FragmentAck *) buffer, peerId);
+    } else if(type == TYPE_PAYLOAD_REQUEST && numBytes == sizeof(PayloadRequest)) {
+        handlePayloadRequest((PayloadRequest *) buffer, peerId);
+    } else if(type == TYPE_BUNDLE) {
+        handleBundle(buffer, numBytes, peerId, peerAddress);
+    }
+}
+
+// Answers requests for the payload till the lieutenants are done (all the rounds and the wait for the payload).
+// A lieutenant that missed fragments of the payload asks again, and only those fragments are sent.
+// The next instance of the shard does not start before the lieutenants are done with this one either.
+void Commander::servePayload() {
+    long int diff = 0;
+    struct timeval start;
+    uint32_t datagram[MAX_DATAGRAM_SIZE / sizeof(uint32_t)];
+    char *buffer = (char *) datagram;
+
+    // Record the start time.
+    currentTime(&start);
+
+    while(diff < (long int) (this->lastRound + 1) * ROUND_TIMEOUT) {
+        struct sockaddr_in peerAddress;
+
+        // Sleep till something arrives, but never past an ACK timeout. What was queued goes out first.
+        waitForDatagram(ACK_TIMEOUT / 1000);
+        int numbytes = receive(buffer, MAX_DATAGRAM_SIZE, MSG_DONTWAIT, &peerAddress);
+
+        uint32_t peerId = isOfInstance(buffer, numbytes) ? this->peers.lookup(peerAddress) : NO_PEER;
+        if(peerId != NO_PEER) {
+            handleDatagram(buffer, numbytes, peerId, peerAddress);
+            recordHandled(peerId);
+        }
+
+        // Record the current time and calculate the difference from the time we started serving.
+        struct timeval end;
+        currentTime(&end);
+        diff = ((end.tv_sec * 1000000 + end.tv_usec) - (start.tv_sec * 1000000 + start.tv_usec));
     }
 }
@@ -14,14 +14,24 @@
 class Commander : public General {
 
     private:
-        uint32_t order; // The order to be sent to toher generals.
+        std::vector<uint8_t> value;       // The value (payload) to be sent to other generals.
+        const PayloadMessage *payloadMsg; // The message carrying the payload.
+        Chain equivocation;               // The other order, sent to odd lieutenants by an equivocating commander.
+        bool equivocating;                // Is the other order being sent?
+        Presigner *presigner;             // Signs the order ahead (NULL if it is signed here).
+        const Chain *sending;             // The order being sent (NULL when none is).
 
-        void selectValue();             // Selects the value/order to be sent.
+        void selectValue();             // Selects the value/payload to be sent.
         void send() throw(std::string); // Sends the order to all generals.
+        void signOrder(const uint8_t *, struct sig *) throw(std::string); // Signs what is proposed for a digest, unless it was signed ahead.
         void waitForAck();              // Waits for incoming ACKs.
+        void servePayload();            // Answers requests for the payload till the lieutenants are done.
+        void handleDatagram(char *, size_t, uint32_t, const struct sockaddr_in &); // Calls the handler for the type of a datagram (or message of a bundle) received.
+        const Chain &messageFor(const Chain &, uint32_t); // Picks the message a general is sent.
+        void resend(uint32_t);                            // Sends the order again to a general.
 
     public:
-        Commander(GeneralInfo *, uint32_t) throw(std::string); // Constructor initializes the variables and calls the parameterized constructor of the base class.
+        Commander(GeneralInfo *, const std::vector<uint8_t> &) throw(std::string); // Constructor initializes the variables and calls the parameterized constructor of the base class.
         int run() throw(std::string);                          // Implements the pure virtual function of parent class which kicks off the algorithm.
 };
 
@@ -0,0 +1,333 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the decision log and its group-commit writer. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "DecisionLog.h"
+
+using namespace std;
+
+// Writes all the given bytes, unless the write fails.
+static bool writeAll(int fd, const char *bytes, size_t len) {
+    while(len > 0) {
+        ssize_t written = write(fd, bytes, len);
+        if(written == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        len -= written;
+    }
+    return true;
+}
+
+// Reads the given number of bytes, unless the file ends first.
+// Returns the number of bytes read, or -1 on error.
+static ssize_t readAll(int fd, char *bytes, size_t len) {
+    size_t total = 0;
+    while(total < len) {
+        ssize_t numRead = ::read(fd, bytes + total, len - total);
+        if(numRead == -1 && errno == EINTR) {
+            continue;
+        }
+        if(numRead == -1) {
+            return -1;
+        }
+        if(numRead == 0) {
+            break;
+        }
+        total += numRead;
+    }
+    return total;
+}
+
+// Reads the record at the current offset of a log into record.
+// Returns RECORD_INTACT, or what was found instead (RECORD_END, RECORD_TORN or RECORD_CORRUPT).
+static int readRecord(int fd, vector<char> &record) {
+    DecisionRecord header;
+    record.clear();
+    ssize_t numRead = readAll(fd, (char *) &header, sizeof(header));
+    if(numRead == 0) {
+        return RECORD_END;
+    }
+    if(numRead < (ssize_t) sizeof(header)) {
+        return RECORD_TORN;
+    }
+    uint32_t length = ntohl(header.length);
+    if(ntohl(header.magic) != DECISION_LOG_MAGIC || length < sizeof(header) || length > MAX_RECORD_SIZE) {
+        return RECORD_CORRUPT;
+    }
+
+    record.resize(length);
+    memcpy(&record[0], &header, sizeof(header));
+    if(readAll(fd, &record[sizeof(header)], length - sizeof(header)) < (ssize_t) (length - sizeof(header))) {
+        return RECORD_TORN;
+    }
+
+    uint32_t crc = ntohl(header.crc);
+    ((DecisionRecord *) &record[0])->crc = 0;
+    bool intact = (DecisionLog::crc32(&record[0], length) == crc);
+    ((DecisionRecord *) &record[0])->crc = header.crc;
+    return intact ? RECORD_INTACT : RECORD_CORRUPT;
+}
+
+// Constructor to initialize variables.
+DecisionLog::DecisionLog() {
+    this->fd = -1;
+    this->numAppended = 0;
+    this->numDurable = 0;
+    this->numBatches = 0;
+    this->closing = false;
+    this->failed = false;
+    this->started = false;
+    pthread_mutex_init(&(this->lock), NULL);
+    pthread_cond_init(&(this->recordsPending), NULL);
+    pthread_cond_init(&(this->recordsDurable), NULL);
+}
+
+// Destructor to close the log.
+DecisionLog::~DecisionLog() {
+    close();
+    pthread_cond_destroy(&(this->recordsDurable));
+    pthread_cond_destroy(&(this->recordsPending));
+    pthread_mutex_destroy(&(this->lock));
+}
+
+// Opens (or creates) a log and starts the writer thread.
+// Whatever follows the last intact record (a record torn by a crash) is cut off first.
+// A log with a corrupt record before its end is not opened: cutting it off there would lose the decisions after it.
+void DecisionLog::open(const string &path) throw(string) {
+    this->path = path;
+    if((this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644)) == -1) {
+        perror("Failed to open the decision log: open() failed");
+        throw string("\nCould not open the decision log " + path + ".");
+    }
+
+    if(recover()) {
+        // The file was just created. Make its directory entry durable too.
+        size_t slash = path.rfind('/');
+        string dir = (slash == string::npos) ? string(".") : path.substr(0, slash + 1);
+        int dirFD = ::open(dir.c_str(), O_RDONLY);
+        if(dirFD != -1) {
+            fsync(dirFD);
+            ::close(dirFD);
+        }
+    }
+
+    if(pthread_create(&(this->writer), NULL, DecisionLog::writerMain, this) != 0) {
+        throw string("\nCould not start the writer of the decision log.");
+    }
+    this->started = true;
+}
+
+// Drops a torn record from the end of the log.
+// The last record is torn if the log ends within it, or if it fails its CRC and ends with the log (its length
+// reached the disk and not all of its bytes); a record that is corrupt anywhere else makes the log unusable.
+// Returns true if the log is empty.
+bool DecisionLog::recover() throw(string) {
+    struct stat info;
+    if(fstat(this->fd, &info) == -1) {
+        perror("Failed to recover the decision log: fstat() failed");
+        throw string("\nCould not recover the decision log " + this->path + ".");
+    }
+
+    off_t end = 0;
+    int status;
+    vector<char> record;
+    lseek(this->fd, 0, SEEK_SET);
+    while((status = readRecord(this->fd, record)) == RECORD_INTACT) {
+        end += record.size();
+    }
+
+    if(status == RECORD_CORRUPT && end + (off_t) record.size() != info.st_size) {
+        char offset[32];
+        snprintf(offset, sizeof(offset), "%ld", (long) end);
+        throw string("\nThe decision log " + this->path + " has a corrupt record at offset " + offset + "; it was not opened.");
+    }
+
+    if(info.st_size > end) {
+        fprintf(stderr, "Dropping %ld bytes of a torn record from the end of the decision log.\n", (long) (info.st_size - end));
+        if(ftruncate(this->fd, end) == -1 || fdatasync(this->fd) == -1) {
+            perror("Failed to cut off a torn record");
+            throw string("\nCould not recover the decision log.");
+        }
+    }
+    return end == 0;
+}
+
+// Hands a decision over to the writer, with the signature chains (in network byte order) it rests on.
+// Returns the number of records handed over so far, to wait for with waitDurable().
+uint64_t DecisionLog::append(uint32_t general, uint32_t instance, int decision, const uint8_t *digest, const vector<vector<char> > &chains) {
+    size_t length = sizeof(DecisionRecord);
+    for(size_t i = 0; i < chains.size(); i++) {
+        length += sizeof(uint32_t) + chains[i].size();
+    }
+
+    vector<char> record(length);
+    DecisionRecord *header = (DecisionRecord *) &record[0];
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    header->magic = htonl(DECISION_LOG_MAGIC);
+    header->length = htonl(length);
+    header->crc = 0;
+    header->general = htonl(general);
+    header->instance = htonl(instance);
+    header->decision = htonl(decision);
+    header->time_sec = htonl(now.tv_sec);
+    header->time_usec = htonl(now.tv_usec);
+    memcpy(header->digest, digest, DIGEST_SIZE);
+    header->num_chains = htonl(chains.size());
+
+    char *next = &record[sizeof(DecisionRecord)];
+    for(size_t i = 0; i < chains.size(); i++) {
+        uint32_t chainLen = htonl(chains[i].size());
+        memcpy(next, &chainLen, sizeof(chainLen));
+        next += sizeof(chainLen);
+        if(!chains[i].empty()) {
+            memcpy(next, &chains[i][0], chains[i].size());
+            next += chains[i].size();
+        }
+    }
+    header->crc = htonl(crc32(&record[0], length));
+
+    pthread_mutex_lock(&(this->lock));
+    if(!this->failed) {
+        // Once writing failed the writer is gone, and the record is dropped: waitDurable() tells so.
+        this->pending.push_back(vector<char>());
+        this->pending.back().swap(record);
+    }
+    uint64_t seq = ++(this->numAppended);
+    pthread_cond_signal(&(this->recordsPending));
+    pthread_mutex_unlock(&(this->lock));
+    return seq;
+}
+
+// Runs the writer thread.
+void *DecisionLog::writerMain(void *arg) {
+    ((DecisionLog *) arg)->writeBatches();
+    return NULL;
+}
+
+// Writes and syncs the pending records, a batch at a time.
+// Records handed over while a batch is being synced make up the next batch.
+// The writer stops at the first batch that fails: a record written in part is cut off again if possible, and
+// nothing is appended behind it otherwise, so that it stays a torn record at the end of the log.
+void DecisionLog::writeBatches() {
+    pthread_mutex_lock(&(this->lock));
+    while(true) {
+        while(this->pending.empty() && !this->closing) {
+            pthread_cond_wait(&(this->recordsPending), &(this->lock));
+        }
+        if(this->pending.empty()) {
+            break;
+        }
+
+        deque<vector<char> > batch;
+        batch.swap(this->pending);
+        pthread_mutex_unlock(&(this->lock));
+
+        struct stat info;
+        bool ok = (fstat(this->fd, &info) == 0);
+        off_t start = ok ? info.st_size : -1; // Where the batch starts.
+        for(size_t i = 0; i < batch.size() && ok; i++) {
+            ok = writeAll(this->fd, &(batch[i][0]), batch[i].size());
+        }
+        if(ok && fdatasync(this->fd) == -1) {
+            ok = false;
+        }
+        if(!ok) {
+            perror("Failed to write the decision log");
+            if(start >= 0 && ftruncate(this->fd, start) == 0) {
+                fdatasync(this->fd);
+            }
+        }
+
+        pthread_mutex_lock(&(this->lock));
+        if(!ok) {
+            fprintf(stderr, "The decision log stops being written.\n");
+            this->failed = true;
+            this->pending.clear();
+            pthread_cond_broadcast(&(this->recordsDurable));
+            break;
+        }
+        this->numDurable += batch.size();
+        this->numBatches++;
+        pthread_cond_broadcast(&(this->recordsDurable));
+    }
+    pthread_mutex_unlock(&(this->lock));
+}
+
+// Waits till the first given number of records are synced.
+// Returns false if writing the log failed.
+bool DecisionLog::waitDurable(uint64_t seq) {
+    pthread_mutex_lock(&(this->lock));
+    while(this->numDurable < seq && this->started && !this->failed) {
+        pthread_cond_wait(&(this->recordsDurable), &(this->lock));
+    }
+    bool ok = !this->failed && this->numDurable >= seq;
+    pthread_mutex_unlock(&(this->lock));
+    return ok;
+}
+
+// Writes and syncs what is pending and stops the writer.
+void DecisionLog::close() {
+    if(this->started) {
+        pthread_mutex_lock(&(this->lock));
+        this->closing = true;
+        pthread_cond_signal(&(this->recordsPending));
+        pthread_mutex_unlock(&(this->lock));
+        pthread_join(this->writer, NULL);
+        this->started = false;
+    }
+    if(this->fd != -1) {
+        ::close(this->fd);
+        this->fd = -1;
+    }
+}
+
+// Returns the number of syncs done.
+uint64_t DecisionLog::getNumBatches() {
+    pthread_mutex_lock(&(this->lock));
+    uint64_t numBatches = this->numBatches;
+    pthread_mutex_unlock(&(this->lock));
+    return numBatches;
+}
+
+// Reads the valid records of a log, up to the first torn or corrupt one.
+// Returns false if the log could not be opened.
+bool DecisionLog::read(const string &path, vector<vector<char> > &records) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd == -1) {
+        return false;
+    }
+
+    vector<char> record;
+    while(readRecord(fd, record) == RECORD_INTACT) {
+        records.push_back(record);
+    }
+    ::close(fd);
+    return true;
+}
+
+// Computes the CRC-32 (IEEE 802.3) of some bytes.
+uint32_t DecisionLog::crc32(const char *bytes, size_t len) {
+    uint32_t crc = 0xffffffff;
+    for(size_t i = 0; i < len; i++) {
+        crc ^= (uint8_t) bytes[i];
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
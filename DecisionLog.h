@@ -0,0 +1,85 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class DecisionLog. |
+|
+| The decision log is an append-only file of the decisions a general |
+| has taken, each with the signature chains it rests on. Records are |
+| handed to a writer thread, which writes all that have piled up and |
+| syncs them with one fdatasync(): the cost of durability is paid per |
+| batch of decisions, and never in the round loop. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef DECISION_LOG_H
+#define DECISION_LOG_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdint.h>
+#include <pthread.h>
+#include "message_format.h"
+
+#define DECISION_LOG_MAGIC 0x42474443 // "BGDC"
+#define MAX_RECORD_SIZE (64 * 1024 * 1024)
+
+// What reading a record found.
+#define RECORD_INTACT 0  // A whole record, with the right CRC.
+#define RECORD_END 1     // The end of the log, right after the last record.
+#define RECORD_TORN 2    // The log ends within the record.
+#define RECORD_CORRUPT 3 // A record that is all there but has a wrong magic number, length or CRC.
+
+// Layout of a record (all fields in network byte order):
+// DecisionRecord, then num_chains times a uint32_t length followed by a SignedMessage of that length.
+typedef struct {
+    uint32_t magic;              // Must be equal to DECISION_LOG_MAGIC.
+    uint32_t length;             // Length of the record, this header included.
+    uint32_t crc;                // CRC-32 of the record, computed with this field set to 0.
+    uint32_t general;            // Identifier of the general that decided.
+    uint32_t instance;           // Agreement instance decided.
+    uint32_t decision;           // ATTACK, RETREAT or OPAQUE_VALUE.
+    uint32_t time_sec;           // When the decision was taken.
+    uint32_t time_usec;
+    uint8_t digest[DIGEST_SIZE]; // Digest of the value decided on.
+    uint32_t num_chains;         // Number of signature chains that follow.
+} DecisionRecord;
+
+// Class definition.
+class DecisionLog {
+
+    private:
+        int fd;                                  // File descriptor of the log.
+        std::string path;                        // Path of the log.
+        std::deque<std::vector<char> > pending;  // Records handed over but not written yet.
+        uint64_t numAppended;                    // Number of records handed over.
+        uint64_t numDurable;                     // Number of records written and synced.
+        uint64_t numBatches;                     // Number of syncs done.
+        bool closing;                            // Should the writer stop once the pending records are written?
+        bool failed;                             // Did a write or a sync fail? The writer stops then.
+        pthread_mutex_t lock;                    // Guards everything above but fd and path.
+        pthread_cond_t recordsPending;           // Signalled when records are handed over or the log is closed.
+        pthread_cond_t recordsDurable;           // Signalled when a batch has been synced.
+        pthread_t writer;                        // The writer thread.
+        bool started;                            // Was the writer thread started?
+
+        static void *writerMain(void *);         // Runs the writer thread.
+        void writeBatches();                     // Writes and syncs the pending records, a batch at a time.
+        bool recover() throw(std::string);       // Drops a torn record from the end of the log, and refuses a corrupt log.
+        DecisionLog(const DecisionLog &);            // Not copyable.
+        DecisionLog &operator=(const DecisionLog &); // Not assignable.
+
+    public:
+        DecisionLog();  // Constructor to initialize variables.
+        ~DecisionLog(); // Destructor to close the log.
+
+        void open(const std::string &) throw(std::string); // Opens (or creates) a log and starts the writer thread.
+        uint64_t append(uint32_t, uint32_t, int, const uint8_t *, const std::vector<std::vector<char> > &); // Hands a decision over to the writer.
+        bool waitDurable(uint64_t);                        // Waits till the first given number of records are synced.
+        void close();                                      // Writes and syncs what is pending and stops the writer.
+        uint64_t getNumBatches();                          // Returns the number of syncs done.
+
+        static bool read(const std::string &, std::vector<std::vector<char> > &); // Reads the valid records of a log.
+        static uint32_t crc32(const char *, size_t);                             // Computes the CRC-32 of some bytes.
+};
+
+#endif
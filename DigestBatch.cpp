@@ -0,0 +1,387 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the batched SHA-256 digests. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstring>
+#include <algorithm>
+#include "DigestBatch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DIGEST_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define SHA256_BLOCK_SIZE 64
+
+using namespace std;
+
+typedef void (*CompressFunction)(uint32_t *, const uint8_t *, size_t); // Hashes whole blocks into a state.
+
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t SHA256_H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+// Does the CPU have what an engine runs on?
+static bool cpuHas(int engine) {
+    if(engine == DIGEST_ENGINE_SCALAR) {
+        return true;
+    }
+#ifdef DIGEST_X86
+    __builtin_cpu_init();
+    if(engine == DIGEST_ENGINE_AVX2) {
+        return __builtin_cpu_supports("avx2");
+    }
+    unsigned int eax, ebx, ecx, edx;
+    if(engine == DIGEST_ENGINE_SHA_NI) {
+        return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA) && __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return false;
+}
+
+int DigestBatch::engine = DigestBatch::detectEngine();
+
+// Reads a big endian word.
+static inline uint32_t loadBigEndian(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+// Writes a big endian word.
+static inline void storeBigEndian(uint8_t *p, uint32_t word) {
+    p[0] = (uint8_t) (word >> 24);
+    p[1] = (uint8_t) (word >> 16);
+    p[2] = (uint8_t) (word >> 8);
+    p[3] = (uint8_t) word;
+}
+
+// Writes a state out as a digest.
+static void storeDigest(const uint32_t *state, uint8_t *digest) {
+    for(int i = 0; i < 8; i++) {
+        storeBigEndian(digest + 4 * i, state[i]);
+    }
+}
+
+// Pads the bytes of a message past its last whole block into the blocks that end it (two at most).
+// Returns the number of those blocks.
+static size_t pad(const uint8_t *data, size_t length, uint8_t *tail) {
+    size_t rest = length % SHA256_BLOCK_SIZE;
+    size_t numBlocks = (rest + 9 > SHA256_BLOCK_SIZE) ? 2 : 1;
+    memset(tail, 0, numBlocks * SHA256_BLOCK_SIZE);
+    memcpy(tail, data + length - rest, rest);
+    tail[rest] = 0x80;
+
+    uint64_t bits = (uint64_t) length * 8;
+    uint8_t *end = tail + numBlocks * SHA256_BLOCK_SIZE - 8;
+    storeBigEndian(end, (uint32_t) (bits >> 32));
+    storeBigEndian(end + 4, (uint32_t) bits);
+    return numBlocks;
+}
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Hashes whole blocks into a state, in plain C++.
+static void compressScalar(uint32_t *state, const uint8_t *blocks, size_t numBlocks) {
+    for(size_t b = 0; b < numBlocks; b++, blocks += SHA256_BLOCK_SIZE) {
+        uint32_t w[64];
+        for(int t = 0; t < 16; t++) {
+            w[t] = loadBigEndian(blocks + 4 * t);
+        }
+        for(int t = 16; t < 64; t++) {
+            uint32_t s0 = ROTR(w[t - 15], 7) ^ ROTR(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = ROTR(w[t - 2], 17) ^ ROTR(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+
+        uint32_t a = state[0], b1 = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+        for(int t = 0; t < 64; t++) {
+            uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[t] + w[t];
+            uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b1) ^ (a & c) ^ (b1 & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b1;
+            b1 = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b1;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef DIGEST_X86
+// Hashes whole blocks into a state with the SHA extensions: four rounds per pair of sha256rnds2,
+// on the state split in ABEF and CDGH, and the message schedule four words at a time.
+__attribute__((target("sha,sse4.1")))
+static void compressShaNi(uint32_t *state, const uint8_t *blocks, size_t numBlocks) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[0]), 0xb1); // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[4]), 0x1b); // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);    // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);         // CDGH
+
+    for(size_t b = 0; b < numBlocks; b++, blocks += SHA256_BLOCK_SIZE) {
+        __m128i saved0 = state0, saved1 = state1;
+        __m128i msgs[4];
+        for(int i = 0; i < 16; i++) {
+            __m128i &msg = msgs[i & 3];
+            if(i < 4) {
+                msg = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (blocks + 16 * i)), byteSwap);
+            } else {
+                // Words 4i..4i+3 from those 16, 15, 7 and 2 before them.
+                __m128i w7 = _mm_alignr_epi8(msgs[(i - 1) & 3], msgs[(i - 2) & 3], 4);
+                msg = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(msg, msgs[(i - 3) & 3]), w7), msgs[(i - 1) & 3]);
+            }
+            __m128i words = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i *) &SHA256_K[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, words);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(words, 0x0e));
+        }
+        state0 = _mm_add_epi32(state0, saved0);
+        state1 = _mm_add_epi32(state1, saved1);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);      // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);   // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0); // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);   // HGFE
+    _mm_storeu_si128((__m128i *) &state[0], state0);
+    _mm_storeu_si128((__m128i *) &state[4], state1);
+}
+
+#define ROTR256(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+
+// Hashes up to DIGEST_BATCH_LANES messages side by side with AVX2, a message per 32-bit lane.
+// Every lane goes through as many blocks as the longest message has. A lane whose message is over
+// has its digest taken when it is, and goes on hashing its last block again, to no effect.
+__attribute__((target("avx2")))
+static void hashLanesAvx2(const DigestJob *const *lanes, int numLanes) {
+    uint8_t tails[DIGEST_BATCH_LANES][2 * SHA256_BLOCK_SIZE];
+    size_t wholeBlocks[DIGEST_BATCH_LANES], numBlocks[DIGEST_BATCH_LANES], maxBlocks = 0;
+    for(int lane = 0; lane < DIGEST_BATCH_LANES; lane++) {
+        if(lane < numLanes) {
+            wholeBlocks[lane] = lanes[lane]->length / SHA256_BLOCK_SIZE;
+            numBlocks[lane] = wholeBlocks[lane] + pad(lanes[lane]->data, lanes[lane]->length, tails[lane]);
+            maxBlocks = max(maxBlocks, numBlocks[lane]);
+        } else {
+            wholeBlocks[lane] = 0;
+            numBlocks[lane] = 1;
+            memset(tails[lane], 0, SHA256_BLOCK_SIZE);
+        }
+    }
+
+    const __m256i byteSwap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                             12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i state[8];
+    for(int i = 0; i < 8; i++) {
+        state[i] = _mm256_set1_epi32((int) SHA256_H0[i]);
+    }
+
+    for(size_t b = 0; b < maxBlocks; b++) {
+        const uint8_t *blocks[DIGEST_BATCH_LANES];
+        for(int lane = 0; lane < DIGEST_BATCH_LANES; lane++) {
+            size_t block = min(b, numBlocks[lane] - 1);
+            blocks[lane] = (block < wholeBlocks[lane]) ? lanes[lane]->data + block * SHA256_BLOCK_SIZE
+                                                       : tails[lane] + (block - wholeBlocks[lane]) * SHA256_BLOCK_SIZE;
+        }
+
+        // Load the block of every lane as a row and transpose: word t of every lane is then in w[t].
+        __m256i w[16];
+        for(int half = 0; half < 2; half++) {
+            __m256i r[8], t[8], u[8];
+            for(int lane = 0; lane < 8; lane++) {
+                r[lane] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (blocks[lane] + 32 * half)), byteSwap);
+            }
+            for(int i = 0; i < 8; i += 2) {
+                t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+                t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+            }
+            for(int i = 0; i < 8; i += 4) {
+                u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+                u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+                u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+                u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+            }
+            for(int i = 0; i < 4; i++) {
+                w[8 * half + i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+                w[8 * half + i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+            }
+        }
+
+        __m256i a = state[0], b1 = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+        for(int t = 0; t < 64; t++) {
+            if(t >= 16) {
+                __m256i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR256(w15, 7), ROTR256(w15, 18)), _mm256_srli_epi32(w15, 3));
+                __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR256(w2, 17), ROTR256(w2, 19)), _mm256_srli_epi32(w2, 10));
+                w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+            }
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR256(e, 6), ROTR256(e, 11)), ROTR256(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, s1), _mm256_add_epi32(ch, _mm256_add_epi32(w[t & 15], _mm256_set1_epi32((int) SHA256_K[t]))));
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR256(a, 2), ROTR256(a, 13)), ROTR256(a, 22));
+            __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b1), _mm256_and_si256(c, _mm256_or_si256(a, b1)));
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b1;
+            b1 = a;
+            a = _mm256_add_epi32(t1, _mm256_add_epi32(s0, maj));
+        }
+        state[0] = _mm256_add_epi32(state[0], a);
+        state[1] = _mm256_add_epi32(state[1], b1);
+        state[2] = _mm256_add_epi32(state[2], c);
+        state[3] = _mm256_add_epi32(state[3], d);
+        state[4] = _mm256_add_epi32(state[4], e);
+        state[5] = _mm256_add_epi32(state[5], f);
+        state[6] = _mm256_add_epi32(state[6], g);
+        state[7] = _mm256_add_epi32(state[7], h);
+
+        // Take the digests of the messages that are over.
+        uint32_t words[8][DIGEST_BATCH_LANES];
+        bool stored = false;
+        for(int lane = 0; lane < numLanes; lane++) {
+            if(numBlocks[lane] != b + 1) {
+                continue;
+            }
+            if(!stored) {
+                for(int i = 0; i < 8; i++) {
+                    _mm256_storeu_si256((__m256i *) words[i], state[i]);
+                }
+                stored = true;
+            }
+            for(int i = 0; i < 8; i++) {
+                storeBigEndian(lanes[lane]->digest + 4 * i, words[i][lane]);
+            }
+        }
+    }
+}
+#endif
+
+// Constructor to initialize variables.
+DigestBatch::DigestBatch() {
+    this->numJobs = 0;
+}
+
+// Adds a message to hash, and where its digest goes. The message must stay as it is till compute().
+// A full batch is computed first.
+void DigestBatch::add(const void *data, size_t length, uint8_t *digest) {
+    if(this->numJobs == MAX_DIGEST_BATCH) {
+        compute();
+    }
+    DigestJob &job = this->jobs[this->numJobs++];
+    job.data = (const uint8_t *) data;
+    job.length = length;
+    job.numBlocks = (length + 9 + SHA256_BLOCK_SIZE - 1) / SHA256_BLOCK_SIZE;
+    job.digest = digest;
+}
+
+// Computes the digests of the messages added, and empties the batch.
+void DigestBatch::compute() {
+    if(engine == DIGEST_ENGINE_AVX2 && this->numJobs > 1) {
+        computeLanes();
+    } else {
+        for(size_t i = 0; i < this->numJobs; i++) {
+            hashOne(this->jobs[i], engine);
+        }
+    }
+    this->numJobs = 0;
+}
+
+// Hashes the messages DIGEST_BATCH_LANES at a time with AVX2. They are ordered by length first,
+// so that the messages hashed side by side are over at about the same block. A message left on
+// its own is hashed in plain C++, which is faster for one.
+// The messages of a chain grow by a signature each, so they mostly come in order already, and an
+// insertion sort of them costs next to nothing.
+void DigestBatch::computeLanes() {
+#ifdef DIGEST_X86
+    const DigestJob *order[MAX_DIGEST_BATCH];
+    for(size_t i = 0; i < this->numJobs; i++) {
+        const DigestJob *job = &(this->jobs[i]);
+        size_t j = i;
+        while(j > 0 && order[j - 1]->numBlocks > job->numBlocks) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = job;
+    }
+
+    for(size_t first = 0; first < this->numJobs; first += DIGEST_BATCH_LANES) {
+        int numLanes = (int) ((this->numJobs - first < DIGEST_BATCH_LANES) ? this->numJobs - first : DIGEST_BATCH_LANES);
+        if(numLanes == 1) {
+            hashOne(*order[first], DIGEST_ENGINE_SCALAR);
+            continue;
+        }
+        hashLanesAvx2(&order[first], numLanes);
+    }
+#endif
+}
+
+// Hashes a message with the engine given: its whole blocks straight from it, then the blocks that pad it.
+void DigestBatch::hashOne(const DigestJob &job, int engine) {
+    CompressFunction compress = compressScalar;
+#ifdef DIGEST_X86
+    if(engine == DIGEST_ENGINE_SHA_NI) {
+        compress = compressShaNi;
+    }
+#endif
+    uint32_t state[8];
+    memcpy(state, SHA256_H0, sizeof(state));
+    size_t wholeBlocks = job.length / SHA256_BLOCK_SIZE;
+    compress(state, job.data, wholeBlocks);
+
+    uint8_t tail[2 * SHA256_BLOCK_SIZE];
+    compress(state, tail, pad(job.data, job.length, tail));
+    storeDigest(state, job.digest);
+}
+
+// Computes the digest of a single message.
+void DigestBatch::digest(const void *data, size_t length, uint8_t *digest) {
+    DigestJob job;
+    job.data = (const uint8_t *) data;
+    job.length = length;
+    job.numBlocks = 0;
+    job.digest = digest;
+    hashOne(job, (engine == DIGEST_ENGINE_AVX2) ? DIGEST_ENGINE_SCALAR : engine);
+}
+
+// Picks an engine (DIGEST_ENGINE_*), to compare them or to keep off one that is slower on a CPU.
+// Returns false, and leaves the engine as it is, if the CPU lacks it.
+bool DigestBatch::setEngine(int engine) {
+    if(!cpuHas(engine)) {
+        return false;
+    }
+    DigestBatch::engine = engine;
+    return true;
+}
+
+// Returns the fastest engine the CPU has: the SHA extensions, AVX2 (for more than one message at a time),
+// or plain C++.
+int DigestBatch::detectEngine() {
+    if(cpuHas(DIGEST_ENGINE_SHA_NI)) {
+        return DIGEST_ENGINE_SHA_NI;
+    }
+    return cpuHas(DIGEST_ENGINE_AVX2) ? DIGEST_ENGINE_AVX2 : DIGEST_ENGINE_SCALAR;
+}
@@ -0,0 +1,64 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class DigestBatch. |
+|
+| A digest batch computes the SHA-256 digests of many short messages |
+| at once, for the signatures of a chain. The engine is picked for the |
+| CPU at startup: the SHA extensions (SHA-NI) hash one message after |
+| the other in hardware; AVX2 hashes DIGEST_BATCH_LANES messages side |
+| by side, a message per 32-bit lane, so that a chain costs about as |
+| much as its longest signed message; anything else hashes them one |
+| after the other in plain C++. Every engine gives the same digests. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef DIGEST_BATCH_H
+#define DIGEST_BATCH_H
+
+#include <cstddef>
+#include <stdint.h>
+#include "message_format.h"
+
+#define DIGEST_BATCH_LANES 8 // Messages AVX2 hashes side by side.
+#define MAX_DIGEST_BATCH 256 // Messages a batch holds: a signature of each general of a chain (MAX_GENERALS).
+
+#define DIGEST_ENGINE_SCALAR 0
+#define DIGEST_ENGINE_AVX2 1
+#define DIGEST_ENGINE_SHA_NI 2
+
+// A message to hash, and where its digest goes.
+typedef struct {
+    const uint8_t *data; // The message.
+    size_t length;       // Its length.
+    size_t numBlocks;    // Blocks of 64 bytes it is hashed in, padding included.
+    uint8_t *digest;     // Where its digest goes (DIGEST_SIZE bytes).
+} DigestJob;
+
+// Class definition.
+class DigestBatch {
+
+    private:
+        DigestJob jobs[MAX_DIGEST_BATCH]; // The messages to hash.
+        size_t numJobs;                   // Number of messages added.
+
+        static int engine; // Engine the digests are computed with.
+
+        void computeLanes();                         // Hashes the messages DIGEST_BATCH_LANES at a time with AVX2.
+        static void hashOne(const DigestJob &, int); // Hashes a message with the engine given.
+        static int detectEngine();                   // Returns the fastest engine the CPU has.
+        DigestBatch(const DigestBatch &);            // Not copyable.
+        DigestBatch &operator=(const DigestBatch &); // Not assignable.
+
+    public:
+        DigestBatch(); // Constructor to initialize variables.
+
+        void add(const void *, size_t, uint8_t *); // Adds a message to hash, and where its digest goes.
+        void compute();                            // Computes the digests of the messages added, and empties the batch.
+        size_t size() const { return this->numJobs; } // Returns the number of messages added.
+
+        static void digest(const void *, size_t, uint8_t *); // Computes the digest of a single message.
+        static bool setEngine(int);                          // Picks an engine (DIGEST_ENGINE_*). Returns false if the CPU lacks it.
+        static int getEngine() { return engine; }            // Returns the engine the digests are computed with.
+};
+
+#endif
@@ -0,0 +1,476 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the fragmentation and reassembly of messages |
+| that do not fit in a single datagram. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstdio>
+#include <cstring>
+#include "General.h"
+
+using namespace std;
+
+#define SEND_STATES_PER_PEER 4 // Messages that may be in flight to a general at once (forwarded chains and payloads).
+
+// Constructor to initialize variables.
+Fragmenter::Fragmenter() {
+    this->socketFD = -1;
+    this->instance = 0;
+    this->nextMsgId = 1;
+    this->maxMessageLen = 0;
+    this->reassemblyBytes = 0;
+    this->clock = 0;
+    this->nextCompleted = 0;
+    this->adversary = NULL;
+    this->local = NULL;
+    this->capture = NULL;
+    this->heldPeer = NO_PEER;
+    memset(this->completed, 0, sizeof(this->completed));
+}
+
+// Sets the socket, the instance, the number of generals, the longest message and the pacing rate (bytes per second, 0 for none).
+void Fragmenter::init(int socketFD, uint32_t instance, uint32_t numGenerals, size_t maxMessageLen, uint64_t pacingRate) {
+    this->socketFD = socketFD;
+    this->instance = instance;
+    this->maxMessageLen = maxMessageLen;
+    this->pacer.init(pacingRate, PACING_BURST);
+
+    SendState idle;
+    idle.msg = NULL;
+    idle.msgId = 0;
+    idle.numAcked = 0;
+    this->sends.assign((numGenerals + 1) * SEND_STATES_PER_PEER, idle);
+
+    Outbox empty;
+    empty.length = 0;
+    empty.count = 0;
+    empty.listed = false;
+    empty.tracked = false;
+    this->outboxes.assign(numGenerals + 1, empty);
+    this->queued.clear();
+
+    Reassembly freeSlot;
+    freeSlot.peerId = NO_PEER;
+    freeSlot.msgId = 0;
+    freeSlot.count = 0;
+    freeSlot.numReceived = 0;
+    freeSlot.totalLen = 0;
+    freeSlot.lastUsed = 0;
+    this->slots.assign(MAX_REASSEMBLY_SLOTS, freeSlot);
+
+    // Seed the message ids so that a restarted general does not reuse the ids of its last run.
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    this->nextMsgId = (uint32_t) (now.tv_sec * 1000000 + now.tv_usec);
+}
+
+// Sends a message (in fragments if needed) to a general.
+int Fragmenter::send(const void *msg, size_t msgLen, uint32_t peerId, const struct sockaddr_in &address) {
+    struct iovec iov;
+    iov.iov_base = (void *) msg;
+    iov.iov_len = msgLen;
+    return send(&iov, 1, msgLen, peerId, address);
+}
+
+// Sends a message gathered from iovecs (in fragments if needed) to a general. The message is never copied:
+// a fragment is gathered from the pieces of the iovecs it spans. The first iovec stands for the message in
+// forget(), and must not move while the message is being sent.
+// A message sent again to the same general only sends the fragments that have not been acknowledged.
+// A message short enough to share a datagram is queued to go out in the next bundle to the general instead.
+// When sending is paced, every datagram waits for its tokens.
+// Returns SEND_QUEUED if the message was queued, SEND_FAILED if a datagram could not be sent and SEND_DONE otherwise.
+int Fragmenter::send(const struct iovec *iov, int iovcnt, size_t msgLen, uint32_t peerId, const struct sockaddr_in &address) {
+    if(msgLen <= MAX_BUNDLED_LEN) {
+        queue(iov, iovcnt, msgLen, peerId, address);
+        return SEND_QUEUED;
+    }
+
+    // Other messages that fit a datagram are sent as they are.
+    if(msgLen <= MAX_DATAGRAM_SIZE) {
+        this->pacer.wait(msgLen);
+        return transmit(iov, iovcnt, peerId, address);
+    }
+    const void *msg = iov[0].iov_base;
+
+    uint32_t count = (msgLen + MAX_FRAGMENT_DATA - 1) / MAX_FRAGMENT_DATA;
+
+    // Find what was sent of this message to the general, or start over in an idle or the least recent state.
+    SendState *first = &(this->sends[peerId * SEND_STATES_PER_PEER]);
+    SendState *state = NULL, *victim = first;
+    for(int i = 0; i < SEND_STATES_PER_PEER; i++) {
+        SendState *candidate = first + i;
+        if(candidate->msg == msg) {
+            state = candidate;
+            break;
+        }
+        if(victim->msg != NULL && (candidate->msg == NULL || candidate->msgId < victim->msgId)) {
+            victim = candidate;
+        }
+    }
+    if(state == NULL) {
+        state = victim;
+        state->msg = msg;
+        state->msgId = this->nextMsgId++;
+        state->numAcked = 0;
+        state->acked.assign(count, 0);
+    }
+
+    char header[sizeof(Fragment)];
+    Fragment *fragment = (Fragment *) header;
+    fragment->type = htonl(TYPE_FRAGMENT);
+    fragment->instance = htonl(this->instance);
+    fragment->msg_id = htonl(state->msgId);
+    fragment->count = htonl(count);
+    fragment->total_len = htonl(msgLen);
+
+    for(uint32_t index = 0; index < count; index++) {
+        if(state->acked[index]) {
+            continue;
+        }
+
+        size_t offset = index * MAX_FRAGMENT_DATA;
+        size_t dataLen = (msgLen - offset < MAX_FRAGMENT_DATA) ? msgLen - offset : MAX_FRAGMENT_DATA;
+        fragment->index = htonl(index);
+
+        // The fragment header, then the pieces of the iovecs that hold bytes offset to offset + dataLen.
+        this->parts.resize(iovcnt + 1);
+        this->parts[0].iov_base = header;
+        this->parts[0].iov_len = sizeof(Fragment);
+        int numParts = 1;
+        size_t start = 0;
+        for(int i = 0; i < iovcnt && start < offset + dataLen; start += iov[i].iov_len, i++) {
+            size_t end = start + iov[i].iov_len;
+            if(end <= offset) {
+                continue;
+            }
+            size_t from = (offset > start) ? offset - start : 0;
+            size_t to = (offset + dataLen < end) ? offset + dataLen - start : iov[i].iov_len;
+            this->parts[numParts].iov_base = (char *) iov[i].iov_base + from;
+            this->parts[numParts].iov_len = to - from;
+            numParts++;
+        }
+        this->pacer.wait(sizeof(Fragment) + dataLen);
+
+        if(transmit(&(this->parts[0]), numParts, peerId, address) == -1) {
+            return SEND_FAILED;
+        }
+    }
+    return SEND_DONE;
+}
+
+// Records the fragment ACK of a general.
+void Fragmenter::handleAck(FragmentAck *ack, uint32_t peerId) {
+    uint32_t msgId = ntohl(ack->msg_id);
+    uint32_t index = ntohl(ack->index);
+
+    SendState *state = &(this->sends[peerId * SEND_STATES_PER_PEER]);
+    for(int i = 0; i < SEND_STATES_PER_PEER; i++, state++) {
+        if(state->msg != NULL && state->msgId == msgId) {
+            if(index < state->acked.size() && !state->acked[index]) {
+                state->acked[index] = 1;
+                state->numAcked++;
+            }
+            return;
+        }
+    }
+}
+
+// Adds a fragment received from a general, after acknowledging it.
+// Returns the message (in network byte order) once all its fragments have arrived, and NULL before that.
+// The message returned is valid until the next call.
+char *Fragmenter::handleFragment(Fragment *fragment, ssize_t numBytes, uint32_t peerId, const struct sockaddr_in &address, size_t *msgLen) {
+    if(numBytes < (ssize_t) sizeof(Fragment)) {
+        return NULL;
+    }
+
+    uint32_t msgId = ntohl(fragment->msg_id);
+    uint32_t index = ntohl(fragment->index);
+    uint32_t count = ntohl(fragment->count);
+    uint32_t totalLen = ntohl(fragment->total_len);
+
+    // Do some sanity check on the fragment.
+    if(totalLen <= MAX_DATAGRAM_SIZE || totalLen > this->maxMessageLen || count != (totalLen + MAX_FRAGMENT_DATA - 1) / MAX_FRAGMENT_DATA || index >= count) {
+        return NULL;
+    }
+    size_t offset = index * MAX_FRAGMENT_DATA;
+    size_t dataLen = (totalLen - offset < MAX_FRAGMENT_DATA) ? totalLen - offset : MAX_FRAGMENT_DATA;
+    if((size_t) numBytes != sizeof(Fragment) + dataLen) {
+        return NULL;
+    }
+
+    sendFragmentAck(fragment, peerId, address);
+
+    // Drop the late fragments of a message that was already reassembled.
+    uint64_t key = ((uint64_t) peerId << 32) | msgId;
+    for(int i = 0; i < COMPLETED_HISTORY; i++) {
+        if(this->completed[i] == key) {
+            return NULL;
+        }
+    }
+
+    Reassembly *slot = findSlot(peerId, msgId, count, totalLen);
+    if(slot == NULL) {
+        return NULL;
+    }
+
+    slot->lastUsed = ++(this->clock);
+    if(!slot->received[index]) {
+        memcpy(&(slot->data[offset]), fragment->data, dataLen);
+        slot->received[index] = 1;
+        slot->numReceived++;
+    }
+
+    if(slot->numReceived < slot->count) {
+        return NULL;
+    }
+
+    // All fragments are in. The slot is freed, but its buffer stays as it is till it is claimed again.
+    this->completed[this->nextCompleted] = key;
+    this->nextCompleted = (this->nextCompleted + 1) % COMPLETED_HISTORY;
+    *msgLen = slot->totalLen;
+    releaseSlot(slot);
+    return &(slot->data[0]);
+}
+
+// Finds the slot of a message or claims one for it, evicting the least recently used messages
+// if there is no free slot or the slots would hold more than MAX_REASSEMBLY_BYTES.
+Fragmenter::Reassembly *Fragmenter::findSlot(uint32_t peerId, uint32_t msgId, uint32_t count, uint32_t totalLen) {
+    for(size_t i = 0; i < this->slots.size(); i++) {
+        Reassembly &slot = this->slots[i];
+        if(slot.peerId == peerId && slot.msgId == msgId) {
+            return (slot.count == count && slot.totalLen == totalLen) ? &slot : NULL;
+        }
+    }
+
+    if(totalLen > MAX_REASSEMBLY_BYTES) {
+        return NULL;
+    }
+
+    Reassembly *freeSlot = NULL;
+    while(true) {
+        Reassembly *lru = NULL;
+        freeSlot = NULL;
+        for(size_t i = 0; i < this->slots.size(); i++) {
+            Reassembly &slot = this->slots[i];
+            if(slot.peerId == NO_PEER) {
+                freeSlot = &slot;
+            } else if(lru == NULL || slot.lastUsed < lru->lastUsed) {
+                lru = &slot;
+            }
+        }
+
+        if(freeSlot != NULL && this->reassemblyBytes + totalLen <= MAX_REASSEMBLY_BYTES) {
+            break;
+        }
+        releaseSlot(lru);
+    }
+
+    freeSlot->peerId = peerId;
+    freeSlot->msgId = msgId;
+    freeSlot->count = count;
+    freeSlot->numReceived = 0;
+    freeSlot->totalLen = totalLen;
+    freeSlot->received.assign(count, 0);
+    freeSlot->data.resize(totalLen);
+    this->reassemblyBytes += totalLen;
+    return freeSlot;
+}
+
+// Frees a reassembly slot (keeping its buffers for the next message).
+void Fragmenter::releaseSlot(Reassembly *slot) {
+    this->reassemblyBytes -= slot->totalLen;
+    slot->peerId = NO_PEER;
+    slot->totalLen = 0;
+}
+
+// Acknowledges a fragment to its sender. The ACKs of the fragments of a pass go out together.
+void Fragmenter::sendFragmentAck(const Fragment *fragment, uint32_t peerId, const struct sockaddr_in &address) {
+    FragmentAck ack;
+    ack.type = htonl(TYPE_FRAGMENT_ACK);
+    ack.instance = fragment->instance;
+    ack.msg_id = fragment->msg_id; // Already in network byte order.
+    ack.index = fragment->index;
+    sendDatagram(&ack, sizeof(ack), peerId, address);
+}
+
+// Forgets what was sent of one message, when it is released.
+void Fragmenter::forget(const void *msg) {
+    for(size_t i = 0; i < this->sends.size(); i++) {
+        if(this->sends[i].msg == msg) {
+            this->sends[i].msg = NULL;
+        }
+    }
+}
+
+// Sends a message that needs no fragmenting (an ACK or a request) to a general. It goes out in his next bundle.
+int Fragmenter::sendDatagram(const void *datagram, size_t len, uint32_t peerId, const struct sockaddr_in &address) {
+    struct iovec iov;
+    iov.iov_base = (void *) datagram;
+    iov.iov_len = len;
+    return send(&iov, 1, len, peerId, address);
+}
+
+// Queues a message (at most MAX_BUNDLED_LEN bytes) for a general, to go out in his next bundle.
+// A bundle that has no room left for it is sent first.
+void Fragmenter::queue(const struct iovec *iov, int iovcnt, size_t msgLen, uint32_t peerId, const struct sockaddr_in &address) {
+    Outbox &outbox = this->outboxes[peerId];
+    size_t recordSize = BUNDLE_RECORD_SIZE(msgLen);
+    if(outbox.count > 0 && outbox.length + recordSize > MAX_DATAGRAM_SIZE && sendBundle(peerId) == -1) {
+        perror("Failed to send a bundle: sendmsg() failed");
+    }
+    if(outbox.count == 0) {
+        outbox.bundle.resize(MAX_DATAGRAM_SIZE);
+        outbox.length = sizeof(Bundle);
+        outbox.address = address;
+    }
+    if(!outbox.listed) {
+        outbox.listed = true;
+        this->queued.push_back(peerId);
+    }
+
+    // The length, then the message, then zeros up to the next multiple of 4 bytes.
+    char *record = &(outbox.bundle[outbox.length]);
+    uint32_t netLen = htonl(msgLen);
+    memcpy(record, &netLen, sizeof(netLen));
+    char *next = record + sizeof(netLen);
+    for(int i = 0; i < iovcnt; i++) {
+        memcpy(next, iov[i].iov_base, iov[i].iov_len);
+        next += iov[i].iov_len;
+    }
+    memset(next, 0, record + recordSize - next);
+    outbox.length += recordSize;
+    outbox.count++;
+}
+
+// Sends the messages queued for a general: a lone message as it is, several in a bundle.
+// Returns -1 if the datagram could not be sent.
+int Fragmenter::sendBundle(uint32_t peerId) {
+    Outbox &outbox = this->outboxes[peerId];
+    struct iovec iov;
+    if(outbox.count == 1) {
+        uint32_t msgLen;
+        memcpy(&msgLen, &(outbox.bundle[sizeof(Bundle)]), sizeof(msgLen));
+        iov.iov_base = &(outbox.bundle[sizeof(Bundle) + sizeof(msgLen)]);
+        iov.iov_len = ntohl(msgLen);
+    } else {
+        Bundle *bundle = (Bundle *) &(outbox.bundle[0]);
+        bundle->type = htonl(TYPE_BUNDLE);
+        bundle->instance = htonl(this->instance);
+        bundle->count = htonl(outbox.count);
+        iov.iov_base = bundle;
+        iov.iov_len = outbox.length;
+    }
+    outbox.count = 0;
+    outbox.length = 0;
+
+    this->pacer.wait(iov.iov_len);
+    int result = transmit(&iov, 1, peerId, outbox.address);
+    if(outbox.tracked) {
+        SendReport report;
+        report.peerId = peerId;
+        report.sent = (result != -1);
+        this->reports.push_back(report);
+        outbox.tracked = false;
+    }
+    return result;
+}
+
+// Reports whether the bundle of the message just queued for a general goes out, in the next takeReports().
+void Fragmenter::track(uint32_t peerId) {
+    this->outboxes[peerId].tracked = true;
+}
+
+// Hands over the reports since the last call. The vector given is cleared and keeps its capacity for the next call.
+void Fragmenter::takeReports(std::vector<SendReport> &taken) {
+    taken.clear();
+    taken.swap(this->reports);
+}
+
+// Sends the messages queued, one bundle per general. Called once per pass of the receive loop,
+// and before waiting for anything to arrive.
+// A datagram held back to be reordered goes out last, so that it is late but never lost when nothing follows it.
+void Fragmenter::flush() {
+    for(size_t i = 0; i < this->queued.size(); i++) {
+        Outbox &outbox = this->outboxes[this->queued[i]];
+        outbox.listed = false;
+        if(outbox.count > 0 && sendBundle(this->queued[i]) == -1) {
+            perror("Failed to send a bundle: sendmsg() failed");
+        }
+    }
+    this->queued.clear();
+    releaseHeld();
+}
+
+// Injects the transport faults of an adversary.
+void Fragmenter::setAdversary(Adversary *adversary) {
+    this->adversary = adversary;
+}
+
+// Carries the datagrams to co-located generals through shared memory.
+void Fragmenter::setLocal(LocalTransport *local) {
+    this->local = local;
+}
+
+// Captures the datagrams sent.
+void Fragmenter::setCapture(PacketCapture *capture) {
+    this->capture = capture;
+}
+
+// Sends a datagram gathered from iovecs to a general, through the faults of the adversary if any.
+// A datagram held back to be reordered goes out right after the next one, or at the next flush().
+// Returns -1 if it could not be sent.
+int Fragmenter::transmit(const struct iovec *iov, int iovcnt, uint32_t peerId, const struct sockaddr_in &address) {
+    int fault = (this->adversary != NULL) ? this->adversary->transportFault() : TRANSPORT_SEND;
+    if(fault == TRANSPORT_LOSE) {
+        return 0;
+    }
+    if(fault == TRANSPORT_REORDER && this->held.empty()) {
+        for(int i = 0; i < iovcnt; i++) {
+            this->held.insert(this->held.end(), (const char *) iov[i].iov_base, (const char *) iov[i].iov_base + iov[i].iov_len);
+        }
+        this->heldPeer = peerId;
+        this->heldAddress = address;
+        return 0;
+    }
+
+    int result = 0;
+    for(int copies = (fault == TRANSPORT_DUPLICATE) ? 2 : 1; copies > 0; copies--) {
+        if(deliver(iov, iovcnt, peerId, address) == -1) {
+            result = -1;
+        }
+    }
+    releaseHeld();
+    return result;
+}
+
+// Sends the datagram held back to be reordered, if any.
+void Fragmenter::releaseHeld() {
+    if(!this->held.empty()) {
+        struct iovec heldIov;
+        heldIov.iov_base = &(this->held[0]);
+        heldIov.iov_len = this->held.size();
+        deliver(&heldIov, 1, this->heldPeer, this->heldAddress);
+        this->held.clear();
+    }
+}
+
+// Sends a datagram to a general: through shared memory if he is co-located and his ring has room, by UDP otherwise.
+// What goes out is captured, if the datagrams are. Returns -1 if it could not be sent.
+int Fragmenter::deliver(const struct iovec *iov, int iovcnt, uint32_t peerId, const struct sockaddr_in &address) {
+    int result = 0;
+    if(this->local == NULL || !this->local->send(peerId, iov, iovcnt)) {
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_name = (void *) &address;
+        header.msg_namelen = sizeof(address);
+        header.msg_iov = (struct iovec *) iov;
+        header.msg_iovlen = iovcnt;
+        result = (sendmsg(this->socketFD, &header, 0) == -1) ? -1 : 0;
+    }
+
+    if(result == 0 && this->capture != NULL) {
+        this->capture->record(CAPTURE_SENT, peerId, iov, iovcnt);
+    }
+    return result;
+}
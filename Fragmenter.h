@@ -0,0 +1,133 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class Fragmenter. |
+|
+| Messages larger than a datagram that fits the path MTU are split |
+| into fragments, each acknowledged on its own, so that only the lost |
+| fragments are sent again. Received fragments are reassembled in a |
+| bounded set of slots. |
+|
+| Small messages (ACKs, requests, short chains and payloads) are not |
+| sent one datagram each: they are queued per general and go out as |
+| one bundle per general when flush() is called, once per pass of the |
+| receive loop. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef FRAGMENTER_H
+#define FRAGMENTER_H
+
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include "message_format.h"
+#include "Pacer.h"
+#include "Adversary.h"
+#include "LocalTransport.h"
+#include "PacketCapture.h"
+
+#define MAX_DATAGRAM_SIZE 1472                                    // 1500 byte Ethernet MTU - IP header - UDP header.
+#define MAX_FRAGMENT_DATA (MAX_DATAGRAM_SIZE - sizeof(Fragment)) // Message bytes carried by one fragment.
+#define MAX_REASSEMBLY_SLOTS 16                                   // Messages that can be reassembled at the same time.
+#define MAX_REASSEMBLY_BYTES (16 * 1024 * 1024)                   // Bytes that the reassembly slots may hold in total.
+#define COMPLETED_HISTORY 32                                      // Reassembled messages remembered to drop their late fragments.
+#define PACING_BURST (16 * MAX_DATAGRAM_SIZE)                     // Bytes that may go out back to back when sending is paced.
+#define BUNDLE_RECORD_SIZE(len) (sizeof(uint32_t) + (((len) + 3) & ~((size_t) 3))) // Bytes a message of the given length takes in a bundle.
+#define MAX_BUNDLED_LEN (MAX_DATAGRAM_SIZE - sizeof(Bundle) - sizeof(uint32_t))  // Longest message that is bundled.
+
+#define SEND_FAILED -1 // Returned by send() if a datagram could not be sent.
+#define SEND_DONE 0    // Returned by send() once the message has gone out.
+#define SEND_QUEUED 1  // Returned by send() if the message was queued to go out in the next bundle.
+
+// Whether the bundle that held a tracked message went out (see Fragmenter::track()).
+typedef struct {
+    uint32_t peerId; // The general the message was for.
+    bool sent;       // Was the bundle sent?
+} SendReport;
+
+// Class definition.
+class Fragmenter {
+
+    private:
+        // What has been sent of a fragmented message to one general.
+        struct SendState {
+            const void *msg;            // The message (NULL if nothing is being sent).
+            uint32_t msgId;             // Identifier assigned to the message.
+            uint32_t numAcked;          // Number of fragments acknowledged.
+            std::vector<uint8_t> acked; // Which fragments have been acknowledged.
+        };
+
+        // The messages queued for one general, as the bundle they go out in.
+        struct Outbox {
+            std::vector<char> bundle;    // The Bundle (MAX_DATAGRAM_SIZE bytes once anything was queued).
+            size_t length;               // Bytes of it in use.
+            uint32_t count;              // Number of messages queued.
+            bool listed;                 // Is the general in the list of those with messages queued?
+            bool tracked;                // Is the sending of the bundle to be reported?
+            struct sockaddr_in address;  // Where the bundle goes.
+        };
+
+        // A message being reassembled.
+        struct Reassembly {
+            uint32_t peerId;               // Sender of the message (0 if the slot is free).
+            uint32_t msgId;                // Identifier the sender assigned to the message.
+            uint32_t count;                // Total number of fragments.
+            uint32_t numReceived;          // Number of distinct fragments received.
+            uint32_t totalLen;             // Length of the message.
+            unsigned long lastUsed;        // When a fragment last arrived (for eviction).
+            std::vector<uint8_t> received; // Which fragments have been received.
+            std::vector<char> data;        // The message.
+        };
+
+        int socketFD;                      // Socket to send fragments and fragment ACKs on.
+        uint32_t instance;                 // Agreement instance the fragments belong to.
+        uint32_t nextMsgId;                // Identifier of the next message fragmented.
+        size_t maxMessageLen;              // Longest message accepted for reassembly.
+        std::vector<SendState> sends;      // Send state, indexed by general id.
+        std::vector<Reassembly> slots;     // Reassembly slots.
+        size_t reassemblyBytes;            // Bytes claimed by the messages being reassembled.
+        unsigned long clock;               // Counts the fragments received, to order slots by use.
+        uint64_t completed[COMPLETED_HISTORY]; // Recently reassembled (peer id, message id) pairs.
+        uint32_t nextCompleted;            // Where the next completed message is remembered.
+        Pacer pacer;                       // Spaces out the datagrams of messages and fragments.
+        Adversary *adversary;              // Injects transport faults into the datagrams sent (NULL for none).
+        LocalTransport *local;             // Carries the datagrams to co-located generals (NULL if there are none).
+        PacketCapture *capture;            // Where the datagrams sent are captured (NULL if they are not).
+        std::vector<char> held;            // Datagram held back to be sent after the next one.
+        uint32_t heldPeer;                 // Who the held datagram goes to.
+        struct sockaddr_in heldAddress;    // Where he is.
+        std::vector<struct iovec> parts;   // Scratch space for the iovecs of a fragment.
+        std::vector<Outbox> outboxes;      // Messages queued to be bundled, indexed by general id.
+        std::vector<uint32_t> queued;      // Generals with messages queued.
+        std::vector<SendReport> reports;   // Whether the bundles of tracked messages went out, since takeReports().
+
+        Reassembly *findSlot(uint32_t, uint32_t, uint32_t, uint32_t); // Finds or claims the slot of a message.
+        void releaseSlot(Reassembly *);                               // Frees a reassembly slot.
+        void sendFragmentAck(const Fragment *, uint32_t, const struct sockaddr_in &); // Acknowledges a fragment.
+        void queue(const struct iovec *, int, size_t, uint32_t, const struct sockaddr_in &); // Queues a message for a general, to go out in his next bundle.
+        int sendBundle(uint32_t);                                     // Sends the messages queued for a general.
+        int transmit(const struct iovec *, int, uint32_t, const struct sockaddr_in &); // Sends a datagram, through the faults of the adversary if any.
+        int deliver(const struct iovec *, int, uint32_t, const struct sockaddr_in &);  // Sends a datagram through shared memory or UDP.
+        void releaseHeld();                                           // Sends the datagram held back to be reordered, if any.
+
+    public:
+        Fragmenter(); // Constructor to initialize variables.
+
+        void init(int, uint32_t, uint32_t, size_t, uint64_t);                        // Sets the socket, the instance, the number of generals, the longest message and the pacing rate.
+        int send(const void *, size_t, uint32_t, const struct sockaddr_in &);        // Sends a message (in fragments if needed) to a general.
+        int send(const struct iovec *, int, size_t, uint32_t, const struct sockaddr_in &); // Sends a message gathered from iovecs (in fragments if needed) to a general.
+        void handleAck(FragmentAck *, uint32_t);                                     // Records the fragment ACK of a general.
+        char *handleFragment(Fragment *, ssize_t, uint32_t, const struct sockaddr_in &, size_t *); // Adds a fragment. Returns the message once complete.
+        void forget(const void *);                                                   // Forgets what was sent of one message, when it is released.
+        int sendDatagram(const void *, size_t, uint32_t, const struct sockaddr_in &); // Sends a message that needs no fragmenting (an ACK or a request) to a general.
+        void track(uint32_t);                                                        // Reports whether the bundle of the message just queued for a general goes out.
+        void takeReports(std::vector<SendReport> &);                                 // Hands over the reports since the last call.
+        void flush();                                                                // Sends the messages queued, one bundle per general, and the datagram held back.
+        void setAdversary(Adversary *);                                              // Injects the transport faults of an adversary.
+        void setLocal(LocalTransport *);                                             // Carries the datagrams to co-located generals through shared memory.
+        void setCapture(PacketCapture *);                                            // Captures the datagrams sent.
+};
+
+#endif
@@ -9,77 +9,180 @@
 
 #include "General.h"
 
+#ifdef SIG_ED25519
+#if OPENSSL_VERSION_NUMBER < 0x10101000L
+#error "Ed25519 signatures need OpenSSL 1.1.1 or later."
+#endif
+#define SIG_KEY_TYPE EVP_PKEY_ED25519
+#else
+#define SIG_KEY_TYPE EVP_PKEY_RSA
+#endif
+
 using namespace std;
 
-// Constructor to initialize variables, start listening for incoming connections
-// and load the private key.
-General::General(GeneralInfo *generalInfo) throw(string) {
+// Constructor to initialize variables, reset the workspace and start listening for incoming connections.
+// A general of a shard works in the workspace of the shard, whose keys, peer table and trie are built
+// once and reset for every instance. Any other general builds a workspace of his own.
+General::General(GeneralInfo *generalInfo) throw(string) :
+    workspace((generalInfo->workspace != NULL) ? generalInfo->workspace : &(this->ownWorkspace)),
+    peers(this->workspace->getPeers()), chains(this->workspace->getChains()) {
     this->myId = generalInfo->myId;
     this->maxFailures = generalInfo->maxFailures;
     this->numGenerals = generalInfo->numGenerals;
     this->cryptoOff = generalInfo->cryptoOff;
     this->listenPort = generalInfo->port;
+    this->instance = generalInfo->instance;
     this->hostNames = generalInfo->hostNames;
-    this->ipToId = generalInfo->ipToId;
-    
-    this->sendQueue = new int[this->numGenerals];
+    if(!this->workspace->isReady()) {
+        this->workspace->init(this->myId, generalInfo->addresses, generalInfo->hugePages, this->cryptoOff);
+    }
+    this->workspace->reset();
+    this->pvtKey = this->workspace->getPrivateKey();
+
     this->round = 1;
-    this->numMsgsSent = 0;
-    this->listenSocketFD = -1;
+    setupGossip(generalInfo->fanout);
+    this->decided = false;
+    this->peerOrderRound = 0;
+    this->adversary.init(generalInfo->adversary, this->myId, this->instance);
+    this->latency = generalInfo->latency;
+    this->rxKernelTime = 0;
+    this->rxUserTime = 0;
+    this->readsSinceFlush = 0;
+    this->local = generalInfo->local;
+    this->interrupted = generalInfo->interrupted;
+    this->capture = generalInfo->capture;
+    this->replay = generalInfo->replay;
+
+    struct timeval now;
+    currentTime(&now);
+    this->peerOrderSeed = (unsigned int) now.tv_sec ^ (this->myId << 16) ^ this->instance;
+    this->jitterSeed = this->peerOrderSeed;
+    this->blindCopies = generalInfo->blindCopies;
+    this->copiesReceived = 0;
+    this->messagesReceived = 0;
+    if(this->adversary.isActive()) {
+        this->peerOrderSeed = this->adversary.random(); // A scenario is run in the same order every time.
+    }
+    this->listenSocketFD = generalInfo->socketFD;
+    this->ownsSocket = (this->listenSocketFD == -1);
 
-    startListening();
+    // A general of a shard uses the socket of the shard.
+    if(this->ownsSocket) {
+        startListening();
+    }
     if(this->listenSocketFD == -1) {
         throw string("\nDon't have a socket to listen. Hence can not receive messages.");
     }
+    this->payloads.init(this->instance);
+
+    this->retransmitTimers.init(this->numGenerals + 1, (int64_t) now.tv_sec * 1000000 + now.tv_usec);
+    this->roundEnd = (int64_t) now.tv_sec * 1000000 + now.tv_usec + ROUND_TIMEOUT;
+
+    // Have the kernel stamp every datagram it receives (SCM_TIMESTAMPNS), to time the latencies.
+    int yes = 1;
+    if(this->latency != NULL && setsockopt(this->listenSocketFD, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof(yes)) == -1) {
+        perror("Failed to turn on kernel timestamps: setsockopt() failed");
+        this->latency = NULL;
+    }
 
-    memset(this->sendQueue, NOP_SEND_STATUS, sizeof(int) * this->numGenerals);
-    loadPrivateKey();
+    size_t maxChainLen = MAX_CHAIN_SIZE;
+    size_t maxPayloadLen = sizeof(PayloadMessage) + MAX_PAYLOAD_SIZE;
+    this->fragmenter.init(this->listenSocketFD, this->instance, this->numGenerals, (maxChainLen > maxPayloadLen) ? maxChainLen : maxPayloadLen, generalInfo->pacingRate);
+    if(this->adversary.hasTransportFaults()) {
+        this->fragmenter.setAdversary(&(this->adversary));
+    }
+    if(this->local != NULL) {
+        this->fragmenter.setLocal(this->local);
+    }
+    if(this->capture != NULL) {
+        this->fragmenter.setCapture(this->capture);
+    }
 }
 
-// Destructor to deallocate memory, close the socket opened for incoming connection
-// and release the loaded private key.
+// Destructor to close the socket opened for incoming connection.
+// The keys stay in the workspace, for the next instance.
 General::~General() {
-    if(this->sendQueue) {
-        delete[] this->sendQueue;
+    this->fragmenter.flush(); // The last ACKs may still be queued.
+    if(this->ownsSocket) {
+        close(this->listenSocketFD);
     }
-    close(this->listenSocketFD);
-    EVP_PKEY_free(this->pvtKey);
 }
 
-// Reads and loads the private key of the general.
-void General::loadPrivateKey() throw(string) {
+// Reads the private key of a general.
+EVP_PKEY *General::readPrivateKey(uint32_t id) throw(string) {
     ERR_load_crypto_strings();
 
     // Open the file containing the private key.
-    string keyFile = "generals/host_" + intToString(this->myId) + "_key.pem";
-    FILE *fp = fopen(keyFile.c_str(), "r");
+    stringstream keyFile;
+    keyFile<<"generals/host_"<<id<<"_key.pem";
+    FILE *fp = fopen(keyFile.str().c_str(), "r");
     if(fp == NULL) {
         throw string("\nCould not open private key file");
     }
 
     // Read the private key.
-    this->pvtKey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+    EVP_PKEY *pvtKey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
     fclose (fp);
     
-    if(this->pvtKey == NULL) {
+    if(pvtKey == NULL) {
         ERR_print_errors_fp (stderr);
         throw string("\nPrivate key is NULL.");
     }
+    if(EVP_PKEY_id(pvtKey) != SIG_KEY_TYPE) {
+        EVP_PKEY_free(pvtKey);
+        throw string("\nThe private key is not of the signature scheme the general was built for.");
+    }
+    return pvtKey;
+}
+
+// Sets the fanout and the last round.
+// In gossip mode a value is relayed to fanout generals picked at random instead of to all of them.
+// The fanout is at least f + 1, so that a relay reaches at least one loyal general, and at least ln(n - 1) + 1,
+// so that relaying every value once reaches all lieutenants with high probability. The value then takes
+// about log_fanout(n - 1) more hops to spread, and as many rounds (plus two of slack) are added.
+void General::setupGossip(int fanout) {
+    int numLieutenants = this->numGenerals - 1;
+    this->fanout = 0;
+    this->lastRound = this->maxFailures + 1;
+    if(fanout <= 0) {
+        return;
+    }
+
+    int minFanout = (int) ceil(log((double) numLieutenants)) + 1;
+    if(fanout < this->maxFailures + 1) {
+        fanout = this->maxFailures + 1;
+    }
+    if(fanout < minFanout) {
+        fanout = minFanout;
+    }
+    if(fanout >= numLieutenants - 1) {
+        return; // Too few generals for gossip to save anything.
+    }
+
+    this->fanout = fanout;
+    this->lastRound += (int) ceil(log((double) numLieutenants) / log((double) fanout)) + 2;
 }
 
 // Opens a port and starts listening for incoming connections.
+// The payload that may come in is not known, so room is made for the largest.
 void General::startListening() throw(string) {
+    this->listenSocketFD = openSocket("", this->listenPort, false, socketBufferSize(this->numGenerals, this->maxFailures, MAX_PAYLOAD_SIZE));
+}
+
+// Opens and binds a socket to listen on the given port of the given numeric address ("" for any).
+// With reusePort, the sockets of all shards can be bound to the same port.
+int General::openSocket(const string &host, const string &port, bool reusePort, int bufferSize) throw(string) {
     int socketFD, status;
     struct addrinfo hints, *hostInfo, *curr;
 
     // Initialize the socket properties.
     memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
+    hints.ai_family = AF_INET; // The peer table holds IPv4 addresses, and this socket also sends to them.
     hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_flags = AI_PASSIVE;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
 
     // Prepare the structure with the port number and socket properties initialized above.
-    if((status = getaddrinfo(NULL, this->listenPort.c_str(), &hints, &hostInfo)) != 0) {
+    if((status = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &hostInfo)) != 0) {
         cerr<<"getaddrinfo: "<<gai_strerror(status);
         throw string("\nCould not retrieve my address info.");
     }
@@ -95,6 +198,19 @@ void General::startListening() throw(string) {
         // Set the socket options.
         int yes = 1;
         setsockopt(socketFD, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+        if(reusePort && setsockopt(socketFD, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1) {
+            close(socketFD);
+            perror("Failed to share the port among the shards: setsockopt() failed.");
+            continue;
+        }
+
+        // Never let the IP layer fragment: large messages are fragmented by the fragmenter instead.
+        int pmtuDisc = IP_PMTUDISC_DO;
+        setsockopt(socketFD, IPPROTO_IP, IP_MTU_DISCOVER, &pmtuDisc, sizeof(int));
+
+        // Make room for what may be queued in a round. The kernel caps the sizes at net.core.[rw]mem_max.
+        setsockopt(socketFD, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(int));
+        setsockopt(socketFD, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(int));
 
         // Bind the socket to the port to listen on.
         if(bind(socketFD, curr->ai_addr, curr->ai_addrlen) == -1) {
@@ -111,24 +227,29 @@ void General::startListening() throw(string) {
     }
 
     freeaddrinfo(hostInfo);
-    this->listenSocketFD = socketFD; // Remember the socket file descriptor.
+    return socketFD;
 }
 
-// Digitally signs the message to be sent.
-struct sig* General::signMessage(void *data, int dataLen) {
-    ERR_load_crypto_strings();
+// Sizes socket buffers from the bytes that may be queued in a round:
+// every other general may send up to two chains of the longest length (a lieutenant forwards
+// at most two values), and payloads of the given total length may go out or come in at once.
+int General::socketBufferSize(int numGenerals, int maxFailures, size_t payloadBytes) {
+    size_t maxChainLen = sizeof(SignedMessage) + sizeof(struct sig) * (maxFailures + 2);
+    size_t volume = 2 * (numGenerals - 1) * maxChainLen + payloadBytes;
+    if(volume < MIN_SOCKET_BUFFER_SIZE) {
+        volume = MIN_SOCKET_BUFFER_SIZE;
+    } else if(volume > MAX_SOCKET_BUFFER_SIZE) {
+        volume = MAX_SOCKET_BUFFER_SIZE;
+    }
+    return (int) volume;
+}
 
-    EVP_MD_CTX md_ctx;
-    unsigned int sig_len = SIG_SIZE;
-    struct sig *sign = new sig;
+// Digitally signs the message to be sent into the given signature.
+struct sig* General::signMessage(void *data, int dataLen, struct sig *sign) {
     sign->id = this->myId;
 
     // Do the signature
-    EVP_SignInit(&md_ctx, EVP_sha1());
-    EVP_SignUpdate (&md_ctx, data, dataLen);
-    int err = EVP_SignFinal(&md_ctx, sign->signature, &sig_len, this->pvtKey);
-
-    if(err != 1) {
+    if(!signBytes(this->pvtKey, data, dataLen, sign->signature)) {
         ERR_print_errors_fp(stderr);
         throw string("\nSigning failed.");
     }
@@ -137,108 +258,676 @@ struct sig* General::signMessage(void *data, int dataLen) {
     return sign;
 }
 
+#ifdef SIG_ED25519
+// Signs some bytes with Ed25519, into SIG_SIZE bytes.
+bool General::signBytes(EVP_PKEY *key, const void *data, size_t dataLen, uint8_t *signature) {
+    size_t sigLen = SIG_SIZE;
+    EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+    bool ok = (EVP_DigestSignInit(md_ctx, NULL, NULL, NULL, key) == 1 && EVP_DigestSign(md_ctx, signature, &sigLen, (const unsigned char *) data, dataLen) == 1);
+    EVP_MD_CTX_free(md_ctx);
+    return ok;
+}
+
+// Verifies an Ed25519 signature over some bytes.
+bool General::verifyBytes(EVP_PKEY *key, const void *data, size_t dataLen, const uint8_t *signature) {
+    EVP_MD_CTX *md_ctx = EVP_MD_CTX_new();
+    bool ok = (EVP_DigestVerifyInit(md_ctx, NULL, NULL, NULL, key) == 1 && EVP_DigestVerify(md_ctx, signature, SIG_SIZE, (const unsigned char *) data, dataLen) == 1);
+    EVP_MD_CTX_free(md_ctx);
+    return ok;
+}
+
+// Verifies signatures in order, up to the first that fails. Returns the number verified.
+size_t General::verifyBatch(const SignatureCheck *checks, size_t numChecks) {
+    size_t numVerified = 0;
+    while(numVerified < numChecks && verifyBytes(checks[numVerified].key, checks[numVerified].data, checks[numVerified].dataLen, checks[numVerified].signature)) {
+        numVerified++;
+    }
+    return numVerified;
+}
+#else
+// Signs some bytes with RSA over their SHA-256 digest, into SIG_SIZE bytes.
+bool General::signBytes(EVP_PKEY *key, const void *data, size_t dataLen, uint8_t *signature) {
+    uint8_t digest[DIGEST_SIZE];
+    DigestBatch::digest(data, dataLen, digest);
+    return signDigest(key, digest, signature);
+}
+
+// Verifies an RSA signature over the SHA-256 digest of some bytes.
+bool General::verifyBytes(EVP_PKEY *key, const void *data, size_t dataLen, const uint8_t *signature) {
+    uint8_t digest[DIGEST_SIZE];
+    DigestBatch::digest(data, dataLen, digest);
+    return verifyDigest(key, digest, signature);
+}
+
+// Verifies signatures in order, up to the first that fails. Returns the number verified.
+// The digests of what they are over are computed first, all at once (MAX_DIGEST_BATCH at a time), on the stack.
+size_t General::verifyBatch(const SignatureCheck *checks, size_t numChecks) {
+    uint8_t digests[MAX_DIGEST_BATCH][DIGEST_SIZE];
+    DigestBatch batch;
+    size_t numVerified = 0;
+    while(numVerified < numChecks) {
+        size_t first = numVerified;
+        size_t last = (numChecks - first < MAX_DIGEST_BATCH) ? numChecks : first + MAX_DIGEST_BATCH;
+        for(size_t i = first; i < last; i++) {
+            batch.add(checks[i].data, checks[i].dataLen, digests[i - first]);
+        }
+        batch.compute();
+
+        while(numVerified < last && verifyDigest(checks[numVerified].key, digests[numVerified - first], checks[numVerified].signature)) {
+            numVerified++;
+        }
+        if(numVerified < last) {
+            break;
+        }
+    }
+    return numVerified;
+}
+
+// Signs a SHA-256 digest with RSA (PKCS #1 v1.5), into SIG_SIZE bytes.
+bool General::signDigest(EVP_PKEY *key, const uint8_t *digest, uint8_t *signature) {
+    size_t sigLen = SIG_SIZE;
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key, NULL);
+    bool ok = (ctx != NULL && EVP_PKEY_sign_init(ctx) == 1 && EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) > 0 &&
+               EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256()) > 0 && EVP_PKEY_sign(ctx, signature, &sigLen, digest, DIGEST_SIZE) == 1);
+    EVP_PKEY_CTX_free(ctx);
+    return ok;
+}
+
+// Verifies an RSA signature (PKCS #1 v1.5) over a SHA-256 digest.
+bool General::verifyDigest(EVP_PKEY *key, const uint8_t *digest, const uint8_t *signature) {
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key, NULL);
+    bool ok = (ctx != NULL && EVP_PKEY_verify_init(ctx) == 1 && EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) > 0 &&
+               EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256()) > 0 && EVP_PKEY_verify(ctx, signature, SIG_SIZE, digest, DIGEST_SIZE) == 1);
+    EVP_PKEY_CTX_free(ctx);
+    return ok;
+}
+#endif
+
 // Sends an order to generals.
-void General::sendOrder(SignedMessage *message) throw(string) {
+// The generals are sent to in an order that changes every round, so that no general is always the last one served.
+void General::sendOrder(const Chain &message) throw(string) {
+    const vector<uint32_t> &order = shuffledPeers();
+
     // Depending on the state in which a general is, the order is sent to desired generals.
     switch(this->state) {
         // Send to generals whose signatures were not found in the signature chain.
+        // In gossip mode only the first fanout of them that have not signed the message.
         case SIGNED:
         case SENDING:
-            for(int i = 1; i < this->numGenerals; i++) {
-                if(this->sendQueue[i] != DO_NOT_SEND && (i + 1) != myId) {
-                    sendMessage(message, i);
+            for(size_t i = 0, numTargets = 0; i < order.size() && (this->fanout == 0 || numTargets < (size_t) this->fanout); i++) {
+                if(this->peers[order[i]].sendStatus != DO_NOT_SEND && !(this->fanout > 0 && ChainTrie::hasSigned(message, order[i]))) {
+                    sendMessage(message, order[i]);
+                    numTargets++;
                 }
             }
             break;
 
         // Send to generals to whom order could not be sent earlier.
+        // Those whose ACK is overdue are sent to again as their retransmit timers expire (see retransmitDue()).
         case ALL_NOT_SENT:
-            for(int i = 1; i < this->numGenerals; i++) {
-                if(this->sendQueue[i] == NOT_SENT && (i + 1) != myId) {
-                    sendMessage(message, i);
-                }
-            }
+            resendPending(message, SEND_STATUS_BIT(NOT_SENT));
             break;
+    }
+}
 
-        // Send to generals from whom an ACK has not been received within timeout period.
-        case ALL_ACKS_NOT_RECEIVED:
-            for(int i = 1; i < this->numGenerals; i++) {
-                if(this->sendQueue[i] != ACKED && this->sendQueue[i] != DO_NOT_SEND && this->sendQueue[i] != NOP_SEND_STATUS && (i + 1) != myId) {
-                    sendMessage(message, i);
-                }
+// Sends a message again to the generals in a mask of send statuses.
+// Only they are visited, from the bitsets of the peer table. They are gone over from the first general of
+// the order of the round, wrapping around, so that no general is always the last one served either.
+void General::resendPending(const Chain &message, unsigned int statuses) {
+    const vector<uint32_t> &order = shuffledPeers();
+    uint32_t first = order.empty() ? COMMANDER_ID : order[0];
+    for(uint32_t id = this->peers.nextWithSendStatus(statuses, first - 1); id != NO_PEER; id = this->peers.nextWithSendStatus(statuses, id)) {
+        sendMessage(message, id);
+    }
+    for(uint32_t id = this->peers.nextWithSendStatus(statuses, NO_PEER); id != NO_PEER && id < first; id = this->peers.nextWithSendStatus(statuses, id)) {
+        sendMessage(message, id);
+    }
+}
+
+// Disarms the retransmit timers and starts a round at the given time: no retransmit is due past its end.
+void General::startRetransmits(const struct timeval &start) {
+    this->retransmitTimers.cancelAll();
+    for(uint32_t id = 1; id <= this->peers.size(); id++) {
+        this->peers[id].timeouts = 0;
+    }
+    this->roundEnd = (int64_t) start.tv_sec * 1000000 + start.tv_usec + ROUND_TIMEOUT;
+}
+
+// Arms the retransmit timer of a general just sent to, unless it is armed already (a message of the round
+// went to him before in this pass). The timeout is twice his round trip time once it is known, doubled with
+// every timeout of the round and jittered by an eighth either way, so that the generals that are slow or gone
+// are retried ever less often and never all at once. A retransmit that would come too late in the round is
+// not armed.
+// In blind mode nothing is ACKed: the timer sends the next copy, the copies of a message evenly spaced over
+// the first BLIND_SPREAD of the round, and is not armed once the last copy went out.
+void General::armRetransmit(uint32_t generalId) {
+    if(this->retransmitTimers.isArmed(generalId)) {
+        return;
+    }
+
+    const Peer &peer = this->peers[generalId];
+    int64_t timeout;
+    if(this->blindCopies > 0) {
+        if(peer.timeouts + 1 >= (uint32_t) this->blindCopies) {
+            return;
+        }
+        timeout = BLIND_SPREAD / this->blindCopies;
+    } else {
+        timeout = (peer.rtt > 0) ? 2 * (int64_t) peer.rtt : RETRANSMIT_INITIAL;
+        if(timeout < RETRANSMIT_MIN) {
+            timeout = RETRANSMIT_MIN;
+        }
+        timeout <<= (peer.timeouts < RETRANSMIT_MAX_BACKOFF) ? peer.timeouts : RETRANSMIT_MAX_BACKOFF;
+    }
+    timeout += (int64_t) (rand_r(&(this->jitterSeed)) % (timeout / 4 + 1)) - timeout / 8;
+
+    struct timeval now;
+    currentTime(&now);
+    int64_t at = (int64_t) now.tv_sec * 1000000 + now.tv_usec + timeout;
+    if(at <= this->roundEnd - RETRANSMIT_MIN) {
+        this->retransmitTimers.arm(generalId, at);
+    }
+}
+
+// Sends again to the generals whose retransmit timers expired, if they still have not ACKed (never, in blind mode).
+void General::retransmitDue() {
+    struct timeval now;
+    currentTime(&now);
+    this->dueGenerals.clear();
+    this->retransmitTimers.expire((int64_t) now.tv_sec * 1000000 + now.tv_usec, this->dueGenerals);
+    for(size_t i = 0; i < this->dueGenerals.size(); i++) {
+        Peer &peer = this->peers[this->dueGenerals[i]];
+        if(peer.sendStatus == SENT || peer.sendStatus == NOT_SENT) {
+            peer.timeouts++;
+            resend(this->dueGenerals[i]);
+        }
+    }
+}
+
+// Are ACKs still awaited, or blind copies still to go out? In blind mode no ACK ever comes.
+bool General::deliveryPending() {
+    if(this->blindCopies > 0) {
+        return this->retransmitTimers.getNumArmed() > 0 || this->peers.countSendStatus(QUEUED) > 0;
+    }
+    return this->peers.countSendStatus(SENT) + this->peers.countSendStatus(QUEUED) > 0;
+}
+
+// Reads the time of day, or the clock of the replay in a replay. Every time a general goes by is read here.
+void General::currentTime(struct timeval *now) {
+    if(this->replay != NULL) {
+        int64_t time = this->replay->now();
+        now->tv_sec = (time_t) (time / 1000000);
+        now->tv_usec = (suseconds_t) (time % 1000000);
+    } else {
+        gettimeofday(now, NULL);
+    }
+}
+
+// Returns the lieutenants (but me) in a random order, new in every round.
+const vector<uint32_t> &General::shuffledPeers() {
+    if(this->peerOrder.empty() || this->peerOrderRound != this->round) {
+        this->peerOrder.clear();
+        for(uint32_t id = COMMANDER_ID + 1; id <= (uint32_t) this->numGenerals; id++) {
+            if(id != this->myId) {
+                this->peerOrder.push_back(id);
             }
-            break;
+        }
+
+        // Fisher-Yates shuffle.
+        for(size_t i = this->peerOrder.size(); i > 1; i--) {
+            size_t j = rand_r(&(this->peerOrderSeed)) % i;
+            uint32_t id = this->peerOrder[i - 1];
+            this->peerOrder[i - 1] = this->peerOrder[j];
+            this->peerOrder[j] = id;
+        }
+        this->peerOrderRound = this->round;
     }
+    return this->peerOrder;
+}
+
+// Does a datagram belong to the instance of the general?
+// Datagrams of other instances are late ones from an instance that is over, or early ones from the next.
+bool General::isOfInstance(const char *buffer, ssize_t numBytes) {
+    return numBytes >= (ssize_t) (2 * sizeof(uint32_t)) && ntohl(((const uint32_t *) buffer)[1]) == this->instance;
+}
+
+// Builds what the commander signs for a digest in an instance: the instance followed by the digest.
+// The signature then can not be replayed in another instance.
+void General::signedValue(uint32_t instance, const uint8_t *digest, uint8_t *data) {
+    uint32_t netInstance = htonl(instance);
+    memcpy(data, &netInstance, sizeof(netInstance));
+    memcpy(data + sizeof(netInstance), digest, DIGEST_SIZE);
 }
 
 // Sends a message to a general given his id.
-void General::sendMessage(SignedMessage *message, int generalK) throw(string) {
-    int socketFD, status, numbytes;
-    struct addrinfo hint, *hostInfo, *curr;
-    string general = this->hostNames[generalK];
-
-    // Set the appropriate flags.
-    memset(&hint, 0, sizeof(hint));
-    hint.ai_family = AF_UNSPEC;
-    hint.ai_socktype = SOCK_DGRAM;
-    hint.ai_flags = AI_PASSIVE;
-
-    // Get the address info of the host to send to.
-    if((status = getaddrinfo(general.c_str(), this->listenPort.c_str(), &hint, &hostInfo)) != 0) {
-        cerr<<"getaddrinfo: "<<gai_strerror(status);
-        throw general.append(" :could not retrieve the address info.");
+// The message goes out of the listening socket to the address resolved at startup, gathered from its chain.
+// A message queued to go out in the next bundle leaves the general QUEUED: he is only SENT to, with the time
+// of the sending and his retransmit timer, once flushSends() sends the bundle.
+void General::sendMessage(const Chain &chain, uint32_t generalId) {
+    Peer &peer = this->peers[generalId];
+    const Chain &message = messageFor(chain, generalId);
+
+    // The address of the general could not be resolved at startup.
+    if(peer.address.sin_family != AF_INET) {
+        cerr<<"\nNo address to send to for "<<this->hostNames[generalId - 1];
+        this->peers.setSendStatus(generalId, NOT_SENT);
+        return;
     }
 
-    // Get the socket descriptor to use for sending the message.
-    for(curr = hostInfo; curr != NULL; curr = curr->ai_next) {
-        if((socketFD = socket(curr->ai_family, curr->ai_socktype, curr->ai_protocol)) == -1) {
-            perror("Failed to create a socket: socket() failed.");
+    // Try sending the message to the general.
+    struct iovec iov[MAX_GENERALS + 1];
+    int iovcnt = ChainTrie::gather(message, iov);
+    int result = this->fragmenter.send(iov, iovcnt, ChainTrie::length(message), generalId, peer.address);
+    if(result == SEND_FAILED) {
+        cerr<<"Failed to send message to "<<this->hostNames[generalId - 1];
+        perror("Failed to send message: sendmsg() failed");
+        this->peers.setSendStatus(generalId, NOT_SENT);
+        armRetransmit(generalId);
+    } else {
+        // Update the status of the sending. The generals whose ACK is awaited are those SENT or QUEUED to.
+        if(peer.sendStatus == SENT || peer.sendStatus == QUEUED) {
+            peer.retransmits++;
+            peer.copiesSent++;
+        } else {
+            peer.copiesSent = 1;
+        }
+        peer.msgsSent++;
+        if(result == SEND_QUEUED) {
+            this->peers.setSendStatus(generalId, QUEUED);
+            this->fragmenter.track(generalId);
+        } else {
+            markSent(generalId);
+        }
+    }
+}
+
+// Marks a general as SENT to now, and arms his retransmit timer.
+void General::markSent(uint32_t generalId) {
+    this->peers.setSendStatus(generalId, SENT);
+    currentTime(&(this->peers[generalId].lastSent));
+    armRetransmit(generalId);
+}
+
+// Marks the current message as acknowledged by a general, who held it for the given microseconds before ACKing.
+// With kernel timestamps, the round trip less the hold time is twice the time on the wire.
+void General::recordAck(uint32_t generalId, uint32_t holdUsecs) {
+    Peer &peer = this->peers[generalId];
+    peer.acksReceived++;
+
+    // Duplicate ACKs (one per copy that was sent) only count once. A copy may still be queued when the ACK of
+    // an earlier one comes.
+    if(peer.sendStatus != SENT && peer.sendStatus != QUEUED) {
+        return;
+    }
+    this->peers.setSendStatus(generalId, ACKED);
+    this->retransmitTimers.cancel(generalId);
+
+    // Update the smoothed round trip time of the general.
+    struct timeval now;
+    currentTime(&now);
+    long int sample = ((now.tv_sec * 1000000 + now.tv_usec) - (peer.lastSent.tv_sec * 1000000 + peer.lastSent.tv_usec));
+    peer.rtt = (peer.rtt == 0) ? sample : (7 * peer.rtt + sample) / 8;
+
+    // Only messages sent once are timed: an ACK can not tell which copy it answers.
+    if(this->latency != NULL && this->rxKernelTime != 0 && peer.copiesSent == 1) {
+        int64_t roundTrip = this->rxKernelTime - ((int64_t) peer.lastSent.tv_sec * 1000000 + peer.lastSent.tv_usec);
+        this->latency->record(generalId, LATENCY_WIRE, (roundTrip - (int64_t) holdUsecs) / 2);
+    }
+}
+
+// Receives a datagram (like recvfrom()), and captures it if the datagrams are captured.
+// In a replay it is the next one of the capture replayed, from the address of its sender.
+ssize_t General::receive(char *buffer, size_t bufferLen, int flags, struct sockaddr_in *address) {
+    ssize_t numBytes;
+    if(this->replay != NULL) {
+        uint32_t peerId;
+        if((numBytes = this->replay->receive(buffer, bufferLen, flags, &peerId)) == -1) {
+            flushSends();
+            errno = EWOULDBLOCK;
+        } else {
+            if(++(this->readsSinceFlush) >= FLUSH_BATCH) {
+                flushSends();
+            }
+            if(peerId >= COMMANDER_ID && peerId <= this->peers.size()) {
+                *address = this->peers[peerId].address;
+            } else {
+                memset(address, 0, sizeof(*address)); // From no general: it is dropped, as it was.
+            }
+        }
+        this->rxKernelTime = 0;
+    } else {
+        numBytes = receiveDatagram(buffer, bufferLen, flags, address);
+    }
+
+    if(this->capture != NULL && numBytes > 0) {
+        this->capture->record(CAPTURE_RECEIVED, this->peers.lookup(*address), buffer, numBytes);
+    }
+    return numBytes;
+}
+
+// Receives a datagram from the socket or a ring, noting when the kernel received it and when it was read.
+// The rings from co-located generals are read first; a datagram of theirs comes from the address of its sender.
+// This is where a pass of the receive loop ends: what was queued to send goes out once the socket is
+// drained (before blocking on it), or after FLUSH_BATCH datagrams if it never is.
+ssize_t General::receiveDatagram(char *buffer, size_t bufferLen, int flags, struct sockaddr_in *address) {
+    uint32_t peerId;
+    int64_t stamp;
+    ssize_t numBytes;
+    if(this->local != NULL && (numBytes = this->local->receive(buffer, bufferLen, &peerId, &stamp)) != -1) {
+        if(++(this->readsSinceFlush) >= FLUSH_BATCH) {
+            flushSends();
+        }
+        *address = this->peers[peerId].address;
+        this->rxKernelTime = 0;
+        if(this->latency != NULL) {
+            struct timeval now;
+            currentTime(&now);
+            this->rxUserTime = (int64_t) now.tv_sec * 1000000 + now.tv_usec;
+            this->rxKernelTime = stamp;
+        }
+        return numBytes;
+    }
+
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = bufferLen;
+
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_name = address;
+    header.msg_namelen = sizeof(*address);
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    if(this->latency != NULL) {
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+    }
+
+    numBytes = recvmsg(this->listenSocketFD, &header, flags | MSG_DONTWAIT);
+    if(numBytes == -1 && errno == EWOULDBLOCK) {
+        if(this->local != NULL) {
+            // Whatever arrives next may come on a ring or on the socket: sleep on both, then read again.
+            this->local->service();
+            if(!(flags & MSG_DONTWAIT)) {
+                waitForDatagram(-1);
+                return receiveDatagram(buffer, bufferLen, flags, address);
+            }
+        }
+        flushSends();
+        errno = EWOULDBLOCK;
+        if(!(flags & MSG_DONTWAIT)) {
+            header.msg_namelen = sizeof(*address);
+            header.msg_controllen = (this->latency != NULL) ? sizeof(control) : 0;
+            numBytes = recvmsg(this->listenSocketFD, &header, flags);
+        }
+    } else if(++(this->readsSinceFlush) >= FLUSH_BATCH) {
+        flushSends();
+    }
+    this->rxKernelTime = 0;
+    if(numBytes == -1 || this->latency == NULL) {
+        return numBytes;
+    }
+
+    struct timeval now;
+    currentTime(&now);
+    this->rxUserTime = (int64_t) now.tv_sec * 1000000 + now.tv_usec;
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != NULL; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec stamp;
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            this->rxKernelTime = (int64_t) stamp.tv_sec * 1000000 + stamp.tv_nsec / 1000;
+        }
+    }
+    return numBytes;
+}
+
+// Sends what was queued, one bundle per general. The generals whose messages went out are SENT to from now;
+// those whose bundle could not be sent are NOT_SENT, and are sent to again when their retransmit timers expire.
+// A general no longer QUEUED (he ACKed an earlier copy, or a new round began) is left as he is.
+void General::flushSends() {
+    this->readsSinceFlush = 0;
+    this->fragmenter.flush();
+    this->fragmenter.takeReports(this->sendReports);
+    for(size_t i = 0; i < this->sendReports.size(); i++) {
+        uint32_t generalId = this->sendReports[i].peerId;
+        if(this->peers[generalId].sendStatus != QUEUED) {
             continue;
         }
-        break;
+        if(this->sendReports[i].sent) {
+            markSent(generalId);
+        } else {
+            cerr<<"Failed to send message to "<<this->hostNames[generalId - 1]<<"\n";
+            this->peers.setSendStatus(generalId, NOT_SENT);
+            armRetransmit(generalId);
+        }
     }
+}
 
-    // Socket creation failed for all options.
-    if(curr == NULL) {
-        cerr<<"\nFailed to create any socket for "<<general;
-        this->sendQueue[generalK] = NOT_SENT;
+// Sends what was queued and sleeps till a datagram arrives on the socket or on a ring, or the timeout
+// (in milliseconds, -1 for none) passes. In a replay, till the next datagram of the capture is due.
+void General::waitForDatagram(int timeout) {
+    flushSends();
+    if(this->replay != NULL) {
+        this->replay->wait(timeout);
+        return;
+    }
+    if(this->local != NULL) {
+        this->local->wait(this->listenSocketFD, timeout);
         return;
     }
 
-    freeaddrinfo(hostInfo);
+    struct pollfd pfd;
+    pfd.fd = this->listenSocketFD;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, timeout);
+}
 
-    // Try sending the message to the general.
-    int msgLen = sizeof(SignedMessage) + sizeof(struct sig) * this->round;
-    if((numbytes = sendto(socketFD, (void *) message, msgLen, 0, curr->ai_addr, curr->ai_addrlen)) == -1) {
-        cerr<<"Failed to send message to "<<general;
-        perror("Failed to send message: sendto() failed");
-        this->sendQueue[generalK] = NOT_SENT;
-    } else {
-        // Update the status of the sending and increment the number of messages that have been sent.
-        this->sendQueue[generalK] = SENT;
-        this->numMsgsSent++;
+// Hands the messages a bundle carries to handleDatagram(), one by one. Bundles never carry bundles,
+// and a record that runs past the end of the bundle ends it.
+void General::handleBundle(char *buffer, size_t numBytes, uint32_t peerId, const struct sockaddr_in &peerAddress) {
+    if(numBytes < sizeof(Bundle)) {
+        return;
+    }
+
+    uint32_t count = ntohl(((Bundle *) buffer)->count);
+    size_t offset = sizeof(Bundle);
+    for(uint32_t i = 0; i < count && offset + sizeof(uint32_t) <= numBytes; i++) {
+        uint32_t recordLen;
+        memcpy(&recordLen, buffer + offset, sizeof(recordLen));
+        recordLen = ntohl(recordLen);
+        if(recordLen > numBytes - offset - sizeof(uint32_t)) {
+            return;
+        }
+
+        char *record = buffer + offset + sizeof(uint32_t);
+        if(isOfInstance(record, recordLen) && ntohl(*(uint32_t *) record) != TYPE_BUNDLE) {
+            handleDatagram(record, recordLen, peerId, peerAddress);
+        }
+        offset += BUNDLE_RECORD_SIZE(recordLen);
     }
-    close(socketFD);
 }
 
-// Converts a SignedMessage from host to network byte order.
-SignedMessage* General::hton_sm(SignedMessage *msg) {
-    uint32_t numSigs = msg->total_sigs;
-    msg->type = htonl(msg->type);
-    msg->total_sigs = htonl(msg->total_sigs);
-    msg->order = htonl(msg->order);
-    for(int i = 0; i < numSigs; i++) {
-        msg->sigs[i].id = htonl(msg->sigs[i].id);
+// Records how long the datagram last read waited in the socket queue and took to handle (till now).
+void General::recordHandled(uint32_t generalId) {
+    if(this->latency == NULL || this->rxKernelTime == 0) {
+        return;
     }
-    return msg;
+    struct timeval now;
+    currentTime(&now);
+    this->latency->record(generalId, LATENCY_QUEUE, this->rxUserTime - this->rxKernelTime);
+    this->latency->record(generalId, LATENCY_HANDLER, ((int64_t) now.tv_sec * 1000000 + now.tv_usec) - this->rxUserTime);
+}
+
+// Returns the microseconds since the kernel received the datagram last read (0 if that is not known).
+uint32_t General::holdTime() {
+    if(this->rxKernelTime == 0) {
+        return 0;
+    }
+    struct timeval now;
+    currentTime(&now);
+    int64_t held = ((int64_t) now.tv_sec * 1000000 + now.tv_usec) - this->rxKernelTime;
+    return (held > 0) ? (uint32_t) held : 0;
+}
+
+// Sends a payload to a general given his id.
+// Sending the same payload again only sends the fragments that were not acknowledged.
+void General::sendPayload(const PayloadMessage *message, uint32_t generalId) {
+    Peer &peer = this->peers[generalId];
+    if(peer.address.sin_family != AF_INET) {
+        return;
+    }
+
+    if(this->fragmenter.send(message, PayloadStore::messageLen(message), generalId, peer.address) == -1) {
+        cerr<<"Failed to send payload to "<<this->hostNames[generalId - 1];
+        perror("Failed to send payload: sendmsg() failed");
+    }
+}
+
+// Sends a payload asked for by a general, if it is here.
+void General::handlePayloadRequest(PayloadRequest *request, uint32_t peerId) {
+    const PayloadMessage *message = this->payloads.find(request->digest);
+    if(message) {
+        sendPayload(message, peerId);
+    }
+}
+
+uint8_t General::orderDigests[2][DIGEST_SIZE];
+bool General::ordersDigested = General::digestOrders();
+
+// Computes the digests of the payloads of RETREAT and ATTACK, for classify().
+bool General::digestOrders() {
+    uint32_t orders[] = { RETREAT, ATTACK };
+    for(int i = 0; i < 2; i++) {
+        vector<uint8_t> payload;
+        orderPayload(orders[i], payload);
+        PayloadStore::digest(&payload[0], payload.size(), orderDigests[orders[i]]);
+    }
+    return true;
+}
+
+// Tells whether a digest is that of an order (ATTACK or RETREAT) or of some other payload (OPAQUE_VALUE).
+int General::classify(const uint8_t *digest) {
+    if(memcmp(digest, orderDigests[RETREAT], DIGEST_SIZE) == 0) {
+        return RETREAT;
+    }
+    if(memcmp(digest, orderDigests[ATTACK], DIGEST_SIZE) == 0) {
+        return ATTACK;
+    }
+    return OPAQUE_VALUE;
+}
+
+// Copies the digest of the value decided on. Returns false if there is none.
+bool General::getDecision(uint8_t *digest) {
+    if(this->decided) {
+        memcpy(digest, this->decision, DIGEST_SIZE);
+    }
+    return this->decided;
+}
+
+// Keeps the chain a value was accepted on, till the general is done.
+void General::keepEvidence(const Chain &chain) {
+    this->chains.retain(chain.tip);
+    this->evidence.push_back(chain);
+}
+
+// Copies out the chains the values were accepted on, each as the SignedMessage (in network byte order) it was received as.
+void General::getEvidence(vector<vector<char> > &chains) const {
+    for(size_t i = 0; i < this->evidence.size(); i++) {
+        const Chain &chain = this->evidence[i];
+        chains.push_back(vector<char>(ChainTrie::length(chain)));
+        struct iovec iov[MAX_GENERALS + 1];
+        int iovcnt = ChainTrie::gather(chain, iov);
+        char *next = &(chains.back()[0]);
+        for(int j = 0; j < iovcnt; j++) {
+            memcpy(next, iov[j].iov_base, iov[j].iov_len);
+            next += iov[j].iov_len;
+        }
+    }
+}
+
+// Returns the signed messages received in blind mode, every copy counted, and the distinct messages among them.
+// Each distinct message was sent blindCopies times, so their ratio is the share of the copies that got through
+// (a little less: no more copies go to a general once he is found to have signed the value himself).
+void General::getDelivery(uint64_t &copies, uint64_t &messages) const {
+    copies = this->copiesReceived;
+    messages = this->messagesReceived;
+}
+
+// Makes a chain of the instance from its last signature, the length of its payload and its digest.
+// The header is built in network byte order, ready to be sent.
+Chain General::makeChain(ChainNode *tip, uint32_t payloadLen, const uint8_t *digest) {
+    Chain chain;
+    chain.tip = tip;
+    SignedMessage *header = (SignedMessage *) chain.header;
+    header->type = htonl(TYPE_SEND);
+    header->instance = htonl(this->instance);
+    header->total_sigs = htonl(tip->depth);
+    header->payload_len = htonl(payloadLen);
+    memcpy(header->digest, digest, DIGEST_SIZE);
+    return chain;
+}
+
+// Sends made up chains to every general, if the adversary floods: values no one proposed,
+// under signatures that do not verify. They are shaped to pass the cheap checks of a lieutenant.
+void General::flood() {
+    if(!this->adversary.has(FLOOD)) {
+        return;
+    }
+
+    char buffer[sizeof(SignedMessage) + 2 * sizeof(struct sig)];
+    SignedMessage *chain = (SignedMessage *) buffer;
+    uint32_t numSigs = (this->myId == COMMANDER_ID) ? 1 : 2;
+    chain->type = htonl(TYPE_SEND);
+    chain->instance = htonl(this->instance);
+    chain->total_sigs = htonl(numSigs);
+    chain->payload_len = htonl(1);
+    chain->sigs[0].id = htonl(COMMANDER_ID);
+    chain->sigs[numSigs - 1].id = htonl(this->myId);
+    for(uint32_t i = 0; i < numSigs; i++) {
+        for(int b = 0; b < SIG_SIZE; b++) {
+            chain->sigs[i].signature[b] = this->adversary.random();
+        }
+    }
+
+    const vector<uint32_t> &order = shuffledPeers();
+    for(int n = 0; n < this->adversary.floodRate(); n++) {
+        for(size_t i = 0; i < order.size(); i++) {
+            const Peer &peer = this->peers[order[i]];
+            if(peer.address.sin_family != AF_INET) {
+                continue;
+            }
+            for(int b = 0; b < DIGEST_SIZE; b++) {
+                chain->digest[b] = this->adversary.random();
+            }
+            this->fragmenter.sendDatagram(buffer, sizeof(SignedMessage) + numSigs * sizeof(struct sig), order[i], peer.address);
+        }
+    }
+}
+
+// Copies the payload with the given digest. Returns false if it is not here.
+bool General::getPayload(const uint8_t *digest, vector<uint8_t> &payload) {
+    const PayloadMessage *message = this->payloads.find(digest);
+    if(message == NULL) {
+        return false;
+    }
+    payload.assign(message->payload, message->payload + ntohl(message->payload_len));
+    return true;
+}
+
+// Returns the payload that stands for an order: the order in network byte order.
+void General::orderPayload(uint32_t order, vector<uint8_t> &payload) {
+    uint32_t netOrder = htonl(order);
+    payload.assign((uint8_t *) &netOrder, (uint8_t *) &netOrder + sizeof(netOrder));
 }
 
 // Converts a SignedMessage from network to host byte order.
 SignedMessage* General::ntoh_sm(SignedMessage *msg, ssize_t numBytesReceived) {
     uint32_t numSigs = (numBytesReceived - sizeof(SignedMessage)) / sizeof(struct sig);
     msg->type = ntohl(msg->type);
+    msg->instance = ntohl(msg->instance);
     msg->total_sigs = ntohl(msg->total_sigs);
-    msg->order = ntohl(msg->order);
+    msg->payload_len = ntohl(msg->payload_len);
     for(int i = 0; i < numSigs; i++) {
         msg->sigs[i].id = ntohl(msg->sigs[i].id);
     }
@@ -248,14 +937,18 @@ SignedMessage* General::ntoh_sm(SignedMessage *msg, ssize_t numBytesReceived) {
 // Converts an Ack from host to network byte order.
 Ack* General::hton_ack(Ack *msg) {
     msg->type = htonl(msg->type);
+    msg->instance = htonl(msg->instance);
     msg->round = htonl(msg->round);
+    msg->hold_usec = htonl(msg->hold_usec);
     return msg;
 }
 
 // Converts an Ack from network to host byte order.
 Ack* General::ntoh_ack(Ack *msg) {
     msg->type = ntohl(msg->type);
+    msg->instance = ntohl(msg->instance);
     msg->round = ntohl(msg->round);
+    msg->hold_usec = ntohl(msg->hold_usec);
     return msg;
 }
 
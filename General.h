@@ -15,7 +15,10 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cerrno>
+#include <ctime>
+#include <cmath>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -31,23 +34,44 @@
 #include <openssl/pem.h>
 #include <openssl/ssl.h>
 #include "message_format.h"
+#include "PeerTable.h"
+#include "ChainTrie.h"
+#include "Fragmenter.h"
+#include "PayloadStore.h"
+#include "Adversary.h"
+#include "LatencyStats.h"
+#include "Presigner.h"
+#include "LocalTransport.h"
+#include "TimerWheel.h"
+#include "PacketCapture.h"
+#include "Replay.h"
+#include "DigestBatch.h"
+#include "Workspace.h"
 
 #define ACK_TIMEOUT 200000   // in microseconds
 #define ROUND_TIMEOUT 500000 // in microseconds
+#define RETRANSMIT_INITIAL 50000 // Retransmit timeout for a general whose round trip time is not known yet, in microseconds.
+#define RETRANSMIT_MIN 10000     // Shortest retransmit timeout, and the least time left in a round for a retransmit, in microseconds.
+#define RETRANSMIT_MAX_BACKOFF 6 // Times the retransmit timeout of a general is doubled at most.
+#define BLIND_SPREAD (ROUND_TIMEOUT / 2) // Part of a round the blind copies of a message are spread over, in microseconds.
+#define MAX_BLIND_COPIES 16      // Most copies of a message sent blind.
 #define MAX_TRIES 10
+#define FLUSH_BATCH 32       // Datagrams read before what was queued to send goes out, if the socket is never drained.
+#define MIN_SOCKET_BUFFER_SIZE (256 * 1024)       // Socket buffers are never made smaller than this.
+#define MAX_SOCKET_BUFFER_SIZE (64 * 1024 * 1024) // Nor larger than this (the kernel caps them at net.core.[rw]mem_max anyway).
 
 #define TYPE_SEND 1
 #define TYPE_ACK 2
-
-#define NOP_SEND_STATUS 0
-#define SENT 1
-#define NOT_SENT 2
-#define ACKED 3
-#define DO_NOT_SEND 4
+#define TYPE_FRAGMENT 3
+#define TYPE_FRAGMENT_ACK 4
+#define TYPE_PAYLOAD 5
+#define TYPE_PAYLOAD_REQUEST 6
+#define TYPE_BUNDLE 7
 
 #define RETREAT 0
 #define ATTACK 1
 #define NO_ORDER 2
+#define OPAQUE_VALUE 3 // A payload that is not an order.
 
 #define INIT 1
 #define WAITING 2
@@ -65,55 +89,162 @@
 #define ACK_VERIFIED 14
 #define DONE 15
 
-#define SIG_SIZE 256 /* For 2048 bit RSA private key */
+#define COMMANDER_ID 1 // The commander is the first general in the hostfile.
+
+// Largest system a build supports (make CPPFLAGS=-DMAX_GENERALS=64 for a smaller one).
+// Per-general scratch state is kept in fixed arrays of this size inside the generals.
+#ifndef MAX_GENERALS
+#define MAX_GENERALS 256
+#endif
+#define MAX_CHAIN_SIZE (sizeof(SignedMessage) + MAX_GENERALS * sizeof(struct sig)) // Longest chain a build handles.
+
+#define SIGNED_VALUE_SIZE (sizeof(uint32_t) + DIGEST_SIZE) // What the commander signs: the instance and the digest.
 
 // Data structure to pass information about a general (Commander or Leiutenant).
 typedef struct {
     uint32_t myId;
+    uint32_t instance; // Agreement instance to run.
+    int socketFD;      // Socket to send and receive on (-1 to open one of its own).
     int maxFailures;
     int numGenerals;
     bool cryptoOff;
+    bool hugePages;      // Should the signature chains be backed by huge pages?
+    uint64_t pacingRate; // Bytes per second that messages are sent at (0 if sending is not paced).
+    int fanout;          // Generals a value is relayed to (0 to relay to all).
+    int blindCopies;     // Copies of every message sent without ACKs, spread over the round (0 to have messages ACKed).
+    AdversaryInfo adversary; // How the general misbehaves (Adversary::clear() for not at all).
+    bool timeLatency;        // Should latencies be timed with kernel timestamps?
+    LatencyStats *latency;   // Where they are recorded (NULL if they are not timed).
+    const volatile bool *interrupted; // Set once the general is to give up his instance (NULL if he never is).
+    Presigner *presigner;    // Signs the order of a commander ahead (NULL to sign it in round 1).
+    LocalTransport *local;   // Rings to the co-located generals (NULL if there are none).
+    PacketCapture *capture;  // Where the datagrams sent and received are captured (NULL if they are not).
+    Replay *replay;          // Feeds the datagrams received, and the time, from a capture (NULL for the socket and the clock).
+    Workspace *workspace;    // Keys, peer table and trie kept across instances (NULL for the general to build his own).
+    std::string capturePath; // Where the shards capture their datagrams (<path>.<shard> with several shards, empty for nowhere).
     std::string port;
     std::string myHostName;
     std::vector<std::string> hostNames;
-    std::map<unsigned long, uint32_t> ipToId;
+    std::vector<struct sockaddr_in> addresses; // addresses[i] is the address of the general with id i + 1.
 } GeneralInfo;
 
+// A signature to verify: by whom, over what.
+typedef struct {
+    EVP_PKEY *key;            // Public key of the general who signed.
+    const void *data;         // What was signed.
+    size_t dataLen;           // Its length.
+    const uint8_t *signature; // The signature (SIG_SIZE bytes).
+} SignatureCheck;
+
 // Class definition.
 class General {
 
     protected:
         uint32_t myId;      // General's id.
-        int *sendQueue;     // Maintains the send status of the messages.
         int round;          // Current round number. The first round starts from 1.
         int numGenerals;    // Number of generals in the system.
         int maxFailures;    // Maximum number of traitor generals in the system.
-        int numMsgsSent;    // The number of generals who have been sent messages.
+        int lastRound;      // Last round of the algorithm: f + 1, plus the rounds gossip takes to spread.
+        int fanout;         // Generals a value is relayed to in gossip mode (0 to relay to all, as in the paper).
         int state;          // State of this general.
         int listenSocketFD; // File descriptor of the socket on which the general is listening on.
+        bool ownsSocket;    // Was the socket opened by the general (and is it to be closed by him)?
+        uint32_t instance;  // Agreement instance the general takes part in.
 
         std::string listenPort;                   // Port to listen on.
         std::vector<std::string> hostNames;       // Vector of host names in the system.
-        std::map<unsigned long, uint32_t> ipToId; // Map for IP address : General id.
+        Workspace ownWorkspace;                   // The workspace of a general not given one.
+        Workspace *workspace;                     // Holds the keys, the peer table and the trie, across instances.
+        PeerTable &peers;                         // Addresses, keys and send status of the generals, indexed by id.
+        ChainTrie &chains;                        // The signature chains held, for sending and as evidence.
+        Fragmenter fragmenter;                    // Splits messages that do not fit a datagram and reassembles them.
+        PayloadStore payloads;                    // Payloads held, by digest.
+        uint8_t decision[DIGEST_SIZE];            // Digest of the value decided on.
+        bool decided;                             // Has a value been decided on?
+        std::vector<uint32_t> peerOrder;          // The generals to send to, in the order they are sent to in this round.
+        int peerOrderRound;                       // Round the order was shuffled for.
+        unsigned int peerOrderSeed;               // State of the generator that shuffles the order.
+        std::vector<Chain> evidence;              // The signature chains of the values accepted.
+        Adversary adversary;                      // Makes the general misbehave, if he is to.
+        LatencyStats *latency;                    // Where latencies are recorded (NULL if they are not timed).
+        int64_t rxKernelTime;                     // When the kernel received the datagram last read, in microseconds (0 if unknown).
+        int64_t rxUserTime;                       // When the datagram last read was read, in microseconds.
+        int readsSinceFlush;                      // Datagrams read since what was queued to send went out.
+        std::vector<SendReport> sendReports;      // Whether the bundles of the messages queued in sendMessage() went out.
+        LocalTransport *local;                    // Rings to the co-located generals (NULL if there are none).
+        const volatile bool *interrupted;         // Set once the general is to give up his instance (NULL if he never is).
+        TimerWheel retransmitTimers;              // A retransmit timer per general sent to and not ACKed yet, indexed by id.
+        std::vector<uint32_t> dueGenerals;        // The generals whose retransmit timers expired.
+        int64_t roundEnd;                         // When the round ends, in microseconds. No retransmit is due later.
+        unsigned int jitterSeed;                  // State of the generator that jitters the retransmit timeouts.
+        int blindCopies;                          // Copies of every message sent without ACKs (0 if messages are ACKed and retransmitted).
+        PacketCapture *capture;                   // Where the datagrams sent and received are captured (NULL if they are not).
+        Replay *replay;                           // Feeds the datagrams received, and the time, in a replay (NULL if this is none).
+        uint64_t copiesReceived;                  // Signed messages received in blind mode, every copy counted.
+        uint64_t messagesReceived;                // Distinct ones among them.
 
         bool cryptoOff;   // Should signature verification be turned off?
-        EVP_PKEY *pvtKey; // Stores the private key of the general. 
+        EVP_PKEY *pvtKey; // The private key of the general (held by the workspace).
 
-        void loadPrivateKey() throw(std::string);                  // Reads and loads the private key of the general.
         void startListening() throw(std::string);                  // Opens a port and starts listening for incoming connections.
-        void sendOrder(SignedMessage *) throw(std::string);        // Sends an order to generals.
-        struct sig* signMessage(void *, int);                      // Digitally signs the message to be sent.
-        void sendMessage(SignedMessage *, int) throw(std::string); // Sends a message to a general given his id.
+        void setupGossip(int);                                     // Sets the fanout and the last round.
+        void sendOrder(const Chain &) throw(std::string);          // Sends an order to generals.
+        void resendPending(const Chain &, unsigned int);           // Sends a message again to the generals in a mask of send statuses.
+        void startRetransmits(const struct timeval &);             // Disarms the retransmit timers and starts a round at the given time.
+        void armRetransmit(uint32_t);                              // Arms the retransmit timer of a general just sent to.
+        void retransmitDue();                                      // Sends again to the generals whose retransmit timers expired.
+        bool deliveryPending();                                    // Are ACKs still awaited, or blind copies still to go out?
+        virtual void resend(uint32_t) = 0;                         // Sends the messages of the round again to a general.
+        const std::vector<uint32_t> &shuffledPeers();              // Returns the lieutenants (but me) in a random order, new in every round.
+        bool isOfInstance(const char *, ssize_t);                  // Does a datagram belong to the instance of the general?
+        Chain makeChain(ChainNode *, uint32_t, const uint8_t *);   // Makes a chain of the instance from its last signature, payload length and digest.
+        void keepEvidence(const Chain &);                          // Keeps the chain a value was accepted on.
+        void flood();                                              // Sends made up chains to every general, if the adversary floods.
+        virtual const Chain &messageFor(const Chain &message, uint32_t) { return message; } // Picks the message a general is sent.
+        struct sig* signMessage(void *, int, struct sig *);        // Digitally signs the message to be sent into the given signature.
+        void sendMessage(const Chain &, uint32_t);                 // Sends a message to a general given his id.
+        void markSent(uint32_t);                                   // Marks a general as SENT to now, and arms his retransmit timer.
+        void recordAck(uint32_t, uint32_t);                        // Marks the current message as acknowledged by a general.
+        ssize_t receive(char *, size_t, int, struct sockaddr_in *); // Receives a datagram (from the capture replayed, in a replay).
+        ssize_t receiveDatagram(char *, size_t, int, struct sockaddr_in *); // Receives a datagram from the socket or a ring, noting when the kernel received it.
+        void currentTime(struct timeval *);                        // Reads the time of day (the clock of the replay, in a replay).
+        void flushSends();                                         // Sends what was queued, one bundle per general.
+        void waitForDatagram(int);                                 // Sends what was queued and sleeps till a datagram arrives (or a timeout in milliseconds).
+        virtual void handleDatagram(char *, size_t, uint32_t, const struct sockaddr_in &) = 0; // Calls the handler for the type of a datagram received.
+        void handleBundle(char *, size_t, uint32_t, const struct sockaddr_in &); // Hands the messages a bundle carries to handleDatagram().
+        void recordHandled(uint32_t);                              // Records how long the datagram last read queued and took to handle.
+        uint32_t holdTime();                                       // Returns the microseconds since the kernel received the datagram last read.
+        void sendPayload(const PayloadMessage *, uint32_t);        // Sends a payload to a general given his id.
+        void handlePayloadRequest(PayloadRequest *, uint32_t);     // Sends a payload asked for by a general, if it is here.
+        int classify(const uint8_t *);                             // Tells whether a digest is that of an order (ATTACK or RETREAT) or of some other payload.
+        static uint8_t orderDigests[2][DIGEST_SIZE];               // Digests of the payloads of RETREAT and ATTACK, indexed by order.
+        static bool ordersDigested;                                // Were they computed (once, at startup)?
+        static bool digestOrders();                                // Computes the digests of the payloads of RETREAT and ATTACK.
         std::string intToString(int);                              // Converts an integer to its string equivalent.
-        SignedMessage* hton_sm(SignedMessage *);                   // Converts a SignedMessage from host to network byte order.
         SignedMessage* ntoh_sm(SignedMessage *, ssize_t);          // Converts a SignedMessage from network to host byte order.
         Ack* hton_ack(Ack *);                                      // Converts an Ack from host to network byte order.
         Ack* ntoh_ack(Ack *);                                      // Converts an Ack from network to host byte order.
+#ifndef SIG_ED25519
+        static bool signDigest(EVP_PKEY *, const uint8_t *, uint8_t *);         // Signs a SHA-256 digest with RSA.
+        static bool verifyDigest(EVP_PKEY *, const uint8_t *, const uint8_t *); // Verifies an RSA signature over a SHA-256 digest.
+#endif
 
     public:
-        General(GeneralInfo *) throw(std::string); // Constructor to initialize variables, start listening for incoming connections and load the private key.
-        ~General();                                // Destructor to deallocate memory, close the socket opened for incoming connection and release the loaded private key.
+        General(GeneralInfo *) throw(std::string); // Constructor to initialize variables, reset the workspace and start listening for incoming connections.
+        virtual ~General();                        // Destructor to close the socket opened for incoming connection.
         virtual int run() throw(std::string) = 0;  // Pure virtual function that should be implented in the child classes.
+        bool getDecision(uint8_t *);                            // Copies the digest of the value decided on. Returns false if there is none.
+        bool getPayload(const uint8_t *, std::vector<uint8_t> &); // Copies the payload with the given digest. Returns false if it is not here.
+        void getEvidence(std::vector<std::vector<char> > &) const; // Copies out the chains the values were accepted on (in network byte order).
+        void getDelivery(uint64_t &, uint64_t &) const;            // Returns the blind copies received and the distinct messages among them.
+        static void orderPayload(uint32_t, std::vector<uint8_t> &); // Returns the payload that stands for an order.
+        static int openSocket(const std::string &, const std::string &, bool, int) throw(std::string); // Opens and binds a socket to listen on.
+        static int socketBufferSize(int, int, size_t);                           // Sizes socket buffers from the bytes that may be queued in a round.
+        static bool signBytes(EVP_PKEY *, const void *, size_t, uint8_t *);       // Signs some bytes with the scheme of the build.
+        static void signedValue(uint32_t, const uint8_t *, uint8_t *);            // Builds what the commander signs for a digest in an instance.
+        static EVP_PKEY *readPrivateKey(uint32_t) throw(std::string);             // Reads the private key of a general.
+        static bool verifyBytes(EVP_PKEY *, const void *, size_t, const uint8_t *); // Verifies a signature over some bytes with the scheme of the build.
+        static size_t verifyBatch(const SignatureCheck *, size_t);                // Verifies signatures in order, up to the first that fails.
 };
 
 #endif
@@ -0,0 +1,114 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the high dynamic range histogram. |
++----------------------------------------------------------------------+
+*/
+
+#include <cmath>
+#include "HdrHistogram.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+HdrHistogram::HdrHistogram() {
+    init(3600000000ULL, 3);
+}
+
+// Sets the largest sample tracked and the significant decimal digits kept (1 to 5), and clears the samples.
+// A sub-bucket is then at most 1 / 10^digits of the samples it holds wide.
+void HdrHistogram::init(uint64_t highest, int digits) {
+    if(digits < 1) {
+        digits = 1;
+    } else if(digits > 5) {
+        digits = 5;
+    }
+
+    uint64_t largestSingleUnit = 2 * (uint64_t) pow(10.0, digits);
+    int subBucketCountMagnitude = (int) ceil(log((double) largestSingleUnit) / log(2.0));
+    this->subBucketHalfCountMagnitude = subBucketCountMagnitude - 1;
+    this->subBucketHalfCount = 1U << this->subBucketHalfCountMagnitude;
+    this->subBucketMask = (1ULL << subBucketCountMagnitude) - 1;
+    this->highest = (highest > this->subBucketMask) ? highest : this->subBucketMask + 1;
+
+    // Every bucket past the first doubles the range.
+    int bucketCount = 1;
+    for(uint64_t smallestUntracked = 1ULL << subBucketCountMagnitude; smallestUntracked <= this->highest && bucketCount < 64; smallestUntracked <<= 1) {
+        bucketCount++;
+    }
+    this->counts.assign((bucketCount + 1) * this->subBucketHalfCount, 0);
+    this->total = 0;
+    this->minimum = ~0ULL;
+    this->maximum = 0;
+}
+
+// Adds a sample. Negative samples (clocks that stepped) are dropped.
+void HdrHistogram::record(int64_t value) {
+    if(value < 0) {
+        return;
+    }
+    uint64_t sample = ((uint64_t) value > this->highest) ? this->highest : (uint64_t) value;
+    this->counts[indexOf(sample)]++;
+    this->total++;
+    if(sample < this->minimum) {
+        this->minimum = sample;
+    }
+    if(sample > this->maximum) {
+        this->maximum = sample;
+    }
+}
+
+// Adds the samples of a histogram of the same range and precision.
+void HdrHistogram::merge(const HdrHistogram &other) {
+    for(size_t i = 0; i < this->counts.size() && i < other.counts.size(); i++) {
+        this->counts[i] += other.counts[i];
+    }
+    this->total += other.total;
+    if(other.total > 0 && other.minimum < this->minimum) {
+        this->minimum = other.minimum;
+    }
+    if(other.maximum > this->maximum) {
+        this->maximum = other.maximum;
+    }
+}
+
+// Returns a percentile (0 to 100) of the samples, as the largest sample its sub-bucket holds (0 if there are none).
+uint64_t HdrHistogram::percentile(double percent) const {
+    if(this->total == 0) {
+        return 0;
+    }
+    if(percent > 100.0) {
+        percent = 100.0;
+    }
+
+    uint64_t rank = (uint64_t) ceil(percent / 100.0 * this->total), seen = 0;
+    if(rank < 1) {
+        rank = 1;
+    }
+    for(uint32_t i = 0; i < this->counts.size(); i++) {
+        seen += this->counts[i];
+        if(seen >= rank) {
+            uint64_t value = highestEquivalent(i);
+            return (value < this->maximum) ? value : this->maximum;
+        }
+    }
+    return this->maximum;
+}
+
+// Returns the counter of a sample: its bucket is the power of two above it, its sub-bucket the bits below that.
+uint32_t HdrHistogram::indexOf(uint64_t value) const {
+    int pow2Ceiling = 64 - __builtin_clzll(value | this->subBucketMask);
+    int bucketIndex = pow2Ceiling - (this->subBucketHalfCountMagnitude + 1);
+    uint32_t subBucketIndex = (uint32_t) (value >> bucketIndex);
+    return ((bucketIndex + 1) << this->subBucketHalfCountMagnitude) + (subBucketIndex - this->subBucketHalfCount);
+}
+
+// Returns the largest sample a counter holds.
+uint64_t HdrHistogram::highestEquivalent(uint32_t index) const {
+    int bucketIndex = (int) (index >> this->subBucketHalfCountMagnitude) - 1;
+    uint64_t subBucketIndex = (index & (this->subBucketHalfCount - 1)) + this->subBucketHalfCount;
+    if(bucketIndex < 0) {
+        subBucketIndex -= this->subBucketHalfCount;
+        bucketIndex = 0;
+    }
+    return ((subBucketIndex + 1) << bucketIndex) - 1;
+}
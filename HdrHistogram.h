@@ -0,0 +1,47 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class HdrHistogram. |
+|
+| A high dynamic range histogram keeps every sample to a fixed number |
+| of significant decimal digits over the whole range it tracks, so |
+| that the tail percentiles of a latency are as precise as its median |
+| at the cost of a few thousand counters. Buckets double in width, and |
+| each is split into the same number of linear sub-buckets. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <vector>
+#include <stdint.h>
+
+// Class definition.
+class HdrHistogram {
+
+    private:
+        uint64_t highest;                // Largest sample tracked (larger ones are counted as it).
+        int subBucketHalfCountMagnitude; // log2 of half the sub-buckets of a bucket.
+        uint32_t subBucketHalfCount;     // Half the sub-buckets of a bucket (the lower half of a bucket overlaps the one before).
+        uint64_t subBucketMask;          // Samples below this fall into the first bucket.
+        std::vector<uint64_t> counts;    // Samples per sub-bucket.
+        uint64_t total;                  // Number of samples.
+        uint64_t minimum;                // Smallest sample.
+        uint64_t maximum;                // Largest sample.
+
+        uint32_t indexOf(uint64_t) const;           // Returns the counter of a sample.
+        uint64_t highestEquivalent(uint32_t) const; // Returns the largest sample a counter holds.
+
+    public:
+        HdrHistogram(); // Constructor to initialize variables.
+
+        void init(uint64_t, int);                  // Sets the largest sample tracked and the significant digits kept.
+        void record(int64_t);                      // Adds a sample.
+        void merge(const HdrHistogram &);          // Adds the samples of a histogram of the same range and precision.
+        uint64_t percentile(double) const;         // Returns a percentile (0 to 100) of the samples.
+        uint64_t getTotal() const { return this->total; }                         // Returns the number of samples.
+        uint64_t getMin() const { return (this->total > 0) ? this->minimum : 0; } // Returns the smallest sample.
+        uint64_t getMax() const { return this->maximum; }                         // Returns the largest sample.
+};
+
+#endif
@@ -0,0 +1,244 @@
+/*
++----------------------------------------------------------------------+
+| This class maps a key bundle and decodes the public keys in it. |
+|
+| The keys are decoded by a pool of threads, one slice of the index |
+| per thread, so that the startup time does not grow with the number |
+| of generals. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <openssl/x509.h>
+#include <openssl/err.h>
+#include "KeyBundle.h"
+
+using namespace std;
+
+// The slice of the index decoded by one loader thread.
+struct DecodeTask {
+    const KeyBundle *bundle;
+    EVP_PKEY **keys;
+    uint32_t numGenerals;
+    uint32_t skipId;
+    uint32_t first;
+    uint32_t stride;
+    bool failed;
+};
+
+// Constructor to initialize variables.
+KeyBundle::KeyBundle() {
+    this->fd = -1;
+    this->mapLen = 0;
+    this->base = NULL;
+    this->count = 0;
+    this->entries = NULL;
+}
+
+// Destructor to unmap the bundle.
+KeyBundle::~KeyBundle() {
+    if(this->base) {
+        munmap((void *) this->base, this->mapLen);
+    }
+    if(this->fd != -1) {
+        close(this->fd);
+    }
+}
+
+// Maps a bundle file. Returns false if there is no such file.
+bool KeyBundle::open(const string &path) throw(string) {
+    if((this->fd = ::open(path.c_str(), O_RDONLY)) == -1) {
+        if(errno == ENOENT) {
+            return false;
+        }
+        perror("Failed to open the key bundle: open() failed");
+        throw string("\nCould not open key bundle ") + path;
+    }
+
+    struct stat fileInfo;
+    if(fstat(this->fd, &fileInfo) == -1 || fileInfo.st_size < (off_t) sizeof(KeyBundleHeader)) {
+        throw string("\nKey bundle ") + path + " is truncated.";
+    }
+
+    this->mapLen = fileInfo.st_size;
+    void *addr = mmap(NULL, this->mapLen, PROT_READ, MAP_PRIVATE | MAP_POPULATE, this->fd, 0);
+    if(addr == MAP_FAILED) {
+        perror("Failed to map the key bundle: mmap() failed");
+        throw string("\nCould not map key bundle ") + path;
+    }
+    this->base = (const uint8_t *) addr;
+
+    // Validate the header and the index before anything is decoded.
+    const KeyBundleHeader *header = (const KeyBundleHeader *) this->base;
+    if(ntohl(header->magic) != KEY_BUNDLE_MAGIC || ntohl(header->version) != KEY_BUNDLE_VERSION) {
+        throw string("\n") + path + " is not a key bundle.";
+    }
+
+    this->count = ntohl(header->count);
+    this->entries = (const KeyBundleEntry *) (this->base + sizeof(KeyBundleHeader));
+    if(sizeof(KeyBundleHeader) + (size_t) this->count * sizeof(KeyBundleEntry) > this->mapLen) {
+        throw string("\nIndex of key bundle ") + path + " is truncated.";
+    }
+
+    // Ids must be strictly increasing, so that no two threads ever decode into the same slot.
+    for(uint32_t i = 0; i < this->count; i++) {
+        if(i > 0 && ntohl(this->entries[i].id) <= ntohl(this->entries[i - 1].id)) {
+            throw string("\nIndex of key bundle ") + path + " is not sorted by id.";
+        }
+        size_t offset = ntohl(this->entries[i].offset);
+        size_t length = ntohl(this->entries[i].length);
+        if(offset + length > this->mapLen) {
+            throw string("\nKey of an entry in key bundle ") + path + " lies outside the file.";
+        }
+    }
+    return true;
+}
+
+// Decodes a slice of the keys (run by every loader thread).
+void *KeyBundle::decodeWorker(void *arg) {
+    DecodeTask *task = (DecodeTask *) arg;
+    const KeyBundle *bundle = task->bundle;
+
+    for(uint32_t i = task->first; i < bundle->count; i += task->stride) {
+        uint32_t id = ntohl(bundle->entries[i].id);
+        if(id == 0 || id > task->numGenerals || id == task->skipId) {
+            continue; // Not a general of this system or the key is not wanted.
+        }
+
+        const unsigned char *der = bundle->base + ntohl(bundle->entries[i].offset);
+        EVP_PKEY *pkey = d2i_PUBKEY(NULL, &der, ntohl(bundle->entries[i].length));
+        if(pkey == NULL) {
+            task->failed = true;
+            continue;
+        }
+        task->keys[id] = pkey;
+    }
+    return NULL;
+}
+
+// Decodes the keys of generals 1..n (except one id) in parallel.
+// keys must have room for n + 1 entries, as it is indexed by general id.
+void KeyBundle::loadKeys(EVP_PKEY **keys, uint32_t numGenerals, uint32_t skipId) throw(string) {
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t numThreads = (numCores > 0) ? (uint32_t) numCores : 1;
+    if(numThreads > this->count) {
+        numThreads = (this->count > 0) ? this->count : 1;
+    }
+
+    for(uint32_t id = 0; id <= numGenerals; id++) {
+        keys[id] = NULL;
+    }
+
+    vector<DecodeTask> tasks(numThreads);
+    vector<pthread_t> threads(numThreads);
+    for(uint32_t t = 0; t < numThreads; t++) {
+        tasks[t].bundle = this;
+        tasks[t].keys = keys;
+        tasks[t].numGenerals = numGenerals;
+        tasks[t].skipId = skipId;
+        tasks[t].first = t;
+        tasks[t].stride = numThreads;
+        tasks[t].failed = false;
+    }
+
+    // The calling thread decodes the first slice itself.
+    uint32_t started = 1;
+    for(; started < numThreads; started++) {
+        if(pthread_create(&threads[started], NULL, KeyBundle::decodeWorker, &tasks[started]) != 0) {
+            break;
+        }
+    }
+    decodeWorker(&tasks[0]);
+    for(uint32_t t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    // Slices whose thread could not be started are decoded here.
+    for(uint32_t t = started; t < numThreads; t++) {
+        decodeWorker(&tasks[t]);
+    }
+
+    bool failed = false;
+    for(uint32_t t = 0; t < numThreads; t++) {
+        failed = failed || tasks[t].failed;
+    }
+    if(failed) {
+        ERR_print_errors_fp(stderr);
+        throw string("\nA public key in the key bundle could not be decoded.");
+    }
+
+    for(uint32_t id = 1; id <= numGenerals; id++) {
+        if(id != skipId && keys[id] == NULL) {
+            char idStr[16];
+            snprintf(idStr, sizeof(idStr), "%u", id);
+            throw string("\nPublic key for ") + idStr + " is missing from the key bundle.\n";
+        }
+    }
+}
+
+// Writes the public keys of generals 1..n into a bundle file.
+// keys[i] is the key of the general with id i + 1.
+void KeyBundle::write(const string &path, const vector<EVP_PKEY *> &keys) throw(string) {
+    vector<unsigned char *> ders(keys.size(), (unsigned char *) NULL);
+    vector<int> lengths(keys.size(), 0);
+
+    // DER encode every key.
+    for(size_t i = 0; i < keys.size(); i++) {
+        if((lengths[i] = i2d_PUBKEY(keys[i], &ders[i])) <= 0) {
+            for(size_t j = 0; j < i; j++) {
+                OPENSSL_free(ders[j]);
+            }
+            ERR_print_errors_fp(stderr);
+            throw string("\nCould not DER encode a public key.");
+        }
+    }
+
+    // Build the header and the index.
+    KeyBundleHeader header;
+    header.magic = htonl(KEY_BUNDLE_MAGIC);
+    header.version = htonl(KEY_BUNDLE_VERSION);
+    header.count = htonl(keys.size());
+    header.pad = 0;
+
+    vector<KeyBundleEntry> index(keys.size());
+    uint32_t offset = sizeof(KeyBundleHeader) + keys.size() * sizeof(KeyBundleEntry);
+    for(size_t i = 0; i < keys.size(); i++) {
+        index[i].id = htonl(i + 1);
+        index[i].offset = htonl(offset);
+        index[i].length = htonl(lengths[i]);
+        index[i].pad = 0;
+        offset += lengths[i];
+    }
+
+    // Write everything to a temporary file and move it in place, so that a reader never sees half a bundle.
+    string tmpPath = path + ".tmp";
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    bool ok = (fp != NULL);
+    if(ok) {
+        ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+        if(ok && !index.empty()) {
+            ok = fwrite(&index[0], sizeof(KeyBundleEntry), index.size(), fp) == index.size();
+        }
+        for(size_t i = 0; ok && i < keys.size(); i++) {
+            ok = fwrite(ders[i], lengths[i], 1, fp) == 1;
+        }
+        ok = (fclose(fp) == 0) && ok;
+    }
+
+    for(size_t i = 0; i < keys.size(); i++) {
+        OPENSSL_free(ders[i]);
+    }
+
+    if(!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        perror("Failed to write the key bundle");
+        unlink(tmpPath.c_str());
+        throw string("\nCould not write key bundle ") + path;
+    }
+}
@@ -0,0 +1,61 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class KeyBundle. |
+|
+| A key bundle packs the DER encoded public keys of all generals into |
+| a single file with an id index, so that it can be memory mapped and |
+| decoded in parallel at startup instead of PEM parsing one |
+| certificate file per general. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef KEY_BUNDLE_H
+#define KEY_BUNDLE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <openssl/evp.h>
+
+#define KEY_BUNDLE_FILE "./generals/keys.bundle"
+#define KEY_BUNDLE_MAGIC 0x42474b42 // "BGKB"
+#define KEY_BUNDLE_VERSION 1
+
+// Layout of the bundle file (all fields in network byte order):
+// KeyBundleHeader, KeyBundleEntry[count] sorted by id, DER encoded keys.
+typedef struct {
+    uint32_t magic;   // Must be equal to KEY_BUNDLE_MAGIC.
+    uint32_t version; // Must be equal to KEY_BUNDLE_VERSION.
+    uint32_t count;   // Number of entries in the index.
+    uint32_t pad;     // Keeps the index 16 byte aligned.
+} KeyBundleHeader;
+
+typedef struct {
+    uint32_t id;     // The identifier of the general owning the key.
+    uint32_t offset; // Offset of the DER encoded key from the start of the file.
+    uint32_t length; // Length of the DER encoded key.
+    uint32_t pad;    // Keeps the entries 16 byte aligned.
+} KeyBundleEntry;
+
+// Class definition.
+class KeyBundle {
+
+    private:
+        int fd;                        // File descriptor of the mapped bundle.
+        size_t mapLen;                 // Length of the mapping.
+        const uint8_t *base;           // Start of the mapping.
+        uint32_t count;                // Number of keys in the bundle.
+        const KeyBundleEntry *entries; // Index of the keys.
+
+        static void *decodeWorker(void *); // Decodes a slice of the keys (run by every loader thread).
+
+    public:
+        KeyBundle();  // Constructor to initialize variables.
+        ~KeyBundle(); // Destructor to unmap the bundle.
+
+        bool open(const std::string &) throw(std::string);                          // Maps a bundle file. Returns false if there is no such file.
+        void loadKeys(EVP_PKEY **, uint32_t, uint32_t) throw(std::string);          // Decodes the keys of generals 1..n (except one id) in parallel.
+        static void write(const std::string &, const std::vector<EVP_PKEY *> &) throw(std::string); // Writes the public keys of generals 1..n into a bundle file.
+};
+
+#endif
@@ -0,0 +1,117 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the per peer latency histograms. |
++----------------------------------------------------------------------+
+*/
+
+#include "LatencyStats.h"
+
+using namespace std;
+
+static const char *latencyNames[NUM_LATENCIES] = { "wire", "queue", "handler" };
+
+// Constructor to initialize variables.
+LatencyStats::LatencyStats() {
+    this->numGenerals = 0;
+}
+
+// Sets the number of generals.
+void LatencyStats::init(uint32_t numGenerals) {
+    this->numGenerals = numGenerals;
+    this->counts.assign((numGenerals + 1) * NUM_LATENCIES * LATENCY_BUCKETS, 0);
+    this->maxima.assign((numGenerals + 1) * NUM_LATENCIES, 0);
+}
+
+// Adds a sample (microseconds) of a latency of a general.
+// Negative samples (clocks that stepped) are dropped.
+void LatencyStats::record(uint32_t generalId, int latency, int64_t usecs) {
+    if(usecs < 0 || generalId > this->numGenerals) {
+        return;
+    }
+    uint32_t histogram = generalId * NUM_LATENCIES + latency;
+    this->counts[histogram * LATENCY_BUCKETS + bucketOf(usecs)]++;
+    if((uint64_t) usecs > this->maxima[histogram]) {
+        this->maxima[histogram] = usecs;
+    }
+}
+
+// Adds the samples of other stats (of the same number of generals).
+void LatencyStats::merge(const LatencyStats &other) {
+    if(this->counts.empty()) {
+        init(other.numGenerals);
+    }
+    for(size_t i = 0; i < this->counts.size() && i < other.counts.size(); i++) {
+        this->counts[i] += other.counts[i];
+    }
+    for(size_t i = 0; i < this->maxima.size() && i < other.maxima.size(); i++) {
+        if(other.maxima[i] > this->maxima[i]) {
+            this->maxima[i] = other.maxima[i];
+        }
+    }
+}
+
+// Prints the median, the 99th percentile and the maximum of every latency of every general heard from.
+void LatencyStats::print(ostream &out, uint32_t myId) const {
+    for(uint32_t id = 1; id <= this->numGenerals; id++) {
+        uint64_t numSamples = 0;
+        for(int latency = 0; latency < NUM_LATENCIES; latency++) {
+            for(uint32_t b = 0; b < LATENCY_BUCKETS; b++) {
+                numSamples += this->counts[(id * NUM_LATENCIES + latency) * LATENCY_BUCKETS + b];
+            }
+        }
+        if(numSamples == 0) {
+            continue;
+        }
+
+        out<<"\n"<<myId<<": from "<<id<<" (us, p50/p99/max):";
+        for(int latency = 0; latency < NUM_LATENCIES; latency++) {
+            out<<" "<<latencyNames[latency]<<" "<<percentile(id, latency, 0.5)<<"/"<<percentile(id, latency, 0.99)<<"/"<<this->maxima[id * NUM_LATENCIES + latency];
+        }
+    }
+}
+
+// Returns a percentile of a histogram (0 if it is empty), as the upper bound of its bucket.
+uint64_t LatencyStats::percentile(uint32_t generalId, int latency, double fraction) const {
+    const uint64_t *histogram = &(this->counts[(generalId * NUM_LATENCIES + latency) * LATENCY_BUCKETS]);
+    uint64_t total = 0;
+    for(uint32_t b = 0; b < LATENCY_BUCKETS; b++) {
+        total += histogram[b];
+    }
+    if(total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (fraction * total), seen = 0;
+    for(uint32_t b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += histogram[b];
+        if(seen > rank) {
+            uint64_t value = valueOf(b);
+            return (value < this->maxima[generalId * NUM_LATENCIES + latency]) ? value : this->maxima[generalId * NUM_LATENCIES + latency];
+        }
+    }
+    return this->maxima[generalId * NUM_LATENCIES + latency];
+}
+
+// Returns the bucket of a sample: samples below LATENCY_SUB_BUCKETS have a bucket each,
+// larger ones fall into one of LATENCY_SUB_BUCKETS buckets per power of two.
+uint32_t LatencyStats::bucketOf(uint64_t usecs) {
+    if(usecs < LATENCY_SUB_BUCKETS) {
+        return (uint32_t) usecs;
+    }
+    int msb = 63 - __builtin_clzll(usecs);
+    if(msb >= 32) {
+        return LATENCY_BUCKETS - 1;
+    }
+    uint32_t sub = (uint32_t) (usecs >> (msb - 3)) & (LATENCY_SUB_BUCKETS - 1);
+    return (msb - 2) * LATENCY_SUB_BUCKETS + sub;
+}
+
+// Returns the largest sample a bucket holds.
+uint64_t LatencyStats::valueOf(uint32_t bucket) {
+    if(bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    int msb = bucket / LATENCY_SUB_BUCKETS + 2;
+    uint64_t sub = bucket % LATENCY_SUB_BUCKETS;
+    return ((LATENCY_SUB_BUCKETS + sub + 1) << (msb - 3)) - 1;
+}
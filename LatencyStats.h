@@ -0,0 +1,50 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class LatencyStats. |
+|
+| Latency stats break the time a datagram takes down with the kernel |
+| timestamps of the socket (SO_TIMESTAMPNS): the time on the wire, |
+| the time it waited in the socket queue till the round loop picked |
+| it up, and the time the loop took to handle it. Each is kept in a |
+| histogram per peer, so that a slow peer (or link) stands apart from |
+| a slow local loop, which slows down the datagrams of every peer. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <vector>
+#include <ostream>
+#include <stdint.h>
+
+#define LATENCY_WIRE 0    // One way time on the wire (half the round trip of a chain and its ACK, less the time the ACKing general held it).
+#define LATENCY_QUEUE 1   // Time from the kernel receiving a datagram to the round loop reading it.
+#define LATENCY_HANDLER 2 // Time the round loop took to handle a datagram.
+#define NUM_LATENCIES 3
+
+#define LATENCY_SUB_BUCKETS 8                       // Buckets per power of two (so a bucket is at most 12.5% wide).
+#define LATENCY_BUCKETS (32 * LATENCY_SUB_BUCKETS)  // Buckets of a histogram, for up to 2^32 microseconds.
+
+// Class definition.
+class LatencyStats {
+
+    private:
+        uint32_t numGenerals;           // Number of generals in the system.
+        std::vector<uint64_t> counts;   // Histograms, NUM_LATENCIES per general, indexed by (id * NUM_LATENCIES + latency) * LATENCY_BUCKETS + bucket.
+        std::vector<uint64_t> maxima;   // Largest sample of each histogram.
+
+        static uint32_t bucketOf(uint64_t);  // Returns the bucket of a sample.
+        static uint64_t valueOf(uint32_t);   // Returns the largest sample a bucket holds.
+        uint64_t percentile(uint32_t, int, double) const; // Returns a percentile of a histogram.
+
+    public:
+        LatencyStats(); // Constructor to initialize variables.
+
+        void init(uint32_t);                           // Sets the number of generals.
+        void record(uint32_t, int, int64_t);           // Adds a sample (microseconds) of a latency of a general.
+        void merge(const LatencyStats &);              // Adds the samples of other stats.
+        void print(std::ostream &, uint32_t) const;    // Prints the percentiles of every general heard from.
+};
+
+#endif
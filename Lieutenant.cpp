@@ -10,50 +10,23 @@
 using namespace std;
 
 // Constructor to initialize variables, call parent's parametrized constructor
-// and load digital certificates of the generals.
+// and have the public keys of the generals loaded (by the first lieutenant of the workspace only).
 Lieutenant::Lieutenant(GeneralInfo *generalInfo) throw(string) : General(generalInfo) {
+    this->workspace->loadPublicKeys();
     this->state = INIT;
-    loadCertificates();
+    this->recvBufferLen = MAX_DATAGRAM_SIZE; // Longer messages arrive in fragments.
+    this->recvBuffer = new char[this->recvBufferLen];
+    this->numValues = 0;
+    this->numMsgsToForward = 0;
+    this->numMsgsBuilt = 0;
+    resetVerifies();
+    memset(this->signerSeen, 0, sizeof(this->signerSeen));
+    memset(this->copiesSeen, 0, sizeof(this->copiesSeen));
 }
 
-// Frees the loaded certificates.
+// Frees the receive buffer. The public keys stay in the workspace.
 Lieutenant::~Lieutenant() {
-    for(uint32_t id = 1; id <= this->numGenerals; id++) {
-        EVP_PKEY_free(this->idToCert[id]);
-    }
-}
-
-// Loads the digital certficates of all generals and stores them.                       
-void Lieutenant::loadCertificates() throw(string) {
-    for(uint32_t id = 1; id <= this->numGenerals; id++) {
-        if(id != this->myId) {
-            // Read the file containig the certificate.
-            string certFile = "./generals/host_" + intToString(id) + "_cert.pem";
-            FILE *fp = fopen(certFile.c_str(), "r");
-            if(fp == NULL) {
-                return;
-            }
-
-            // Read the certificate.
-            X509 *x509 = PEM_read_X509(fp, NULL, NULL, NULL);
-            fclose (fp);
-
-            if(x509 == NULL) {
-                ERR_print_errors_fp(stderr);
-                throw string("\nPublic key for " + intToString(id) + " could not be read.\n");
-            }
-
-            // Read the public key.
-            EVP_PKEY *pkey = X509_get_pubkey(x509);
-            if(pkey == NULL) {
-                ERR_print_errors_fp(stderr);
-                throw string("\nPublic key for " + intToString(id) + " could not be fetched.\n");
-            }
-
-            // Store public key (or digital certificate) in the map.
-            this->idToCert[id] = pkey;
-        }
-    }
+    delete[] this->recvBuffer;
 }
 
 // Implements the pure virtual function of the parent that kicks off the algorithm.
@@ -63,6 +36,7 @@ int Lieutenant::run() throw(string) {
     int decision = RETREAT;
     if(this->state == DONE) {
 	   decision = decide();
+       fetchPayload();
     }
     return decision;
 }
@@ -71,16 +45,31 @@ int Lieutenant::run() throw(string) {
 void Lieutenant::receiveAndForward() throw(string) {
 	while(this->state != DONE) {
         long int diff = 0;
-        gettimeofday(&(this->start), NULL); // Record the start time.
+        currentTime(&(this->start)); // Record the start time.
         
         // If this is not the first round.
         if(this->round > 1) { 
-            // If the number of rounds != f+1.
-            if(this->round <= maxFailures + 1) {
-                // Reset the queue to maintain the status of message sending and message counter.
-                memset(this->sendQueue, NOP_SEND_STATUS, this->numGenerals);
-                this->numMsgsSent = 0;
+            // If the last round has not passed yet.
+            if(this->round <= this->lastRound) {
+                // Reset the status of message sending (which counts the ACKs awaited too) and the retransmit timers.
+                this->peers.resetSendStatus(NOP_SEND_STATUS);
+                startRetransmits(this->start);
+
+                // The messages built in the last round are forwarded in this one.
+                // Those forwarded in the last round are released here (what the evidence holds of them stays), and
+                // what was sent of them is forgotten, as their headers are reused. Payloads are sent from the
+                // store, which keeps them for the instance, so what was sent of them is kept.
+                for(int i = 0; i < this->numMsgsToForward; i++) {
+                    this->fragmenter.forget(this->msgsToForward[i].header);
+                    this->chains.release(this->msgsToForward[i].tip);
+                }
+                memcpy(this->msgsToForward, this->msgsBuilt, this->numMsgsBuilt * sizeof(Chain));
+                this->numMsgsToForward = this->numMsgsBuilt;
+                this->numMsgsBuilt = 0;
+                resetVerifies();
                 
+                flood();
+                holdRelays();
                 this->state = SENDING;
                 diff = forwardMessages();
             } else {
@@ -92,241 +81,398 @@ void Lieutenant::receiveAndForward() throw(string) {
         while(diff < ROUND_TIMEOUT) {
             this->state = WAITING;
 
-    		receiveMessage();
-            if(this->state == ALL_ACKS_NOT_RECEIVED) {
-                diff = forwardMessages();
-                continue;
-            }
+    		receiveMessage(); // The generals whose ACK is overdue are sent to again as their timers expire.
+            requestMissingPayloads();
 
             // Record the current time and calculate the difference from the time we started checking for ACKs.
             struct timeval end;
-            gettimeofday(&end, NULL);
+            currentTime(&end);
             diff = ((end.tv_sec * 1000000 + end.tv_usec) - ((this->start).tv_sec * 1000000 + (this->start).tv_usec));
         }
-
-        if(this->round > 1) {
-            // Clear the messages of this round.
-            for(vector<SignedMessage*>::iterator iter = this->msgsToForward.begin(); iter != this->msgsToForward.end(); iter++) {
-                if(*iter) {
-                    free(*iter);
-                }
-            }
-            this->msgsToForward.clear();
-        }
         this->round++;
 	}
 }
 
 // Received any message that has arrived at the socket.
-void Lieutenant::receiveMessage() {
+// A socket that was shut down (see Shard::interrupt()) reads as empty: the instance is given up then.
+void Lieutenant::receiveMessage() throw(string) {
     int bufferLen, flag;
     long int diff = 0;
     struct timeval ackStart;
+    char *buffer = this->recvBuffer;
 
-    bufferLen = sizeof(SignedMessage) + sizeof(struct sig) * this->numGenerals;
-    flag = (this->round == 1) ? 0 : MSG_DONTWAIT; // If this is the first round then make recvfrom() blocking, otherwise non-blocking.
+    bufferLen = this->recvBufferLen;
+    flag = (this->round == 1 && this->numValues == 0) ? 0 : MSG_DONTWAIT; // Block in the first round till the commander's order arrives, otherwise non-blocking.
 
     // Record the start time.
-    gettimeofday(&ackStart, NULL);
+    currentTime(&ackStart);
 
     while(diff < ACK_TIMEOUT) {
         ssize_t numBytes;
-        char *buffer = new char[bufferLen];
+        uint32_t peerId;
         struct sockaddr_in peerAddress;
-        socklen_t addrLen = sizeof(peerAddress);
+        retransmitDue();
 
         // Read the bytes from the socket.
-        if((numBytes = recvfrom(this->listenSocketFD, buffer, bufferLen, flag, (struct sockaddr *) &peerAddress, &addrLen)) == -1) {
+        if((numBytes = receive(buffer, bufferLen, flag, &peerAddress)) == -1) {
             if(errno != EWOULDBLOCK) {
-                perror("Failed to receive a message: recvfrom() failed");
+                perror("Failed to receive a message: recvmsg() failed");
             }
-        } else {
-            // Determine the type of message and call the appropriate message handler.
-            if(numBytes == sizeof(Ack)) {
-                this->state = ACK_RECEIVED;
-
-                handleAck(ntoh_ack((Ack *) buffer), peerAddress);
-                if(this->state == ACK_VERIFIED) {
-                    this->numMsgsSent--;
-                }
-            } else if(numBytes >= (sizeof(SignedMessage) + sizeof(struct sig))) {
-                this->state = MSG_RECEIVED;
-                handleMessage(ntoh_sm((SignedMessage *) buffer, numBytes), peerAddress, numBytes);
+        } else if(numBytes == 0 && this->interrupted != NULL && *(this->interrupted)) {
+            throw string("\nThe instance was interrupted.");
+        } else if(isOfInstance(buffer, numBytes) && (peerId = this->peers.lookup(peerAddress)) != NO_PEER) {
+            // The first round starts when the commander is heard from. Stop blocking from then on.
+            if(flag == 0) {
+                flag = MSG_DONTWAIT;
+                currentTime(&(this->start));
+                ackStart = this->start;
             }
+            handleDatagram(buffer, numBytes, peerId, peerAddress);
+            recordHandled(peerId);
 
-            if(this->numMsgsSent == 0) {
+            if(!deliveryPending()) {
                 this->state = ALL_ACKS_RECEIVED;
             }
         }
 
-        if(buffer) {
-            delete[] buffer;
-        }
-
         // Record the current time and calculate the difference from the time we started checking for ACKs.
         struct timeval end;
-        gettimeofday(&end, NULL);
+        currentTime(&end);
         diff = ((end.tv_sec * 1000000 + end.tv_usec) - (ackStart.tv_sec * 1000000 + ackStart.tv_usec));
     }
 
-    if(this->numMsgsSent > 0) {
+    if(deliveryPending()) {
         this->state = ALL_ACKS_NOT_RECEIVED;
     }
 }
 
-// Handles an ACK received.
-void Lieutenant::handleAck(Ack *ackData, struct sockaddr_in peerAddress) {
+// Calls the handler for the type of a datagram (or reassembled message, or message of a bundle) received from a general.
+void Lieutenant::handleDatagram(char *buffer, size_t numBytes, uint32_t peerId, const struct sockaddr_in &peerAddress) {
+    if(numBytes < sizeof(uint32_t)) {
+        return;
+    }
+    uint32_t type = ntohl(*(uint32_t *) buffer);
+
+    // Determine the type of message and call the appropriate message handler.
+    if(type == TYPE_ACK && numBytes == sizeof(Ack)) {
+        this->state = ACK_RECEIVED;
+        handleAck(ntoh_ack((Ack *) buffer), peerId);
+    } else if(type == TYPE_FRAGMENT_ACK && numBytes == sizeof(FragmentAck)) {
+        this->fragmenter.handleAck((FragmentAck *) buffer, peerId);
+    } else if(type == TYPE_FRAGMENT) {
+        // Handle the message once its last fragment has arrived (fragments never carry fragments).
+        size_t msgLen;
+        char *msg = this->fragmenter.handleFragment((Fragment *) buffer, numBytes, peerId, peerAddress, &msgLen);
+        if(msg && ntohl(*(uint32_t *) msg) != TYPE_FRAGMENT) {
+            handleDatagram(msg, msgLen, peerId, peerAddress);
+        }
+    } else if(type == TYPE_SEND && numBytes >= sizeof(SignedMessage) + sizeof(struct sig)) {
+        this->state = MSG_RECEIVED;
+        handleMessage(ntoh_sm((SignedMessage *) buffer, numBytes), peerId, numBytes);
+    } else if(type == TYPE_PAYLOAD && numBytes > sizeof(PayloadMessage)) {
+        handlePayload((PayloadMessage *) buffer, numBytes, peerId);
+    } else if(type == TYPE_PAYLOAD_REQUEST && numBytes == sizeof(PayloadRequest)) {
+        handlePayloadRequest((PayloadRequest *) buffer, peerId);
+    } else if(type == TYPE_BUNDLE) {
+        handleBundle(buffer, numBytes, peerId, peerAddress);
+    }
+}
+
+// Handles an ACK received from a general.
+void Lieutenant::handleAck(Ack *ackData, uint32_t peerId) {
     // Check if it is an expected ACK.
     if(ackData && ackData->type == TYPE_ACK && ackData->round == this->round) {
-        uint32_t peerId = this->ipToId[(peerAddress.sin_addr).s_addr];
-        this->sendQueue[peerId] = ACKED;
+        recordAck(peerId, ackData->hold_usec);
         this->state = ACK_VERIFIED;
     }
 }
 
-// Handles a message received.
-void Lieutenant::handleMessage(SignedMessage *msgReceived, struct sockaddr_in peerAddress, ssize_t numBytesReceived) {
-    sendAck(peerAddress);
+// Handles a message received from a general.
+// Only the chains that pass the cheap checks of admitChain() have their signatures verified.
+// In blind mode the message is not ACKed, and admitChain() counts it as a copy.
+void Lieutenant::handleMessage(SignedMessage *msgReceived, uint32_t peerId, ssize_t numBytesReceived) {
+    this->peers[peerId].msgsReceived++;
+    if(this->blindCopies == 0) {
+        sendAck(peerId);
+    }
     
-    // Do some sanity check on the message arrived.
-    if(msgReceived && msgReceived->type == TYPE_SEND && (msgReceived->order == RETREAT || msgReceived->order == ATTACK)) {
-        uint32_t numSignatures = (numBytesReceived - sizeof(SignedMessage)) / sizeof(struct sig);
-
-        if(numSignatures == msgReceived->total_sigs) {
-            // Verifies the signatures in the message.
-            verifySignatures(msgReceived->order, numSignatures, msgReceived->sigs);
-
-            // If the signatures are verified and if the value/order is not there in my set of values then include it.
-            if(this->state == SIGNATURE_VERIFIED && !isValueInSet(msgReceived->order)) {
-                if(msgReceived->total_sigs > this->round) {
-                    this->round++; // Catch up if lagging behind.
+    if(admitChain(msgReceived, peerId, numBytesReceived)) {
+        // Verifies the signatures in the message.
+        verifySignatures(msgReceived->digest, msgReceived->total_sigs, msgReceived->sigs);
+
+        // If the signatures are verified then include the value/order in my set of values.
+        if(this->state == SIGNATURE_VERIFIED) {
+            if(msgReceived->total_sigs > (uint32_t) this->round) {
+                this->round = msgReceived->total_sigs; // Catch up if lagging behind.
+            }
+            memcpy(this->values[this->numValues++], msgReceived->digest, DIGEST_SIZE); // admitChain() let in a new value only, and MAX_VALUES at most.
+            Chain received = makeChain(this->chains.insert(msgReceived), msgReceived->payload_len, msgReceived->digest);
+            keepEvidence(received);
+            this->state = VALUE_INCLUDED;
+            if(!this->adversary.has(DROP_RELAYS)) {
+                this->msgsBuilt[this->numMsgsBuilt++] = constructMessage(received); // A value is accepted at most MAX_VALUES times.
+            }
+            this->chains.release(received.tip);
+
+            // The payload of an order is known to everyone. Any other payload is asked for if it has not arrived.
+            if(this->payloads.find(msgReceived->digest) == NULL) {
+                int order = classify(msgReceived->digest);
+                if(order != OPAQUE_VALUE) {
+                    vector<uint8_t> payload;
+                    orderPayload(order, payload);
+                    this->payloads.put(&payload[0], payload.size(), msgReceived->digest);
+                } else {
+                    this->payloadSources[PayloadStore::key(msgReceived->digest)] = peerId;
+                    requestPayload(msgReceived->digest, peerId);
                 }
-                this->values.insert(msgReceived->order);
-                this->state = VALUE_INCLUDED;
-                this->msgsToForward.push_back(constructMessage(msgReceived));
             }
         }
     }
 }
 
-// Sends an ACK in response to a message received.
-void Lieutenant::sendAck(struct sockaddr_in peerAddress) {
-    long int diff = 0;
-    
-    while(diff < ROUND_TIMEOUT) {
-        int socketFD;
+// Counts a message received in blind mode, and tells its first copy from the others: a copy comes from the
+// same general with the same digest and number of signatures (which is the round it was sent in). The copies
+// of a message straddle the rounds of the generals that are not in step, so they are told apart by that.
+// A loyal general sends at most MAX_VALUES messages a round; those past that (from a faulty one) are not counted.
+void Lieutenant::countCopy(const SignedMessage *msgReceived, uint32_t peerId) {
+    uint32_t round = msgReceived->total_sigs;
+    CopySeen *seen = this->copiesSeen[peerId][round % COPY_ROUNDS];
+    CopySeen *freeSlot = NULL;
+    for(int i = 0; i < MAX_VALUES; i++) {
+        if(seen[i].round == round && memcmp(seen[i].digest, msgReceived->digest, DIGEST_SIZE) == 0) {
+            this->copiesReceived++;
+            return;
+        }
+        if(seen[i].round != round && freeSlot == NULL) {
+            freeSlot = &seen[i]; // Free, or left from COPY_ROUNDS rounds before.
+        }
+    }
+    if(freeSlot != NULL) {
+        freeSlot->round = round;
+        memcpy(freeSlot->digest, msgReceived->digest, DIGEST_SIZE);
+        this->copiesReceived++;
+        this->messagesReceived++;
+    }
+}
 
-        // Prepare a socket to send the ACK.
-        if((socketFD = socket(peerAddress.sin_family, SOCK_DGRAM, 0)) == -1) {
-            perror("Failed to create a socket: socket() failed.");
-            continue;
+// Runs the cheap checks on a chain, in order of cost.
+// Returns true only if the chain is well formed and verifying it could change anything:
+// its value must be new, and the general who sent it must not have used up his verifications for the round.
+bool Lieutenant::admitChain(SignedMessage *msgReceived, uint32_t peerId, ssize_t numBytesReceived) {
+    // Type and length.
+    if(msgReceived == NULL || msgReceived->type != TYPE_SEND || msgReceived->payload_len == 0 || msgReceived->payload_len > MAX_PAYLOAD_SIZE) {
+        return false;
+    }
+    uint32_t numSignatures = (numBytesReceived - sizeof(SignedMessage)) / sizeof(struct sig);
+    if(numSignatures != msgReceived->total_sigs) {
+        return false;
+    }
+
+    // Round range: a chain has one signature per round, and may be at most a round ahead of mine.
+    // A lieutenant that has not heard of any value yet (that gossip has not reached yet) joins in the round of the chain.
+    if(numSignatures == 0 || numSignatures > (uint32_t) this->lastRound || (numSignatures > (uint32_t) this->round + 1 && this->numValues > 0)) {
+        return false;
+    }
+
+    // In blind mode, a well formed chain of a round in play is a copy, whether its value is new or not.
+    if(this->blindCopies > 0) {
+        countCopy(msgReceived, peerId);
+    }
+
+    // Values already known change nothing, and neither does any value once MAX_VALUES are known.
+    if(this->numValues >= MAX_VALUES || isValueInSet(msgReceived->digest)) {
+        return false;
+    }
+
+    // The chain starts with the commander and ends with the general who sent it, signed by distinct generals other than me.
+    struct sig *signs = msgReceived->sigs;
+    if(signs[0].id != COMMANDER_ID || signs[numSignatures - 1].id != peerId) {
+        return false;
+    }
+    bool distinct = true;
+    for(uint32_t i = 0; i < numSignatures && distinct; i++) {
+        uint32_t signerId = signs[i].id;
+        distinct = (signerId > 0 && signerId <= (uint32_t) this->numGenerals && signerId != this->myId && !this->signerSeen[signerId]);
+        if(distinct) {
+            this->signerSeen[signerId] = 1;
+        }
+    }
+    for(uint32_t i = 0; i < numSignatures; i++) {
+        if(signs[i].id <= (uint32_t) this->numGenerals) {
+            this->signerSeen[signs[i].id] = 0;
+        }
+    }
+    if(!distinct) {
+        return false;
+    }
+
+    // A loyal general relays at most MAX_VALUES chains, so a flood from a faulty one is cut off here.
+    if(this->verifiesLeft[peerId] == 0) {
+        return false;
+    }
+    this->verifiesLeft[peerId]--;
+    return true;
+}
+
+// Handles a payload received from a general.
+// Only payloads of values in the set, or sent by the commander, are kept.
+void Lieutenant::handlePayload(PayloadMessage *payloadMsg, size_t numBytesReceived, uint32_t peerId) {
+    size_t payloadLen = ntohl(payloadMsg->payload_len);
+    if(numBytesReceived != sizeof(PayloadMessage) + payloadLen || this->payloads.find(payloadMsg->digest) != NULL) {
+        return;
+    }
+
+    if(isValueInSet(payloadMsg->digest) || (peerId == COMMANDER_ID && !this->payloads.isFull())) {
+        if(this->payloads.put(payloadMsg->payload, payloadLen, payloadMsg->digest)) {
+            this->payloadSources.erase(PayloadStore::key(payloadMsg->digest));
         }
+    }
+}
 
-        int numBytes;
-        Ack *ackData = new Ack;
-        ackData->type = TYPE_ACK;
-        ackData->round = this->round;
+// Sends an ACK in response to a message received. It goes out with the others of the pass.
+void Lieutenant::sendAck(uint32_t peerId) {
+    long int diff = 0;
+    Peer &peer = this->peers[peerId];
 
-        struct sockaddr_in sendtoAddr;
-        memset((char *)&sendtoAddr, 0, sizeof(peerAddress));
-        string ip = inet_ntoa(peerAddress.sin_addr);
-        sendtoAddr.sin_family = AF_INET;
-        sendtoAddr.sin_port = htons((unsigned short int) atoi(this->listenPort.c_str()));
-        inet_aton(ip.c_str(), &sendtoAddr.sin_addr);
+    Ack ackData;
+    ackData.type = TYPE_ACK;
+    ackData.instance = this->instance;
+    ackData.round = this->round;
+    ackData.hold_usec = holdTime();
+    hton_ack(&ackData);
 
-        // Send the ACK prepared above and to the address prepared above.
-        if((numBytes = sendto(socketFD, (void *) hton_ack(ackData), sizeof(Ack), 0, (struct sockaddr *) &sendtoAddr, sizeof(sendtoAddr))) == -1) {
-            cerr<<"Failed to send ACK to "<<ipToId[(peerAddress.sin_addr).s_addr];
-            perror("Failed to send: sendto() failed");
+    while(diff < ROUND_TIMEOUT) {
+        // Send the ACK prepared above to the address of the general.
+        if(this->fragmenter.sendDatagram(&ackData, sizeof(Ack), peerId, peer.address) == -1) {
+            cerr<<"Failed to send ACK to "<<peerId;
+            perror("Failed to send: sendmsg() failed");
 
             // Record the current time and calculate the difference from the time we started this round.
             struct timeval end;
-            gettimeofday(&end, NULL);
+            currentTime(&end);
             diff = ((end.tv_sec * 1000000 + end.tv_usec) - ((this->start).tv_sec * 1000000 + (this->start).tv_usec));
 
             continue;
         }
+        break;
+    }
+}
 
-        close(socketFD);
-        if(ackData) {
-            delete ackData;
+// Asks a general (and the commander) for a missing payload.
+void Lieutenant::requestPayload(const uint8_t *digest, uint32_t peerId) {
+    PayloadRequest request;
+    request.type = htonl(TYPE_PAYLOAD_REQUEST);
+    request.instance = htonl(this->instance);
+    memcpy(request.digest, digest, DIGEST_SIZE);
+
+    uint32_t ids[] = { peerId, COMMANDER_ID };
+    for(int i = 0; i < 2; i++) {
+        Peer &peer = this->peers[ids[i]];
+        if(ids[i] == this->myId || (i == 1 && peerId == COMMANDER_ID) || peer.address.sin_family != AF_INET) {
+            continue;
         }
-        break;
+        if(this->fragmenter.sendDatagram(&request, sizeof(request), ids[i], peer.address) == -1) {
+            perror("Failed to ask for a payload: sendmsg() failed");
+        }
+    }
+}
+
+// Asks again for all the payloads still missing.
+void Lieutenant::requestMissingPayloads() {
+    for(map<string, uint32_t>::iterator iter = this->payloadSources.begin(); iter != this->payloadSources.end(); iter++) {
+        requestPayload((const uint8_t *) iter->first.data(), iter->second);
+    }
+}
+
+// Waits for the payload of the decided value till it arrives or a round passes.
+void Lieutenant::fetchPayload() {
+    long int diff = 0;
+    currentTime(&(this->start)); // Record the start time.
+
+    while(this->payloads.find(this->decision) == NULL && diff < ROUND_TIMEOUT) {
+        requestMissingPayloads();
+        receiveMessage();
+
+        // Record the current time and calculate the difference from the time we started waiting.
+        struct timeval end;
+        currentTime(&end);
+        diff = ((end.tv_sec * 1000000 + end.tv_usec) - ((this->start).tv_sec * 1000000 + (this->start).tv_usec));
     }
 }
 
 // Verified the digital signature in a message received.
-void Lieutenant::verifySignatures(uint32_t order, uint32_t totalSigns, struct sig *signs) {
+// The first signature is over the instance and the digest of the payload, every other one over the signature before it.
+// They are verified from the last, all at once, so that what they are over is hashed side by side.
+void Lieutenant::verifySignatures(const uint8_t *digest, uint32_t totalSigns, struct sig *signs) {
     if(!this->cryptoOff) {
-        for(int i = totalSigns - 1; i >= 0; i--) {
-            int dataLen;
-            char *data;
-            string id = intToString(signs[i].id);
+        uint8_t value[SIGNED_VALUE_SIZE];
+        signedValue(this->instance, digest, value);
 
-            if(i == 0) {
-                data = (char *) &order;
-                dataLen = sizeof(order);
-            } else {
-                data = (char *) signs[i-1].signature;
-                dataLen = SIG_SIZE;
+        // The signers must be generals whose public keys we hold: those before the last that is not are not checked.
+        SignatureCheck checks[MAX_GENERALS];
+        uint32_t numChecks = 0;
+        for(int i = totalSigns - 1; i >= 0; i--) {
+            uint32_t signerId = signs[i].id;
+            if(signerId == 0 || signerId > (uint32_t) this->numGenerals || this->peers[signerId].pubKey == NULL) {
+                break;
             }
 
-            EVP_MD_CTX md_ctx;
-            
-            // Verify the signature
-            EVP_VerifyInit(&md_ctx, EVP_sha1());
-            EVP_VerifyUpdate(&md_ctx, data, dataLen);
-            int err = EVP_VerifyFinal(&md_ctx, signs[i].signature, SIG_SIZE, this->idToCert[signs[i].id]);
-
-            if(err != 1) {
-                ERR_print_errors_fp (stderr);
-                return;
-            }
+            SignatureCheck &check = checks[numChecks++];
+            check.key = this->peers[signerId].pubKey;
+            check.data = (i == 0) ? (const void *) value : (const void *) signs[i-1].signature;
+            check.dataLen = (i == 0) ? SIGNED_VALUE_SIZE : SIG_SIZE;
+            check.signature = signs[i].signature;
+        }
 
-            // Update the send status to refelct that this general should not be sent a message.
-            this->sendQueue[signs[i].id - 1] = DO_NOT_SEND;
+        // Verify the signatures, and update the send status of every general whose signature verified
+        // to reflect that he should not be sent a message.
+        uint32_t numVerified = verifyBatch(checks, numChecks);
+        for(uint32_t i = 0; i < numVerified; i++) {
+            this->peers.setSendStatus(signs[totalSigns - 1 - i].id, DO_NOT_SEND);
+        }
+        if(numVerified < numChecks) {
+            ERR_print_errors_fp (stderr);
+        }
+        if(numVerified < totalSigns) {
+            return;
         }
     }
     this->state = SIGNATURE_VERIFIED;
 }
 
-// Constructs a message to be sent.
-SignedMessage* Lieutenant::constructMessage(SignedMessage *msgReceived) {
-    struct sig *sign = signMessage(msgReceived->sigs[this->round - 1].signature, SIG_SIZE);
-    SignedMessage *message = (SignedMessage *) malloc(sizeof(SignedMessage) + (sizeof(struct sig) * (this->round + 1)));
-    message->type = TYPE_SEND;
-    message->total_sigs = this->round + 1;
-    message->order = msgReceived->order;
-    memcpy(message->sigs, msgReceived->sigs, this->round * sizeof(struct sig)); // Copy the existing signatures.
-    memcpy(&(message->sigs[this->round]), sign, sizeof(struct sig));            // Copy the current signature.
-    message = hton_sm(message);
-
-    if(sign) {
-        delete sign;
-    }
-    return message;
+// Constructs a message to be sent: the chain received, with my signature added to it.
+// Only the new signature takes memory. The chain received is shared with it in the trie.
+Chain Lieutenant::constructMessage(const Chain &received) {
+    const SignedMessage *header = (const SignedMessage *) received.header;
+    struct sig sign;
+    signMessage(received.tip->sign.signature, SIG_SIZE, &sign); // Sign the last signature.
+    if(this->adversary.has(FORGE_RELAYS)) {
+        sign.signature[this->adversary.random() % SIG_SIZE] ^= 0xff; // Relay it under a signature that does not verify.
+    }
+    sign.id = htonl(sign.id);
+    return makeChain(this->chains.extend(received.tip, &sign), ntohl(header->payload_len), header->digest);
 }
 
 // Forwards messages to the generals.
 long int Lieutenant::forwardMessages() throw(string) {
     long int diff = 0;
+    int sendState = this->state; // Every message is sent to the generals this state calls for.
 
     // Loop over the mssages to be sent till the round lasts.
-    for(vector<SignedMessage*>::iterator iter = this->msgsToForward.begin(); iter != this->msgsToForward.end() && diff < ROUND_TIMEOUT; iter++) {
+    for(Chain *iter = this->msgsToForward; iter != this->msgsToForward + this->numMsgsToForward && diff < ROUND_TIMEOUT; iter++) {
+        this->state = sendState;
+
         // Loop over till all messages are sent to all requried generals or till the round lasts.
         while(this->state != ALL_SENT && diff < ROUND_TIMEOUT) {
             sendOrder(*iter);
-            for(int i = 0; i < this->numGenerals; i++) {
-                if(this->sendQueue[i] == NOT_SENT) {
-                    cerr<<"\nCould not send message to: "<<this->hostNames[i];
-                    this->state = ALL_NOT_SENT;
-                    break;
-                }
+            if(this->peers.countSendStatus(NOT_SENT) > 0) {
+                cerr<<"\nCould not send message to: "<<this->hostNames[this->peers.nextWithSendStatus(SEND_STATUS_BIT(NOT_SENT), NO_PEER) - 1];
+                this->state = ALL_NOT_SENT;
             }
 
             // Record the current time and calculate the difference from the time we started checking for ACKs.
             struct timeval end;
-            gettimeofday(&end, NULL);
+            currentTime(&end);
             diff = ((end.tv_sec * 1000000 + end.tv_usec) - (this->start.tv_sec * 1000000 + this->start.tv_usec));
 
             if(this->state == ALL_NOT_SENT) {
@@ -339,10 +485,41 @@ long int Lieutenant::forwardMessages() throw(string) {
     return diff;
 }
 
+// Sends the messages of the round again to a general whose ACK is overdue.
+void Lieutenant::resend(uint32_t generalId) {
+    for(int i = 0; i < this->numMsgsToForward; i++) {
+        sendMessage(this->msgsToForward[i], generalId);
+    }
+}
+
+// Keeps receiving, without relaying, till the relay delay of the adversary passes (counted from the start of the round).
+// With a delay of a round or more, the relays never go out.
+void Lieutenant::holdRelays() {
+    if(!this->adversary.has(DELAY_RELAYS)) {
+        return;
+    }
+
+    long int diff = 0;
+    while(diff < this->adversary.relayDelay() && diff < ROUND_TIMEOUT) {
+        receiveMessage();
+
+        struct timeval end;
+        currentTime(&end);
+        diff = ((end.tv_sec * 1000000 + end.tv_usec) - (this->start.tv_sec * 1000000 + this->start.tv_usec));
+    }
+}
+
+// Lets every general have VERIFIES_PER_PEER_PER_ROUND chains verified in the round.
+void Lieutenant::resetVerifies() {
+    for(uint32_t id = 0; id <= (uint32_t) this->numGenerals; id++) {
+        this->verifiesLeft[id] = VERIFIES_PER_PEER_PER_ROUND;
+    }
+}
+
 // Check if a value is in the set values.
-bool Lieutenant::isValueInSet(int order) {
-	for(set<int>::iterator iter = this->values.begin(); iter != this->values.end(); iter++) {
-		if(*iter == order) {
+bool Lieutenant::isValueInSet(const uint8_t *digest) {
+	for(int i = 0; i < this->numValues; i++) {
+		if(memcmp(this->values[i], digest, DIGEST_SIZE) == 0) {
 			return true;
 		}
 	}
@@ -350,11 +527,16 @@ bool Lieutenant::isValueInSet(int order) {
 }
 
 // Takes a decision based on the values in the set.
+// Without exactly one value the decision is the default order, RETREAT.
 int Lieutenant::decide() {
-	if(this->values.empty() || this->values.size() >= 2) {
-		return RETREAT;
+	if(this->numValues != 1) {
+		vector<uint8_t> payload;
+		orderPayload(RETREAT, payload);
+		this->payloads.put(&payload[0], payload.size(), NULL);
+		PayloadStore::digest(&payload[0], payload.size(), this->decision);
 	} else {
-		set<int>::iterator iter = this->values.begin();
-		return *iter;
+		memcpy(this->decision, this->values[0], DIGEST_SIZE);
 	}
+	this->decided = true;
+	return classify(this->decision);
 }
@@ -8,32 +8,59 @@
 #ifndef LIEUTENANT_H
 #define LIEUTENANT_H
 
-#include <set>
 #include "General.h"
 
+#define MAX_VALUES 2                  // Once a lieutenant holds this many values, no other can change his decision.
+#define VERIFIES_PER_PEER_PER_ROUND 2 // Chains of a general verified in a round (a loyal one relays at most MAX_VALUES).
+#define COPY_ROUNDS 2                 // Rounds whose blind copies are told apart at once (generals may be a round apart).
+
+// A message received in blind mode from a general: the round it was sent in (its number of signatures) and its value.
+typedef struct {
+    uint32_t round;              // 0 for a free slot.
+    uint8_t digest[DIGEST_SIZE];
+} CopySeen;
+
 class Lieutenant : public General {
 
     private:
-        std::set<int> values;                       // The set of values obtained from all generals.
-        std::vector<SignedMessage *> msgsToForward; // The list of messages to forward/send to generals.
-        std::map<uint32_t, EVP_PKEY *> idToCert;    // Map for General Id : Digital Certificate
+        uint8_t values[MAX_VALUES][DIGEST_SIZE];    // The set of values (payload digests) obtained from all generals.
+        int numValues;                              // Number of values in the set.
+        std::map<std::string, uint32_t> payloadSources; // Value : General that relayed it, for the values whose payload is missing.
+        CopySeen copiesSeen[MAX_GENERALS + 1][COPY_ROUNDS][MAX_VALUES]; // Messages received in blind mode, by general, round (modulo COPY_ROUNDS) and value.
+        Chain msgsToForward[MAX_VALUES];            // The messages to forward/send to generals in this round (one per value at most).
+        int numMsgsToForward;                       // Number of messages to forward in this round.
+        Chain msgsBuilt[MAX_VALUES];                // The messages built in this round, to be forwarded in the next one.
+        int numMsgsBuilt;                           // Number of messages built in this round.
+        uint32_t verifiesLeft[MAX_GENERALS + 1];    // Chains of each general that may still be verified in this round, indexed by id.
+        uint8_t signerSeen[MAX_GENERALS + 1];       // Scratch space to find repeated signers in a chain, indexed by id.
+        char *recvBuffer;                           // Buffer that messages are received into.
+        int recvBufferLen;                          // Size of the receive buffer.
         struct timeval start;                       // Stores the start time after sending a message to generals.
 
-        void loadCertificates() throw(std::string);                       // Loads the digital certficates of all generals and stores them.                       
         void receiveAndForward() throw(std::string);                      // It loops over the actions of receiving messages and forwarding messages.
-        void receiveMessage();                                            // Received any message that has arrived at the socket.
-        void handleAck(Ack *, struct sockaddr_in);                        // Handles an ACK received.
-        void handleMessage(SignedMessage *, struct sockaddr_in, ssize_t); // Handles a message received.
-        void sendAck(struct sockaddr_in);                                 // Sends an ACK in response to a message received.
-        void verifySignatures(uint32_t, uint32_t, struct sig *);          // Verified the digital signature in a message received.
-        SignedMessage *constructMessage(SignedMessage *);                 // Constructs a message to be sent.
+        void receiveMessage() throw(std::string);                         // Received any message that has arrived at the socket.
+        void handleDatagram(char *, size_t, uint32_t, const struct sockaddr_in &); // Calls the handler for the type of a datagram (or reassembled message) received.
+        void handleAck(Ack *, uint32_t);                                  // Handles an ACK received from a general.
+        void handleMessage(SignedMessage *, uint32_t, ssize_t);           // Handles a message received from a general.
+        void countCopy(const SignedMessage *, uint32_t);                  // Counts a message received in blind mode, and whether it is the first copy.
+        bool admitChain(SignedMessage *, uint32_t, ssize_t);              // Runs the cheap checks on a chain. Returns true if verifying it could change anything.
+        void handlePayload(PayloadMessage *, size_t, uint32_t);           // Handles a payload received from a general.
+        void sendAck(uint32_t);                                           // Sends an ACK in response to a message received.
+        void requestPayload(const uint8_t *, uint32_t);                   // Asks a general (and the commander) for a missing payload.
+        void requestMissingPayloads();                                    // Asks again for all the payloads still missing.
+        void fetchPayload();                                              // Waits for the payload of the decided value till it arrives or a round passes.
+        void verifySignatures(const uint8_t *, uint32_t, struct sig *);   // Verified the digital signature in a message received.
+        Chain constructMessage(const Chain &);                            // Constructs a message to be sent.
         long int forwardMessages() throw(std::string);                    // Forwards messages to the generals.
-        bool isValueInSet(int);                                           // Check if a value is in the set values.
+        void resend(uint32_t);                                            // Sends the messages of the round again to a general.
+        void holdRelays();                                                // Keeps receiving, without relaying, till the relay delay of the adversary passes.
+        void resetVerifies();                                             // Lets every general have his chains verified again in the round.
+        bool isValueInSet(const uint8_t *);                               // Check if a value is in the set values.
         int decide();                                                     // Takes a decision based on the values in the set.
 
     public:
-        Lieutenant(GeneralInfo *) throw(std::string); // Constructor to initialize variables, to call parent's parametrized constructor and to load digital certificates of the generals.
-        ~Lieutenant();                                // Frees the loaded certificates.
+        Lieutenant(GeneralInfo *) throw(std::string); // Constructor to initialize variables, to call parent's parametrized constructor and to have the public keys of the generals loaded.
+        ~Lieutenant();                                // Frees the receive buffer.
         int run() throw(std::string);                 // Implements the pure virtual function of the parent that kicks off the algorithm.
 };
 
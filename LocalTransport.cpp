@@ -0,0 +1,452 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the shared memory transport between generals |
+| co-located on one host. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <sstream>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <ifaddrs.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include "LocalTransport.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+using namespace std;
+
+// What a ring is handed over with (the memfd goes along as SCM_RIGHTS).
+typedef struct {
+    uint32_t fromId; // General sending.
+    uint32_t shard;  // Shard of both.
+} LocalOffer;
+
+// Constructor to initialize variables.
+LocalTransport::LocalTransport() {
+    this->myId = 0;
+    this->shard = 0;
+    this->numShards = 1;
+    this->socketFD = -1;
+    this->nextIn = 0;
+}
+
+// Destructor to close the rings and the socket.
+LocalTransport::~LocalTransport() {
+    close();
+}
+
+// Opens the socket of a shard of a general, named after the port, the general and the shard.
+// addresses[i] is the address of the general with id i + 1. The generals at addresses of this host are co-located.
+void LocalTransport::init(uint32_t myId, uint32_t shard, uint32_t numShards, const string &port, const vector<struct sockaddr_in> &addresses) throw(string) {
+    this->myId = myId;
+    this->shard = shard;
+    this->numShards = numShards;
+    this->port = port;
+    this->colocated.assign(addresses.size() + 1, 0);
+    for(uint32_t id = 1; id <= addresses.size(); id++) {
+        this->colocated[id] = (id != myId && isLocal(addresses[id - 1]));
+    }
+
+    Link none;
+    none.ring = NULL;
+    none.retryAt = 0;
+    this->outLinks.assign(addresses.size() + 1, none);
+    this->inRings.assign(addresses.size() + 1, (LocalRing *) NULL);
+
+    struct sockaddr_un name;
+    socklen_t nameLen;
+    socketName(myId, &name, &nameLen);
+    if((this->socketFD = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        perror("Failed to create the socket for the co-located generals: socket() failed");
+        throw string("\nCould not open the shared memory transport.");
+    }
+    if(bind(this->socketFD, (struct sockaddr *) &name, nameLen) == -1) {
+        perror("Failed to bind the socket for the co-located generals: bind() failed");
+        throw string("\nCould not open the shared memory transport (is a general with the same id running here?).");
+    }
+}
+
+// Writes a datagram to the ring of a general, and rings his doorbell if he sleeps.
+// Returns false if it has to go by UDP: the general is not co-located, his ring is not accepted yet or it is full.
+bool LocalTransport::send(uint32_t peerId, const struct iovec *iov, int iovcnt) {
+    if(peerId >= this->colocated.size() || !this->colocated[peerId]) {
+        return false;
+    }
+
+    Link &link = this->outLinks[peerId];
+    if(link.ring == NULL) {
+        if(now() >= link.retryAt) {
+            offer(peerId); // It is written to once it is accepted.
+        }
+        return false;
+    }
+
+    LocalRing *ring = link.ring;
+    uint32_t state = __atomic_load_n(&(ring->state), __ATOMIC_ACQUIRE);
+    if(state != RING_ACCEPTED) {
+        if(state != RING_OFFERED) {
+            dropOut(peerId);
+        }
+        return false;
+    }
+
+    size_t len = 0;
+    for(int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    size_t recordSize = sizeof(LocalRecord) + ((len + 7) & ~((size_t) 7));
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE);
+    size_t offset = head % LOCAL_RING_SIZE;
+    size_t contiguous = LOCAL_RING_SIZE - offset;
+    size_t needed = (recordSize <= contiguous) ? recordSize : contiguous + recordSize;
+    if(LOCAL_RING_SIZE - (head - tail) < needed) {
+        return false;
+    }
+
+    // A datagram that does not fit before the end of the ring goes to its start.
+    if(recordSize > contiguous) {
+        uint32_t wrap = LOCAL_WRAP;
+        memcpy(ring->data + offset, &wrap, sizeof(wrap));
+        head += contiguous;
+        offset = 0;
+    }
+    LocalRecord *record = (LocalRecord *) (ring->data + offset);
+    record->len = len;
+    record->stamp = now();
+    char *next = (char *) (record + 1);
+    for(int i = 0; i < iovcnt; i++) {
+        memcpy(next, iov[i].iov_base, iov[i].iov_len);
+        next += iov[i].iov_len;
+    }
+
+    // Publish it, then ring the doorbell if the receiver went to sleep (only the sender who wakes him rings).
+    __atomic_store_n(&(ring->head), head + recordSize, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&(ring->sleeping), __ATOMIC_SEQ_CST) && __atomic_exchange_n(&(ring->sleeping), 0, __ATOMIC_SEQ_CST)) {
+        ringDoorbell(peerId);
+    }
+    return true;
+}
+
+// Reads the next datagram of any ring into a buffer, taking the rings in turn.
+// Returns its length (cut to the buffer) and sets the general who sent it and when. Returns -1 if there is none.
+ssize_t LocalTransport::receive(char *buffer, size_t bufferLen, uint32_t *peerId, int64_t *stamp) {
+    for(size_t n = 0; n < this->inPeers.size(); n++) {
+        size_t i = (this->nextIn + n) % this->inPeers.size();
+        LocalRing *ring = this->inRings[this->inPeers[i]];
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+        if(head == tail) {
+            continue;
+        }
+
+        size_t offset = tail % LOCAL_RING_SIZE;
+        uint32_t len;
+        memcpy(&len, ring->data + offset, sizeof(len));
+        if(len == LOCAL_WRAP) {
+            tail += LOCAL_RING_SIZE - offset;
+            offset = 0;
+            memcpy(&len, ring->data, sizeof(len));
+        }
+
+        // The sender is another process: a ring he wrote past its bounds is let go.
+        if(head - tail > LOCAL_RING_SIZE || head == tail || len > LOCAL_RING_SIZE - offset - sizeof(LocalRecord)) {
+            dropIn(this->inPeers[i]);
+            return -1;
+        }
+
+        const LocalRecord *record = (const LocalRecord *) (ring->data + offset);
+        size_t copyLen = (len < bufferLen) ? len : bufferLen;
+        memcpy(buffer, record + 1, copyLen);
+        *stamp = record->stamp;
+        *peerId = this->inPeers[i];
+        __atomic_store_n(&(ring->tail), tail + sizeof(LocalRecord) + ((len + 7) & ~((size_t) 7)), __ATOMIC_RELEASE);
+        this->nextIn = i + 1;
+        return copyLen;
+    }
+    return -1;
+}
+
+// Takes the rings handed over on the socket and drains the doorbell.
+// Rings closed by their senders are let go once they are read to the end.
+void LocalTransport::service() {
+    if(this->socketFD == -1) {
+        return;
+    }
+
+    while(true) {
+        LocalOffer handed;
+        struct iovec iov;
+        iov.iov_base = &handed;
+        iov.iov_len = sizeof(handed);
+
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &iov;
+        header.msg_iovlen = 1;
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+
+        if(recvmsg(this->socketFD, &header, MSG_DONTWAIT | MSG_CMSG_CLOEXEC) == -1) {
+            break;
+        }
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != NULL; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+            if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+                accept(fd);
+            }
+        }
+    }
+
+    for(size_t i = 0; i < this->inPeers.size(); ) {
+        LocalRing *ring = this->inRings[this->inPeers[i]];
+        if(__atomic_load_n(&(ring->state), __ATOMIC_ACQUIRE) == RING_CLOSED && __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE) == ring->tail) {
+            dropIn(this->inPeers[i]);
+        } else {
+            i++;
+        }
+    }
+}
+
+// Sleeps till a datagram arrives on a ring or on the given UDP socket, or the timeout (in milliseconds, -1 for none) passes.
+// The senders are asked to ring the doorbell first, and the rings are looked at once more after that, so no wakeup is lost.
+void LocalTransport::wait(int udpSocketFD, int timeoutMs) {
+    bool ready = false;
+    for(size_t i = 0; i < this->inPeers.size(); i++) {
+        __atomic_store_n(&(this->inRings[this->inPeers[i]]->sleeping), 1, __ATOMIC_SEQ_CST);
+    }
+    for(size_t i = 0; i < this->inPeers.size() && !ready; i++) {
+        LocalRing *ring = this->inRings[this->inPeers[i]];
+        ready = (__atomic_load_n(&(ring->head), __ATOMIC_SEQ_CST) != ring->tail);
+    }
+
+    if(!ready) {
+        struct pollfd fds[2];
+        fds[0].fd = udpSocketFD;
+        fds[0].events = POLLIN;
+        fds[1].fd = this->socketFD;
+        fds[1].events = POLLIN;
+        poll(fds, 2, timeoutMs);
+    }
+
+    for(size_t i = 0; i < this->inPeers.size(); i++) {
+        __atomic_store_n(&(this->inRings[this->inPeers[i]]->sleeping), 0, __ATOMIC_RELAXED);
+    }
+    service();
+}
+
+// Closes the rings and the socket. The generals on the other ends see the rings closed.
+void LocalTransport::close() {
+    while(!this->inPeers.empty()) {
+        dropIn(this->inPeers.back());
+    }
+    for(uint32_t id = 0; id < this->outLinks.size(); id++) {
+        dropOut(id);
+    }
+    if(this->socketFD != -1) {
+        ::close(this->socketFD);
+        this->socketFD = -1;
+    }
+}
+
+// Makes a ring to a general and hands it over to his shard of the same index.
+// If he is not up yet, a ring is offered again after LOCAL_RETRY_USEC.
+void LocalTransport::offer(uint32_t peerId) {
+    Link &link = this->outLinks[peerId];
+    link.retryAt = now() + LOCAL_RETRY_USEC;
+
+    int fd = syscall(SYS_memfd_create, "byzgen-ring", MFD_CLOEXEC);
+    if(fd == -1) {
+        return;
+    }
+    LocalRing *ring = (ftruncate(fd, sizeof(LocalRing)) == 0) ? mapRing(fd) : NULL;
+    if(ring == NULL) {
+        ::close(fd);
+        return;
+    }
+    ring->magic = LOCAL_RING_MAGIC;
+    ring->fromId = this->myId;
+    ring->toId = peerId;
+    ring->shard = this->shard;
+    ring->numShards = this->numShards;
+    ring->state = RING_OFFERED;
+
+    LocalOffer handed;
+    handed.fromId = this->myId;
+    handed.shard = this->shard;
+    struct iovec iov;
+    iov.iov_base = &handed;
+    iov.iov_len = sizeof(handed);
+
+    struct sockaddr_un name;
+    socklen_t nameLen;
+    socketName(peerId, &name, &nameLen);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_name = &name;
+    header.msg_namelen = nameLen;
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+    if(sendmsg(this->socketFD, &header, MSG_DONTWAIT) == -1) {
+        munmap(ring, sizeof(LocalRing));
+    } else {
+        link.ring = ring;
+    }
+    ::close(fd);
+}
+
+// Takes a ring handed over, if it is meant for this shard and comes from a co-located general.
+// A ring from a general who runs a different number of shards is refused: his instances would reach the wrong shard.
+void LocalTransport::accept(int fd) {
+    LocalRing *ring = mapRing(fd);
+    ::close(fd);
+    if(ring == NULL) {
+        return;
+    }
+
+    uint32_t fromId = ring->fromId;
+    if(ring->magic != LOCAL_RING_MAGIC || ring->toId != this->myId || ring->shard != this->shard || fromId >= this->colocated.size() || !this->colocated[fromId]) {
+        munmap(ring, sizeof(LocalRing));
+        return;
+    }
+    if(ring->numShards != this->numShards) {
+        __atomic_store_n(&(ring->state), RING_REFUSED, __ATOMIC_RELEASE);
+        munmap(ring, sizeof(LocalRing));
+        return;
+    }
+
+    // A general who restarted hands over a new ring.
+    if(this->inRings[fromId] != NULL) {
+        dropIn(fromId);
+    }
+    this->inRings[fromId] = ring;
+    this->inPeers.push_back(fromId);
+    __atomic_store_n(&(ring->state), RING_ACCEPTED, __ATOMIC_RELEASE);
+}
+
+// Lets go of the ring from a general, and tells him.
+void LocalTransport::dropIn(uint32_t peerId) {
+    LocalRing *ring = this->inRings[peerId];
+    if(ring == NULL) {
+        return;
+    }
+    __atomic_store_n(&(ring->state), RING_CLOSED, __ATOMIC_RELEASE);
+    munmap(ring, sizeof(LocalRing));
+    this->inRings[peerId] = NULL;
+    for(size_t i = 0; i < this->inPeers.size(); i++) {
+        if(this->inPeers[i] == peerId) {
+            this->inPeers.erase(this->inPeers.begin() + i);
+            break;
+        }
+    }
+}
+
+// Lets go of the ring to a general, and tells him. Another one is offered after LOCAL_RETRY_USEC.
+void LocalTransport::dropOut(uint32_t peerId) {
+    Link &link = this->outLinks[peerId];
+    if(link.ring == NULL) {
+        return;
+    }
+    __atomic_store_n(&(link.ring->state), RING_CLOSED, __ATOMIC_RELEASE);
+    munmap(link.ring, sizeof(LocalRing));
+    link.ring = NULL;
+    link.retryAt = now() + LOCAL_RETRY_USEC;
+}
+
+// Rings the doorbell of a general. A general whose socket is gone went away, and so did his end of the ring.
+void LocalTransport::ringDoorbell(uint32_t peerId) {
+    struct sockaddr_un name;
+    socklen_t nameLen;
+    socketName(peerId, &name, &nameLen);
+
+    char bell = 0;
+    if(sendto(this->socketFD, &bell, sizeof(bell), MSG_DONTWAIT, (struct sockaddr *) &name, nameLen) == -1 && errno == ECONNREFUSED) {
+        dropOut(peerId);
+    }
+}
+
+// Builds the name of the socket of the shard (of the same index) of a general, in the abstract namespace.
+void LocalTransport::socketName(uint32_t id, struct sockaddr_un *name, socklen_t *nameLen) {
+    stringstream path;
+    path<<"byzgen."<<this->port<<"."<<id<<"."<<this->shard;
+    string text = path.str();
+
+    memset(name, 0, sizeof(*name));
+    name->sun_family = AF_UNIX;
+    memcpy(name->sun_path + 1, text.data(), text.size()); // sun_path[0] is 0: the name is abstract.
+    *nameLen = offsetof(struct sockaddr_un, sun_path) + 1 + text.size();
+}
+
+// Maps a ring. Returns NULL if the descriptor does not hold one.
+LocalRing *LocalTransport::mapRing(int fd) {
+    struct stat info;
+    if(fstat(fd, &info) == -1 || info.st_size != (off_t) sizeof(LocalRing)) {
+        return NULL;
+    }
+    void *mem = mmap(NULL, sizeof(LocalRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return (mem == MAP_FAILED) ? NULL : (LocalRing *) mem;
+}
+
+// Returns the time in microseconds.
+int64_t LocalTransport::now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+// Is any general other than the given one on this host?
+bool LocalTransport::isColocated(const vector<struct sockaddr_in> &addresses, uint32_t myId) {
+    for(uint32_t id = 1; id <= addresses.size(); id++) {
+        if(id != myId && isLocal(addresses[id - 1])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Is an address one of this host: a loopback address, or one of an interface?
+bool LocalTransport::isLocal(const struct sockaddr_in &address) {
+    if(address.sin_family != AF_INET) {
+        return false;
+    }
+    if((ntohl(address.sin_addr.s_addr) >> 24) == 127) {
+        return true;
+    }
+
+    struct ifaddrs *interfaces;
+    if(getifaddrs(&interfaces) == -1) {
+        return false;
+    }
+    bool local = false;
+    for(struct ifaddrs *i = interfaces; i != NULL && !local; i = i->ifa_next) {
+        if(i->ifa_addr != NULL && i->ifa_addr->sa_family == AF_INET) {
+            local = (((struct sockaddr_in *) i->ifa_addr)->sin_addr.s_addr == address.sin_addr.s_addr);
+        }
+    }
+    freeifaddrs(interfaces);
+    return local;
+}
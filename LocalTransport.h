@@ -0,0 +1,110 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class LocalTransport. |
+|
+| Generals whose hostfile entries resolve to addresses of the same |
+| host exchange their datagrams through shared memory instead of the |
+| UDP stack. Every shard of a sender has a ring (a memfd, single |
+| producer, single consumer) to the shard of the same index of every |
+| co-located receiver. The sender makes the ring and hands it over on |
+| the abstract Unix socket of the receiving shard, which also serves |
+| as its doorbell: a receiver about to sleep asks the senders to ring |
+| it, and polls that socket together with its UDP socket. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef LOCAL_TRANSPORT_H
+#define LOCAL_TRANSPORT_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#define LOCAL_RING_MAGIC 0x42595a52   // Marks a ring ("BYZR").
+#define LOCAL_RING_SIZE (1024 * 1024) // Bytes of datagrams a ring holds.
+#define LOCAL_WRAP 0xffffffff         // Length that marks the end of the ring: the next datagram is at its start.
+#define LOCAL_RETRY_USEC 1000000      // Wait before a ring is offered again to a general that did not take it.
+
+#define RING_OFFERED 1  // The sender handed the ring over.
+#define RING_ACCEPTED 2 // The receiver reads it.
+#define RING_REFUSED 3  // The receiver does not read it (it runs a different number of shards).
+#define RING_CLOSED 4   // One of the two went away.
+
+// The head of a ring. Its datagrams follow it.
+// head is written by the sender only, tail by the receiver only, each on a cache line of its own.
+typedef struct {
+    uint32_t magic;              // LOCAL_RING_MAGIC.
+    uint32_t fromId;             // General sending.
+    uint32_t toId;               // General receiving.
+    uint32_t shard;              // Shard of both.
+    uint32_t numShards;          // Number of shards of the sender.
+    uint32_t state;              // RING_OFFERED to RING_CLOSED.
+    uint32_t sleeping;           // Set by a receiver about to sleep. The sender who clears it rings the doorbell.
+    char pad1[36];
+    uint64_t head;               // Bytes written since the ring was made.
+    char pad2[56];
+    uint64_t tail;               // Bytes read since the ring was made.
+    char pad3[56];
+    char data[LOCAL_RING_SIZE];  // The datagrams, each a LocalRecord padded to 8 bytes.
+} LocalRing;
+
+// What precedes a datagram in a ring.
+typedef struct {
+    uint32_t len;   // Length of the datagram (LOCAL_WRAP for the end of the ring).
+    uint32_t pad;
+    int64_t stamp;  // When it was written, in microseconds (it stands for the kernel timestamp of UDP).
+} LocalRecord;
+
+// Class definition.
+class LocalTransport {
+
+    private:
+        // A ring to another general.
+        struct Link {
+            LocalRing *ring; // The ring (NULL if there is none).
+            int64_t retryAt; // When a ring may be offered again, in microseconds.
+        };
+
+        uint32_t myId;                    // Id of the general.
+        uint32_t shard;                   // Index of the shard.
+        uint32_t numShards;               // Number of shards of the general.
+        std::string port;                 // Port of the system, part of the names of the sockets.
+        int socketFD;                     // Abstract Unix socket the rings are handed over on (and the doorbell).
+        std::vector<uint8_t> colocated;   // Is a general on this host? Indexed by id.
+        std::vector<Link> outLinks;       // Rings to the co-located generals, indexed by id.
+        std::vector<LocalRing *> inRings; // Rings from them, indexed by id (NULL if there is none).
+        std::vector<uint32_t> inPeers;    // The generals there is a ring from.
+        size_t nextIn;                    // Where the next receive starts looking, for fairness.
+
+        void offer(uint32_t);                           // Makes a ring to a general and hands it over.
+        void accept(int);                               // Takes a ring handed over, if it is meant for this shard.
+        void dropIn(uint32_t);                          // Lets go of the ring from a general.
+        void dropOut(uint32_t);                         // Lets go of the ring to a general, to offer another one later.
+        void ringDoorbell(uint32_t);                    // Rings the doorbell of a general.
+        void socketName(uint32_t, struct sockaddr_un *, socklen_t *); // Builds the name of the socket of a shard of a general.
+        static LocalRing *mapRing(int);                 // Maps a ring.
+        static int64_t now();                           // Returns the time in microseconds.
+        LocalTransport(const LocalTransport &);            // Not copyable.
+        LocalTransport &operator=(const LocalTransport &); // Not assignable.
+
+    public:
+        LocalTransport();  // Constructor to initialize variables.
+        ~LocalTransport(); // Destructor to close the rings and the socket.
+
+        void init(uint32_t, uint32_t, uint32_t, const std::string &, const std::vector<struct sockaddr_in> &) throw(std::string); // Opens the socket of a shard of a general.
+        bool send(uint32_t, const struct iovec *, int);  // Writes a datagram to the ring of a general. Returns false if it has to go by UDP.
+        ssize_t receive(char *, size_t, uint32_t *, int64_t *); // Reads the next datagram of any ring. Returns -1 if there is none.
+        void service();                                  // Takes the rings handed over and drains the doorbell.
+        void wait(int, int);                             // Sleeps till a datagram arrives on a ring or on a UDP socket.
+        void close();                                    // Closes the rings and the socket.
+
+        static bool isColocated(const std::vector<struct sockaddr_in> &, uint32_t); // Is any other general on this host?
+        static bool isLocal(const struct sockaddr_in &);                             // Is an address one of this host?
+};
+
+#endif
@@ -0,0 +1,246 @@
+/*
++----------------------------------------------------------------------+
+| This class implements a node: the API of libbyzgen, that runs the |
+| shards of a general for the values submitted to it. |
++----------------------------------------------------------------------+
+*/
+
+#include <cerrno>
+#include <climits>
+#include <sys/eventfd.h>
+#include "Node.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+Node::Node() {
+    this->shards = NULL;
+    this->numShards = 0;
+    this->callback = NULL;
+    this->context = NULL;
+    this->nextInstance = 0;
+    this->eventFD = -1;
+    this->stopping = false;
+    this->started = false;
+    pthread_mutex_init(&(this->lock), NULL);
+    pthread_cond_init(&(this->valueSubmitted), NULL);
+    pthread_cond_init(&(this->outcomeQueued), NULL);
+}
+
+// Destructor to stop the node.
+Node::~Node() {
+    stop();
+    if(this->eventFD != -1) {
+        close(this->eventFD);
+    }
+    pthread_cond_destroy(&(this->outcomeQueued));
+    pthread_cond_destroy(&(this->valueSubmitted));
+    pthread_mutex_destroy(&(this->lock));
+}
+
+// Starts the node: resolves the hosts, opens the decision log and starts a shard per thread.
+// With a callback, every decision is handed to it on the thread of the shard that took it (so it must
+// not block for long, and must be safe to call from several threads at once); without, decisions are
+// queued for poll() and wait().
+void Node::start(const NodeConfig &config, DecisionCallback callback, void *context) throw(string) {
+    int numGenerals = (int) config.hostNames.size();
+    if(this->started) {
+        throw string("\nThe node is already started.");
+    }
+    if(numGenerals < config.maxFailures + 2) {
+        throw string("\nThe total number of generals must be no less than (faulty + 2).");
+    }
+    if(numGenerals > MAX_GENERALS) {
+        throw string("\nThis build supports fewer generals (rebuild with CPPFLAGS=-DMAX_GENERALS=<n> for more).");
+    }
+    if(config.myId < 1 || config.myId > (uint32_t) numGenerals) {
+        throw string("\nThe id of the node must be its position (from 1) among the hosts.");
+    }
+    if(config.numThreads < 1 || config.numThreads > MAX_SHARDS) {
+        throw string("\nThe number of threads should lie between 1 and MAX_SHARDS including both.");
+    }
+
+    this->generalInfo.myId = config.myId;
+    this->generalInfo.instance = 0;
+    this->generalInfo.socketFD = -1;
+    this->generalInfo.maxFailures = config.maxFailures;
+    this->generalInfo.numGenerals = numGenerals;
+    this->generalInfo.cryptoOff = config.cryptoOff;
+    this->generalInfo.hugePages = config.hugePages;
+    this->generalInfo.pacingRate = config.pacingRate;
+    this->generalInfo.fanout = config.fanout;
+    this->generalInfo.blindCopies = config.blindCopies;
+    Adversary::clear(&(this->generalInfo.adversary));
+    this->generalInfo.timeLatency = false;
+    this->generalInfo.latency = NULL;
+    this->generalInfo.interrupted = NULL;
+    this->generalInfo.presigner = NULL;
+    this->generalInfo.local = NULL;
+    this->generalInfo.capture = NULL;
+    this->generalInfo.replay = NULL;
+    this->generalInfo.workspace = NULL;
+    this->generalInfo.port = config.port;
+    this->generalInfo.myHostName = config.hostNames[config.myId - 1];
+    this->generalInfo.hostNames = config.hostNames;
+    PeerTable::resolve(config.hostNames, config.port, this->generalInfo.addresses);
+
+    if(this->eventFD == -1 && (this->eventFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        perror("Failed to create the event descriptor: eventfd() failed");
+        throw string("\nCould not start the node.");
+    }
+    this->callback = callback;
+    this->context = context;
+    this->stopping = false;
+    this->nextInstance = 0;
+
+    // The shards run instances for as long as the node hands values out.
+    Shard::initCrypto();
+    this->numShards = config.numThreads;
+    this->shards = new Shard[this->numShards];
+    this->started = true;
+    try {
+        if(!config.logPath.empty()) {
+            this->log.open(config.logPath);
+        }
+        for(int s = 0; s < this->numShards; s++) {
+            this->shards[s].init(s, this->numShards, UINT_MAX, this->generalInfo, vector<uint8_t>(), config.logPath.empty() ? NULL : &(this->log), this);
+        }
+        Shard::steer(this->shards, this->numShards);
+        for(int s = 0; s < this->numShards; s++) {
+            this->shards[s].start();
+        }
+    } catch(string msg) {
+        stop();
+        throw;
+    }
+}
+
+// Proposes a value in the next instance and returns the instance. Only the commander proposes values.
+// The value is taken by the shard of the instance once it is done with the instances before.
+uint32_t Node::submit(const vector<uint8_t> &value) throw(string) {
+    if(!this->started || this->generalInfo.myId != COMMANDER_ID) {
+        throw string("\nOnly a started commander can submit values.");
+    }
+    if(value.empty() || value.size() > MAX_PAYLOAD_SIZE) {
+        throw string("\nA value must hold 1 byte up to 8 MB.");
+    }
+
+    pthread_mutex_lock(&(this->lock));
+    uint32_t instance = this->nextInstance++;
+    pthread_mutex_unlock(&(this->lock));
+
+    // The order is signed while the shard is busy with the instances before.
+    // It is asked for before the value is handed over, so that the commander finds it asked for.
+    this->shards[instance % this->numShards].presign(instance, value);
+
+    pthread_mutex_lock(&(this->lock));
+    this->submitted[instance] = value;
+    pthread_cond_broadcast(&(this->valueSubmitted));
+    pthread_mutex_unlock(&(this->lock));
+    return instance;
+}
+
+// Takes the next decision, if there is one. Never blocks.
+bool Node::poll(Outcome *outcome) {
+    pthread_mutex_lock(&(this->lock));
+    bool taken = takeOutcome(outcome);
+    pthread_mutex_unlock(&(this->lock));
+    return taken;
+}
+
+// Waits for the next decision. Returns false if the node stopped with no decision left.
+bool Node::wait(Outcome *outcome) {
+    pthread_mutex_lock(&(this->lock));
+    while(this->outcomes.empty() && this->started && !this->stopping) {
+        pthread_cond_wait(&(this->outcomeQueued), &(this->lock));
+    }
+    bool taken = takeOutcome(outcome);
+    pthread_mutex_unlock(&(this->lock));
+    return taken;
+}
+
+// Stops the node and closes the decision log. Values submitted and not taken yet are dropped.
+// The commander finishes the instances it has started. A lieutenant gives his up, as he can not
+// tell a commander that stopped from a slow one.
+void Node::stop() {
+    if(!this->started) {
+        return;
+    }
+
+    pthread_mutex_lock(&(this->lock));
+    this->stopping = true;
+    pthread_cond_broadcast(&(this->valueSubmitted));
+    pthread_cond_broadcast(&(this->outcomeQueued));
+    pthread_mutex_unlock(&(this->lock));
+
+    for(int s = 0; s < this->numShards; s++) {
+        if(this->generalInfo.myId != COMMANDER_ID) {
+            this->shards[s].interrupt();
+        }
+        this->shards[s].join();
+    }
+    this->log.close();
+    delete[] this->shards;
+    this->shards = NULL;
+    this->numShards = 0;
+
+    pthread_mutex_lock(&(this->lock));
+    this->submitted.clear();
+    this->started = false;
+    pthread_mutex_unlock(&(this->lock));
+}
+
+// Waits for the value of an instance: the commander waits for it to be submitted, a lieutenant learns it
+// from the commander. Returns false once the node is stopping.
+bool Node::nextValue(uint32_t instance, vector<uint8_t> &value) {
+    pthread_mutex_lock(&(this->lock));
+    if(this->generalInfo.myId == COMMANDER_ID) {
+        while(!this->stopping && this->submitted.find(instance) == this->submitted.end()) {
+            pthread_cond_wait(&(this->valueSubmitted), &(this->lock));
+        }
+        if(!this->stopping) {
+            map<uint32_t, vector<uint8_t> >::iterator it = this->submitted.find(instance);
+            value.swap(it->second);
+            this->submitted.erase(it);
+        }
+    }
+    bool proceed = !this->stopping;
+    pthread_mutex_unlock(&(this->lock));
+    return proceed;
+}
+
+// Takes what was decided in an instance: hands it to the callback, or queues it and makes the event
+// descriptor readable.
+void Node::decided(const Outcome &outcome) {
+    if(this->callback != NULL) {
+        this->callback(outcome, this->context);
+        return;
+    }
+
+    pthread_mutex_lock(&(this->lock));
+    this->outcomes.push_back(outcome);
+    uint64_t one = 1;
+    if(write(this->eventFD, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        perror("Failed to signal a decision: write() failed");
+    }
+    pthread_cond_signal(&(this->outcomeQueued));
+    pthread_mutex_unlock(&(this->lock));
+}
+
+// Takes the decision at the head of the queue, if there is one. The lock must be held.
+// The event descriptor is drained along with the last decision.
+bool Node::takeOutcome(Outcome *outcome) {
+    if(this->outcomes.empty()) {
+        return false;
+    }
+
+    *outcome = this->outcomes.front();
+    this->outcomes.pop_front();
+    if(this->outcomes.empty()) {
+        uint64_t count;
+        if(read(this->eventFD, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+            perror("Failed to drain the event descriptor: read() failed");
+        }
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class Node. |
+|
+| A node is the API of libbyzgen: it runs a general inside the |
+| application, for as many agreement instances as are submitted. |
+| The commander (node 1) submits values; every node, the commander |
+| included, learns what was decided in each instance through a |
+| callback, or by polling when the event file descriptor turns |
+| readable, so that it fits whatever event loop the application has. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef NODE_H
+#define NODE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <pthread.h>
+#include "Shard.h"
+#include "DecisionLog.h"
+
+// What a node is made from. Every node of a system must be given the same hostNames, port, maxFailures,
+// numThreads, fanout and blindCopies.
+typedef struct {
+    uint32_t myId;                      // Id of the node: its position (from 1) in hostNames. Node COMMANDER_ID is the commander.
+    std::vector<std::string> hostNames; // Host names (or addresses) of all the nodes.
+    std::string port;                   // Port all the nodes listen on.
+    int maxFailures;                    // Maximum number of traitor nodes.
+    int numThreads;                     // Instances run at the same time, each on a thread of its own (instance i on thread i % numThreads).
+    bool cryptoOff;                     // Should signature verification be turned off?
+    bool hugePages;                     // Should the signature chains be backed by huge pages?
+    uint64_t pacingRate;                // Bytes per second each thread sends at (0 if sending is not paced).
+    int fanout;                         // Nodes a value is relayed to (0 to relay to all).
+    int blindCopies;                    // Copies of every message sent without ACKs (0 to have messages ACKed).
+    std::string logPath;                // Decision log to append to (empty for none).
+} NodeConfig;
+
+typedef void (*DecisionCallback)(const Outcome &, void *); // Called with what was decided in an instance, and the context given to start().
+
+// Class definition.
+class Node : private InstanceFeed {
+
+    private:
+        GeneralInfo generalInfo;                              // Information to create the generals of the instances from.
+        Shard *shards;                                        // The shards running the instances.
+        int numShards;                                        // Number of shards.
+        DecisionLog log;                                      // Log of the decisions (if one is kept).
+        DecisionCallback callback;                            // Called with every decision (NULL to queue them for poll()).
+        void *context;                                        // Passed to the callback.
+        std::map<uint32_t, std::vector<uint8_t> > submitted;  // Values submitted, by instance, till their shard takes them.
+        uint32_t nextInstance;                                // Instance the next value submitted is proposed in.
+        std::deque<Outcome> outcomes;                         // Decisions waiting to be polled.
+        int eventFD;                                          // Readable while decisions are waiting to be polled.
+        bool stopping;                                        // Is the node stopping?
+        bool started;                                         // Are the shards running?
+        pthread_mutex_t lock;                                 // Guards submitted, nextInstance, outcomes, stopping and started.
+        pthread_cond_t valueSubmitted;                        // Signalled when a value is submitted or the node stops.
+        pthread_cond_t outcomeQueued;                         // Signalled when a decision is queued or the node stops.
+
+        bool nextValue(uint32_t, std::vector<uint8_t> &); // Waits for the value of an instance. Returns false to stop.
+        void decided(const Outcome &);                    // Takes what was decided in an instance.
+        bool takeOutcome(Outcome *);                      // Takes the decision at the head of the queue, if there is one.
+        Node(const Node &);                               // Not copyable.
+        Node &operator=(const Node &);                    // Not assignable.
+
+    public:
+        Node();  // Constructor to initialize variables.
+        ~Node(); // Destructor to stop the node.
+
+        void start(const NodeConfig &, DecisionCallback, void *) throw(std::string); // Starts the node.
+        uint32_t submit(const std::vector<uint8_t> &) throw(std::string);             // Proposes a value in the next instance (on the commander). Returns the instance.
+        int getEventFD() const { return this->eventFD; }                               // Returns a descriptor that is readable while decisions wait to be polled.
+        bool poll(Outcome *);                                                          // Takes the next decision, if there is one.
+        bool wait(Outcome *);                                                          // Waits for the next decision. Returns false if the node stopped.
+        void stop();                                                                   // Stops the node and closes the decision log.
+};
+
+#endif
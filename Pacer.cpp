@@ -0,0 +1,70 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the token bucket that paces the datagrams a |
+| general sends. |
++----------------------------------------------------------------------+
+*/
+
+#include <unistd.h>
+#include "Pacer.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+Pacer::Pacer() {
+    this->rate = 0;
+    this->burst = 0;
+    this->tokens = 0;
+    gettimeofday(&(this->last), NULL);
+}
+
+// Sets the rate (bytes per second, 0 for none) and the depth of the bucket.
+// The bucket starts full.
+void Pacer::init(uint64_t rate, size_t burst) {
+    this->rate = rate;
+    this->burst = burst;
+    this->tokens = burst;
+    gettimeofday(&(this->last), NULL);
+}
+
+// Adds the tokens earned since the bucket was last filled up.
+void Pacer::refill() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t elapsed = ((int64_t) now.tv_sec * 1000000 + now.tv_usec) - ((int64_t) this->last.tv_sec * 1000000 + this->last.tv_usec);
+    if(elapsed <= 0) {
+        return;
+    }
+
+    // Only whole bytes are added, and the time they took is kept account of, so that nothing is lost to rounding.
+    int64_t earned = elapsed * (int64_t) this->rate / 1000000;
+    if(earned == 0) {
+        return;
+    }
+    this->tokens += earned;
+    if(this->tokens >= this->burst) {
+        this->tokens = this->burst;
+        this->last = now;
+    } else {
+        int64_t spent = earned * 1000000 / (int64_t) this->rate;
+        int64_t usec = (int64_t) this->last.tv_usec + spent;
+        this->last.tv_sec += usec / 1000000;
+        this->last.tv_usec = usec % 1000000;
+    }
+}
+
+// Waits till the given number of bytes may be sent, and takes their tokens.
+// A datagram larger than the bucket is let through once the bucket is full.
+void Pacer::wait(size_t bytes) {
+    if(this->rate == 0) {
+        return;
+    }
+
+    int64_t needed = ((int64_t) bytes < this->burst) ? (int64_t) bytes : this->burst;
+    refill();
+    while(this->tokens < needed) {
+        usleep((useconds_t) ((needed - this->tokens) * 1000000 / (int64_t) this->rate) + 1);
+        refill();
+    }
+    this->tokens -= bytes;
+}
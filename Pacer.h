@@ -0,0 +1,38 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class Pacer. |
+|
+| A pacer is a token bucket that spaces out the datagrams a general |
+| sends, so that a fan-out to many generals (or a retransmission to |
+| all that did not ACK) does not arrive as one burst that overflows |
+| socket buffers and switch queues. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <sys/time.h>
+
+// Class definition.
+class Pacer {
+
+    private:
+        uint64_t rate;       // Bytes per second (0 if sending is not paced).
+        int64_t burst;       // Depth of the bucket in bytes.
+        int64_t tokens;      // Bytes that may be sent right now.
+        struct timeval last; // When the bucket was last filled up.
+
+        void refill(); // Adds the tokens earned since the bucket was last filled up.
+
+    public:
+        Pacer(); // Constructor to initialize variables.
+
+        void init(uint64_t, size_t); // Sets the rate (bytes per second, 0 for none) and the depth of the bucket.
+        void wait(size_t);           // Waits till the given number of bytes may be sent, and takes their tokens.
+        bool isPaced() const { return this->rate > 0; } // Is sending paced?
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the packet capture. |
++----------------------------------------------------------------------+
+*/
+
+#include <fstream>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "PacketCapture.h"
+#include "Replay.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+PacketCapture::PacketCapture() {
+    this->file = NULL;
+    this->numRecords = 0;
+    this->clock = NULL;
+}
+
+// Destructor to close the capture.
+PacketCapture::~PacketCapture() {
+    close();
+}
+
+// Creates a capture (truncating any at the path) and writes its header, given in host byte order.
+void PacketCapture::open(const string &path, const CaptureHeader &header) throw(string) {
+    close();
+    if((this->file = fopen(path.c_str(), "wb")) == NULL) {
+        perror("Failed to open the packet capture: fopen() failed");
+        throw string("\nCould not open the packet capture " + path + ".");
+    }
+    this->buffer.resize(CAPTURE_BUFFER_SIZE);
+    setvbuf(this->file, &(this->buffer[0]), _IOFBF, this->buffer.size());
+
+    CaptureHeader out;
+    out.magic = htonl(CAPTURE_MAGIC);
+    out.version = htonl(CAPTURE_VERSION);
+    out.general = htonl(header.general);
+    out.num_generals = htonl(header.num_generals);
+    out.max_failures = htonl(header.max_failures);
+    out.fanout = htonl(header.fanout);
+    out.blind_copies = htonl(header.blind_copies);
+    out.shard = htonl(header.shard);
+    out.num_shards = htonl(header.num_shards);
+    fwrite(&out, sizeof(out), 1, this->file);
+    this->numRecords = 0;
+}
+
+// Appends a datagram gathered from iovecs, sent to or received from a general, stamped with the time.
+// Datagrams too long for a record (none that goes on the wire is) are left out.
+void PacketCapture::record(int direction, uint32_t peerId, const struct iovec *iov, int iovcnt) {
+    if(this->file == NULL) {
+        return;
+    }
+    size_t length = 0;
+    for(int i = 0; i < iovcnt; i++) {
+        length += iov[i].iov_len;
+    }
+    if(length > 0xffff) {
+        return;
+    }
+
+    int64_t time;
+    if(this->clock != NULL) {
+        time = this->clock->now();
+    } else {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        time = (int64_t) now.tv_sec * 1000000 + now.tv_usec;
+    }
+
+    CaptureRecord header;
+    header.time_sec = htonl((uint32_t) (time / 1000000));
+    header.time_usec = htonl((uint32_t) (time % 1000000));
+    header.peer = htonl(peerId);
+    header.direction = htons((uint16_t) direction);
+    header.length = htons((uint16_t) length);
+    fwrite(&header, sizeof(header), 1, this->file);
+    for(int i = 0; i < iovcnt; i++) {
+        fwrite(iov[i].iov_base, 1, iov[i].iov_len, this->file);
+    }
+    this->numRecords++;
+}
+
+// Appends a datagram sent to or received from a general.
+void PacketCapture::record(int direction, uint32_t peerId, const void *datagram, size_t length) {
+    struct iovec iov;
+    iov.iov_base = (void *) datagram;
+    iov.iov_len = length;
+    record(direction, peerId, &iov, 1);
+}
+
+// Writes what is buffered and closes the capture.
+void PacketCapture::close() {
+    if(this->file != NULL) {
+        if(fclose(this->file) != 0) {
+            perror("Failed to write the packet capture: fclose() failed");
+        }
+        this->file = NULL;
+    }
+}
+
+// Stamps the records with the virtual time of a replay, so that what a replayed general sends is on its clock.
+void PacketCapture::setClock(const Replay *clock) {
+    this->clock = clock;
+}
+
+// Reads a capture back: its header and its records (in host byte order), and their bytes.
+// A record cut short by a general that did not close his capture ends it.
+// Returns false if the file can not be read or is not a capture.
+bool PacketCapture::load(const string &path, CaptureHeader *header, vector<CapturedDatagram> &datagrams, vector<char> &bytes) {
+    ifstream file(path.c_str(), ios::in | ios::binary);
+    if(!file.is_open() || !file.read((char *) header, sizeof(*header)) || ntohl(header->magic) != CAPTURE_MAGIC || ntohl(header->version) != CAPTURE_VERSION) {
+        return false;
+    }
+    header->magic = CAPTURE_MAGIC;
+    header->version = CAPTURE_VERSION;
+    header->general = ntohl(header->general);
+    header->num_generals = ntohl(header->num_generals);
+    header->max_failures = ntohl(header->max_failures);
+    header->fanout = ntohl(header->fanout);
+    header->blind_copies = ntohl(header->blind_copies);
+    header->shard = ntohl(header->shard);
+    header->num_shards = ntohl(header->num_shards);
+
+    CaptureRecord record;
+    while(file.read((char *) &record, sizeof(record))) {
+        CapturedDatagram datagram;
+        datagram.time = (int64_t) ntohl(record.time_sec) * 1000000 + ntohl(record.time_usec);
+        datagram.peerId = ntohl(record.peer);
+        datagram.direction = ntohs(record.direction);
+        datagram.length = ntohs(record.length);
+        datagram.offset = bytes.size();
+
+        bytes.resize(bytes.size() + datagram.length);
+        if(datagram.length > 0 && !file.read(&(bytes[datagram.offset]), datagram.length)) {
+            bytes.resize(datagram.offset);
+            break;
+        }
+        datagrams.push_back(datagram);
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class PacketCapture. |
+|
+| A packet capture is a file of every datagram a general sent or |
+| received, each with when it went out or was read, the general on |
+| the other end and its bytes. Records are buffered and written by |
+| the thread of the shard that captures, and never synced: a capture |
+| is for replaying the traffic offline (see Replay), not for keeping. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef PACKET_CAPTURE_H
+#define PACKET_CAPTURE_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define CAPTURE_MAGIC 0x42474350 // "BGCP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_BUFFER_SIZE (1024 * 1024) // Bytes of records buffered before they are written.
+
+#define CAPTURE_SENT 1
+#define CAPTURE_RECEIVED 2
+
+// Layout of a capture (all fields in network byte order): a CaptureHeader, then records,
+// each a CaptureRecord followed by the length bytes of its datagram.
+typedef struct {
+    uint32_t magic;        // Must be equal to CAPTURE_MAGIC.
+    uint32_t version;      // Must be equal to CAPTURE_VERSION.
+    uint32_t general;      // Identifier of the general captured.
+    uint32_t num_generals; // Number of generals in the system.
+    uint32_t max_failures; // Maximum number of traitor generals in the system.
+    uint32_t fanout;       // Fanout the general was given (0 to relay to all).
+    uint32_t blind_copies; // Blind copies the general was given (0 if messages were ACKed).
+    uint32_t shard;        // Shard captured.
+    uint32_t num_shards;   // Number of shards of the general.
+} CaptureHeader;
+
+typedef struct {
+    uint32_t time_sec;  // When the datagram was sent or read.
+    uint32_t time_usec;
+    uint32_t peer;      // General it was sent to or received from (NO_PEER if he is not known).
+    uint16_t direction; // CAPTURE_SENT or CAPTURE_RECEIVED.
+    uint16_t length;    // Length of the datagram.
+} CaptureRecord;
+
+// A record of a capture read back, in host byte order. Its bytes are kept apart, at offset.
+typedef struct {
+    int64_t time;       // When the datagram was sent or read, in microseconds.
+    uint32_t peerId;    // General it was sent to or received from.
+    uint16_t direction; // CAPTURE_SENT or CAPTURE_RECEIVED.
+    uint16_t length;    // Length of the datagram.
+    size_t offset;      // Where its bytes start.
+} CapturedDatagram;
+
+class Replay;
+
+// Class definition.
+class PacketCapture {
+
+    private:
+        FILE *file;                 // The capture being written (NULL if none is open).
+        std::vector<char> buffer;   // Buffer of the file.
+        uint64_t numRecords;        // Number of records written.
+        const Replay *clock;        // Replay whose virtual time stamps the records (NULL for the time of day).
+
+        PacketCapture(const PacketCapture &);            // Not copyable.
+        PacketCapture &operator=(const PacketCapture &); // Not assignable.
+
+    public:
+        PacketCapture();  // Constructor to initialize variables.
+        ~PacketCapture(); // Destructor to close the capture.
+
+        void open(const std::string &, const CaptureHeader &) throw(std::string); // Creates a capture (truncating any) and writes its header.
+        void record(int, uint32_t, const struct iovec *, int);                    // Appends a datagram gathered from iovecs.
+        void record(int, uint32_t, const void *, size_t);                         // Appends a datagram.
+        void close();                                                             // Writes what is buffered and closes the capture.
+        void setClock(const Replay *);                                            // Stamps the records with the virtual time of a replay.
+        bool isOpen() const { return this->file != NULL; }                        // Is a capture open?
+        uint64_t getNumRecords() const { return this->numRecords; }               // Returns the number of records written.
+
+        static bool load(const std::string &, CaptureHeader *, std::vector<CapturedDatagram> &, std::vector<char> &); // Reads a capture back.
+};
+
+#endif
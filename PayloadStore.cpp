@@ -0,0 +1,92 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the store of payloads of a general. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstring>
+#include <arpa/inet.h>
+#include "General.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+PayloadStore::PayloadStore() {
+    this->instance = 0;
+}
+
+// Sets the instance the payload messages belong to.
+void PayloadStore::init(uint32_t instance) {
+    this->instance = instance;
+}
+
+// Stores a payload. If a digest is given, the payload must hash to it.
+// Returns the message carrying the payload, or NULL if it does not match the digest or is too long.
+const PayloadMessage *PayloadStore::put(const uint8_t *payload, size_t payloadLen, const uint8_t *expectedDigest) {
+    if(payloadLen == 0 || payloadLen > MAX_PAYLOAD_SIZE) {
+        return NULL;
+    }
+
+    uint8_t md[DIGEST_SIZE];
+    digest(payload, payloadLen, md);
+    if(expectedDigest && memcmp(md, expectedDigest, DIGEST_SIZE) != 0) {
+        return NULL;
+    }
+
+    const PayloadMessage *stored = find(md);
+    if(stored) {
+        return stored;
+    }
+
+    // Keep the payload as the message that carries it, so that it can be sent without being copied.
+    vector<uint8_t> &bytes = this->messages[key(md)];
+    bytes.resize(sizeof(PayloadMessage) + payloadLen);
+    PayloadMessage *message = (PayloadMessage *) &bytes[0];
+    message->type = htonl(TYPE_PAYLOAD);
+    message->instance = htonl(this->instance);
+    message->payload_len = htonl(payloadLen);
+    memcpy(message->digest, md, DIGEST_SIZE);
+    memcpy(message->payload, payload, payloadLen);
+    return message;
+}
+
+// Returns the message of the payload with the given digest, or NULL if the payload is not here.
+const PayloadMessage *PayloadStore::find(const uint8_t *md) const {
+    map<string, vector<uint8_t> >::const_iterator iter = this->messages.find(key(md));
+    if(iter == this->messages.end()) {
+        return NULL;
+    }
+    return (const PayloadMessage *) &(iter->second[0]);
+}
+
+// Is there room for no more payloads?
+bool PayloadStore::isFull() const {
+    return this->messages.size() >= MAX_STORED_PAYLOADS;
+}
+
+// Computes the SHA-256 digest of a payload.
+void PayloadStore::digest(const uint8_t *payload, size_t payloadLen, uint8_t *md) {
+    unsigned int mdLen = DIGEST_SIZE;
+    EVP_Digest(payload, payloadLen, md, &mdLen, EVP_sha256(), NULL);
+}
+
+// Returns a digest as a string, to index by.
+string PayloadStore::key(const uint8_t *md) {
+    return string((const char *) md, DIGEST_SIZE);
+}
+
+// Returns a digest in hexadecimal.
+string PayloadStore::toHex(const uint8_t *md) {
+    static const char hexDigits[] = "0123456789abcdef";
+    string hex;
+    for(int i = 0; i < DIGEST_SIZE; i++) {
+        hex += hexDigits[md[i] >> 4];
+        hex += hexDigits[md[i] & 0xf];
+    }
+    return hex;
+}
+
+// Returns the length of a stored payload message.
+size_t PayloadStore::messageLen(const PayloadMessage *message) {
+    return sizeof(PayloadMessage) + ntohl(message->payload_len);
+}
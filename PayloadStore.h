@@ -0,0 +1,45 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class PayloadStore. |
+|
+| The generals agree on the SHA-256 digest of a payload. The payloads |
+| themselves are kept here, ready to be sent as a PayloadMessage to |
+| any general that lacks one. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef PAYLOAD_STORE_H
+#define PAYLOAD_STORE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <cstddef>
+#include "message_format.h"
+
+#define MAX_PAYLOAD_SIZE (8 * 1024 * 1024) // Largest payload that can be agreed on.
+#define MAX_STORED_PAYLOADS 16              // Payloads a general keeps (a traitor commander may propose several).
+
+// Class definition.
+class PayloadStore {
+
+    private:
+        std::map<std::string, std::vector<uint8_t> > messages; // Digest : PayloadMessage (in network byte order) carrying the payload.
+        uint32_t instance;                                     // Agreement instance the payload messages belong to.
+
+    public:
+        PayloadStore(); // Constructor to initialize variables.
+
+        void init(uint32_t);                                                  // Sets the instance the payload messages belong to.
+        const PayloadMessage *put(const uint8_t *, size_t, const uint8_t *); // Stores a payload. Returns its message, or NULL if it does not match the digest.
+        const PayloadMessage *find(const uint8_t *) const;                    // Returns the message of the payload with the given digest, or NULL.
+        bool isFull() const;                                                  // Is there room for no more payloads?
+
+        static void digest(const uint8_t *, size_t, uint8_t *);               // Computes the SHA-256 digest of a payload.
+        static std::string key(const uint8_t *);                              // Returns a digest as a string, to index by.
+        static std::string toHex(const uint8_t *);                            // Returns a digest in hexadecimal.
+        static size_t messageLen(const PayloadMessage *);                     // Returns the length of a stored payload message.
+};
+
+#endif
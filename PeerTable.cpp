@@ -0,0 +1,234 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the table of peers of a general. |
++----------------------------------------------------------------------+
+*/
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include "PeerTable.h"
+
+using namespace std;
+
+// The slice of the host names resolved by one resolver thread.
+struct ResolveTask {
+    const vector<string> *hostNames;
+    const string *port;
+    vector<struct sockaddr_in> *addresses;
+    size_t first;
+    size_t stride;
+};
+
+// Resolves a slice of the host names (run by every resolver thread).
+static void *resolveWorker(void *arg) {
+    ResolveTask *task = (ResolveTask *) arg;
+
+    for(size_t i = task->first; i < task->hostNames->size(); i += task->stride) {
+        struct addrinfo hints, *hostInfo;
+        struct sockaddr_in &address = (*task->addresses)[i];
+
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_UNSPEC;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+
+        int status = getaddrinfo((*task->hostNames)[i].c_str(), task->port->c_str(), &hints, &hostInfo);
+        if(status != 0) {
+            cerr<<"getaddrinfo: "<<(*task->hostNames)[i]<<": "<<gai_strerror(status)<<"\n";
+            continue;
+        }
+        memcpy(&address, hostInfo->ai_addr, sizeof(address));
+        freeaddrinfo(hostInfo);
+    }
+    return NULL;
+}
+
+// Constructor to initialize variables.
+PeerTable::PeerTable() {
+    this->peers = NULL;
+    this->numPeers = 0;
+    this->slots = NULL;
+    this->slotMask = 0;
+    this->hashShift = 0;
+    this->numWords = 0;
+    memset(this->statusCounts, 0, sizeof(this->statusCounts));
+}
+
+// Destructor to free the table.
+PeerTable::~PeerTable() {
+    free(this->peers);
+    delete[] this->slots;
+}
+
+// Builds the table from the addresses of generals 1..n.
+// addresses[i] is the address of the general with id i + 1.
+void PeerTable::init(const vector<struct sockaddr_in> &addresses) throw(string) {
+    this->numPeers = addresses.size();
+
+    void *mem = NULL;
+    if(posix_memalign(&mem, CACHE_LINE_SIZE, sizeof(Peer) * (this->numPeers + 1)) != 0) {
+        throw string("\nCould not allocate the peer table.");
+    }
+    this->peers = (Peer *) mem;
+    memset(this->peers, 0, sizeof(Peer) * (this->numPeers + 1));
+
+    // Size the hash for a load factor of at most one half.
+    uint32_t numSlots = 4, bits = 2;
+    while(numSlots < 2 * this->numPeers) {
+        numSlots <<= 1;
+        bits++;
+    }
+    this->slots = new uint32_t[numSlots];
+    memset(this->slots, 0, sizeof(uint32_t) * numSlots);
+    this->slotMask = numSlots - 1;
+    this->hashShift = 32 - bits;
+
+    for(uint32_t id = 1; id <= this->numPeers; id++) {
+        Peer &peer = this->peers[id];
+        peer.id = id; // The send status starts out zeroed, i.e. as NOP_SEND_STATUS.
+        peer.address = addresses[id - 1];
+
+        if(peer.address.sin_family != AF_INET) {
+            continue; // Unresolved hosts can not send to us either.
+        }
+
+        // Linear probing. The first general listed with an address owns it.
+        uint32_t slot = slotOf(peer.address.sin_addr.s_addr);
+        while(this->slots[slot] != NO_PEER && this->peers[this->slots[slot]].address.sin_addr.s_addr != peer.address.sin_addr.s_addr) {
+            slot = (slot + 1) & this->slotMask;
+        }
+        if(this->slots[slot] == NO_PEER) {
+            this->slots[slot] = id;
+        }
+    }
+
+    this->numWords = (this->numPeers + 1 + 63) / 64;
+    resetSendStatus(NOP_SEND_STATUS);
+}
+
+// Home slot of an IP address (Fibonacci hashing keeps the well mixed top bits).
+uint32_t PeerTable::slotOf(in_addr_t addr) const {
+    return ((uint32_t) addr * 2654435769u) >> this->hashShift;
+}
+
+// Returns the id of the general with the given address, or NO_PEER.
+uint32_t PeerTable::lookup(const struct sockaddr_in &address) const {
+    uint32_t slot = slotOf(address.sin_addr.s_addr);
+    while(this->slots[slot] != NO_PEER) {
+        uint32_t id = this->slots[slot];
+        if(this->peers[id].address.sin_addr.s_addr == address.sin_addr.s_addr) {
+            return id;
+        }
+        slot = (slot + 1) & this->slotMask;
+    }
+    return NO_PEER;
+}
+
+// Sets the send status of a general, moving him to the bitset of that status.
+void PeerTable::setSendStatus(uint32_t id, int status) {
+    int old = this->peers[id].sendStatus;
+    if(old == status) {
+        return;
+    }
+    this->statusBits[old * this->numWords + id / 64] &= ~(1ULL << (id % 64));
+    this->statusBits[status * this->numWords + id / 64] |= 1ULL << (id % 64);
+    this->statusCounts[old]--;
+    this->statusCounts[status]++;
+    this->peers[id].sendStatus = status;
+}
+
+// Sets the send status of every general.
+void PeerTable::resetSendStatus(int status) {
+    this->statusBits.assign(NUM_SEND_STATUSES * this->numWords, 0);
+    memset(this->statusCounts, 0, sizeof(this->statusCounts));
+    for(uint32_t id = 1; id <= this->numPeers; id++) {
+        this->peers[id].sendStatus = status;
+        this->statusBits[status * this->numWords + id / 64] |= 1ULL << (id % 64);
+    }
+    this->statusCounts[status] = this->numPeers;
+}
+
+// Forgets what was sent to and received from every general, for a new instance.
+// The addresses, the hash and the public keys stay: the table is built once and reused.
+void PeerTable::reset() {
+    for(uint32_t id = 1; id <= this->numPeers; id++) {
+        Peer &peer = this->peers[id];
+        struct sockaddr_in address = peer.address;
+        EVP_PKEY *pubKey = peer.pubKey;
+        memset(&peer, 0, sizeof(Peer));
+        peer.id = id;
+        peer.address = address;
+        peer.pubKey = pubKey;
+    }
+    resetSendStatus(NOP_SEND_STATUS);
+}
+
+// Returns the next general after an id whose send status is in a mask of them (of SEND_STATUS_BIT()s), or NO_PEER.
+// Only the words of the bitsets are scanned, so going over the generals left in a status costs a word per 64 generals.
+uint32_t PeerTable::nextWithSendStatus(unsigned int statuses, uint32_t id) const {
+    uint32_t first = id + 1;
+    for(uint32_t w = first / 64; w < this->numWords; w++) {
+        uint64_t bits = 0;
+        for(int status = 0; status < NUM_SEND_STATUSES; status++) {
+            if(statuses & SEND_STATUS_BIT(status)) {
+                bits |= this->statusBits[status * this->numWords + w];
+            }
+        }
+        if(w == first / 64) {
+            bits &= ~0ULL << (first % 64);
+        }
+        if(bits != 0) {
+            return w * 64 + __builtin_ctzll(bits);
+        }
+    }
+    return NO_PEER;
+}
+
+// Resolves host names concurrently, one slice of the names per thread.
+// addresses[i] receives the address of hostNames[i], or AF_UNSPEC if it could not be resolved.
+void PeerTable::resolve(const vector<string> &hostNames, const string &port, vector<struct sockaddr_in> &addresses) {
+    addresses.resize(hostNames.size());
+    if(hostNames.empty()) {
+        return;
+    }
+
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t numThreads = (numCores > 0) ? 4 * (size_t) numCores : 4; // Resolution mostly waits on the network.
+    if(numThreads > hostNames.size()) {
+        numThreads = hostNames.size();
+    }
+
+    vector<ResolveTask> tasks(numThreads);
+    vector<pthread_t> threads(numThreads);
+    for(size_t t = 0; t < numThreads; t++) {
+        tasks[t].hostNames = &hostNames;
+        tasks[t].port = &port;
+        tasks[t].addresses = &addresses;
+        tasks[t].first = t;
+        tasks[t].stride = numThreads;
+    }
+
+    // The calling thread resolves the first slice itself.
+    size_t started = 1;
+    for(; started < numThreads; started++) {
+        if(pthread_create(&threads[started], NULL, resolveWorker, &tasks[started]) != 0) {
+            break;
+        }
+    }
+    resolveWorker(&tasks[0]);
+    for(size_t t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    // Slices whose thread could not be started are resolved here.
+    for(size_t t = started; t < numThreads; t++) {
+        resolveWorker(&tasks[t]);
+    }
+}
@@ -0,0 +1,85 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class PeerTable. |
+|
+| The peer table is a contiguous array of per-general state indexed |
+| by general id, plus a small open addressed hash from IP address to |
+| general id for the receive path. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef PEER_TABLE_H
+#define PEER_TABLE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <openssl/evp.h>
+
+#define CACHE_LINE_SIZE 64
+#define NO_PEER 0 // Returned by lookups for addresses that do not belong to any general.
+
+#define NOP_SEND_STATUS 0
+#define SENT 1
+#define NOT_SENT 2
+#define ACKED 3
+#define DO_NOT_SEND 4
+#define QUEUED 5 // The message waits in the bundle of the general, to go out at the next flush.
+#define NUM_SEND_STATUSES 6
+#define SEND_STATUS_BIT(status) (1U << (status)) // Picks a send status out of a mask of them.
+
+// Everything a general knows about one of the generals in the system.
+// Aligned to a cache line, so that updating one peer never touches the line of another.
+typedef struct {
+    uint32_t id;                // The identifier of the general.
+    int sendStatus;             // Send status of the current message to this general (set through PeerTable::setSendStatus()).
+    struct sockaddr_in address; // Address to send to (sin_family is AF_UNSPEC if it could not be resolved).
+    EVP_PKEY *pubKey;           // Public key of the general (NULL if not loaded).
+    struct timeval lastSent;    // When the current message was last sent to this general.
+    long rtt;                   // Smoothed round trip time in microseconds (0 until the first ACK).
+    uint32_t msgsSent;          // Number of datagrams sent to this general.
+    uint32_t retransmits;       // Number of those that were retransmissions.
+    uint32_t copiesSent;        // Copies of the current message sent to this general.
+    uint32_t timeouts;          // Retransmit timeouts of the current message (the timeout doubles with each).
+    uint32_t msgsReceived;      // Number of messages received from this general.
+    uint32_t acksReceived;      // Number of ACKs received from this general.
+} __attribute__((aligned(CACHE_LINE_SIZE))) Peer;
+
+// Class definition.
+class PeerTable {
+
+    private:
+        Peer *peers;        // Peer state, indexed by general id (slot 0 is unused).
+        uint32_t numPeers;  // Number of generals in the system.
+        uint32_t *slots;    // Open addressed hash of IP address to general id (NO_PEER marks an empty slot).
+        uint32_t slotMask;  // Number of slots - 1 (the number of slots is a power of two).
+        uint32_t hashShift; // Shift that keeps the top bits of the multiplicative hash.
+        std::vector<uint64_t> statusBits;         // A bitset of the generals in each send status, numWords words apiece.
+        uint32_t numWords;                        // Words of a bitset.
+        uint32_t statusCounts[NUM_SEND_STATUSES]; // Number of generals in each send status.
+
+        uint32_t slotOf(in_addr_t) const;        // Home slot of an IP address.
+        PeerTable(const PeerTable &);            // Not copyable.
+        PeerTable &operator=(const PeerTable &); // Not assignable.
+
+    public:
+        PeerTable();  // Constructor to initialize variables.
+        ~PeerTable(); // Destructor to free the table.
+
+        void init(const std::vector<struct sockaddr_in> &) throw(std::string); // Builds the table from the addresses of generals 1..n.
+        uint32_t lookup(const struct sockaddr_in &) const;                     // Returns the id of the general with the given address, or NO_PEER.
+        void setSendStatus(uint32_t, int);                                     // Sets the send status of a general.
+        void resetSendStatus(int);                                             // Sets the send status of every general.
+        void reset();                                                          // Forgets what was sent and received, keeping the addresses and keys.
+        uint32_t nextWithSendStatus(unsigned int, uint32_t) const;             // Returns the next general after an id in any of a mask of send statuses, or NO_PEER.
+        uint32_t countSendStatus(int status) const { return this->statusCounts[status]; } // Returns the number of generals in a send status.
+        uint32_t size() const { return this->numPeers; }                       // Returns the number of generals in the system.
+        Peer &operator[](uint32_t id) { return this->peers[id]; }              // Returns the state of a general given his id.
+        const Peer &operator[](uint32_t id) const { return this->peers[id]; }  // Returns the state of a general given his id.
+
+        static void resolve(const std::vector<std::string> &, const std::string &, std::vector<struct sockaddr_in> &); // Resolves host names concurrently.
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the presigner: a thread that signs the order |
+| of the commander for the instances ahead of the one running. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstring>
+#include <openssl/err.h>
+#include "Presigner.h"
+#include "General.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+Presigner::Presigner() {
+    this->myId = 0;
+    this->pvtKey = NULL;
+    this->signing = false;
+    this->stopping = false;
+    this->started = false;
+    pthread_mutex_init(&(this->lock), NULL);
+    pthread_cond_init(&(this->requested), NULL);
+    pthread_cond_init(&(this->signedOne), NULL);
+}
+
+// Destructor to stop the presigner thread and release the key.
+Presigner::~Presigner() {
+    stop();
+    if(this->pvtKey != NULL) {
+        EVP_PKEY_free(this->pvtKey);
+    }
+    pthread_cond_destroy(&(this->signedOne));
+    pthread_cond_destroy(&(this->requested));
+    pthread_mutex_destroy(&(this->lock));
+}
+
+// Loads the private key of a general and starts the presigner thread.
+void Presigner::start(uint32_t myId) throw(string) {
+    this->myId = myId;
+    this->pvtKey = General::readPrivateKey(myId);
+    this->stopping = false;
+    if(pthread_create(&(this->thread), NULL, Presigner::signerMain, this) != 0) {
+        throw string("\nCould not start the presigner.");
+    }
+    this->started = true;
+}
+
+// Asks for the signature of a digest in an instance. It is signed on the presigner thread.
+void Presigner::request(uint32_t instance, const uint8_t *digest) {
+    Presigned presigned;
+    presigned.instance = instance;
+    memcpy(presigned.digest, digest, DIGEST_SIZE);
+
+    pthread_mutex_lock(&(this->lock));
+    this->pending.push_back(presigned);
+    pthread_cond_signal(&(this->requested));
+    pthread_mutex_unlock(&(this->lock));
+}
+
+// Takes the signature of a digest in an instance, if it was signed ahead. One being signed right now is waited for.
+// One still waiting its turn is dropped: the commander signs it himself sooner than it would come.
+// Returns false if the caller has to sign.
+bool Presigner::take(uint32_t instance, const uint8_t *digest, struct sig *sign) {
+    bool taken = false;
+    pthread_mutex_lock(&(this->lock));
+    while(this->signing && this->current.instance == instance && memcmp(this->current.digest, digest, DIGEST_SIZE) == 0) {
+        pthread_cond_wait(&(this->signedOne), &(this->lock));
+    }
+
+    map<uint32_t, vector<Presigned> >::iterator it = this->signatures.find(instance);
+    for(size_t i = 0; it != this->signatures.end() && i < it->second.size() && !taken; i++) {
+        if(memcmp(it->second[i].digest, digest, DIGEST_SIZE) == 0) {
+            memcpy(sign, &(it->second[i].signature), sizeof(struct sig));
+            it->second.erase(it->second.begin() + i);
+            taken = true;
+        }
+    }
+    for(deque<Presigned>::iterator p = this->pending.begin(); p != this->pending.end() && !taken; ) {
+        p = (p->instance == instance && memcmp(p->digest, digest, DIGEST_SIZE) == 0) ? this->pending.erase(p) : p + 1;
+    }
+    pthread_mutex_unlock(&(this->lock));
+    return taken;
+}
+
+// Drops what is left of an instance, signed or not.
+void Presigner::forget(uint32_t instance) {
+    pthread_mutex_lock(&(this->lock));
+    this->signatures.erase(instance);
+    for(deque<Presigned>::iterator p = this->pending.begin(); p != this->pending.end(); ) {
+        p = (p->instance == instance) ? this->pending.erase(p) : p + 1;
+    }
+    pthread_mutex_unlock(&(this->lock));
+}
+
+// Stops the presigner thread. What was not signed yet is dropped.
+void Presigner::stop() {
+    if(!this->started) {
+        return;
+    }
+
+    pthread_mutex_lock(&(this->lock));
+    this->stopping = true;
+    this->pending.clear();
+    pthread_cond_signal(&(this->requested));
+    pthread_mutex_unlock(&(this->lock));
+    pthread_join(this->thread, NULL);
+    this->started = false;
+}
+
+// Runs the presigner thread.
+void *Presigner::signerMain(void *arg) {
+    ((Presigner *) arg)->signAhead();
+    return NULL;
+}
+
+// Signs the signatures asked for, one after the other, as General::signMessage() would.
+void Presigner::signAhead() {
+    pthread_mutex_lock(&(this->lock));
+    while(true) {
+        while(this->pending.empty() && !this->stopping) {
+            pthread_cond_wait(&(this->requested), &(this->lock));
+        }
+        if(this->stopping) {
+            break;
+        }
+
+        this->current = this->pending.front();
+        this->pending.pop_front();
+        this->signing = true;
+        pthread_mutex_unlock(&(this->lock));
+
+        uint8_t value[SIGNED_VALUE_SIZE];
+        General::signedValue(this->current.instance, this->current.digest, value);
+        this->current.signature.id = this->myId;
+        bool ok = General::signBytes(this->pvtKey, value, SIGNED_VALUE_SIZE, this->current.signature.signature);
+        if(!ok) {
+            ERR_print_errors_fp(stderr);
+        }
+
+        pthread_mutex_lock(&(this->lock));
+        if(ok) {
+            this->signatures[this->current.instance].push_back(this->current);
+        }
+        this->signing = false;
+        pthread_cond_broadcast(&(this->signedOne));
+    }
+    pthread_mutex_unlock(&(this->lock));
+}
@@ -0,0 +1,67 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class Presigner. |
+|
+| The commander signs one thing per instance: the instance and the |
+| digest of the value (see General::signedValue()). Both are known |
+| before the instance starts, so a presigner thread signs them ahead |
+| while the shard is still busy with the instances before, and the |
+| commander sends his order in round 1 without signing anything. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef PRESIGNER_H
+#define PRESIGNER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include "message_format.h"
+
+#define PRESIGN_AHEAD 4 // Instances of a shard signed ahead of the one it runs, when the values are known up front.
+
+// A signature asked for, or signed ahead.
+typedef struct {
+    uint32_t instance;           // The instance signed in.
+    uint8_t digest[DIGEST_SIZE]; // Digest of the value signed.
+    struct sig signature;        // The signature (once it is signed).
+} Presigned;
+
+// Class definition.
+class Presigner {
+
+    private:
+        uint32_t myId;                                          // Id of the general signing.
+        EVP_PKEY *pvtKey;                                       // Private key of the general (a copy of his own, for the presigner thread).
+        std::deque<Presigned> pending;                          // Signatures asked for and not signed yet.
+        std::map<uint32_t, std::vector<Presigned> > signatures; // Signatures signed ahead, by instance.
+        bool signing;                                           // Is the presigner thread signing one right now?
+        Presigned current;                                      // What it is signing.
+        bool stopping;                                          // Should the presigner thread stop?
+        pthread_mutex_t lock;                                   // Guards everything above but myId and pvtKey.
+        pthread_cond_t requested;                               // Signalled when a signature is asked for or the presigner stops.
+        pthread_cond_t signedOne;                               // Signalled when a signature has been signed.
+        pthread_t thread;                                       // The presigner thread.
+        bool started;                                           // Was the presigner thread started?
+
+        static void *signerMain(void *);             // Runs the presigner thread.
+        void signAhead();                            // Signs the signatures asked for, one after the other.
+        Presigner(const Presigner &);                // Not copyable.
+        Presigner &operator=(const Presigner &);     // Not assignable.
+
+    public:
+        Presigner();  // Constructor to initialize variables.
+        ~Presigner(); // Destructor to stop the presigner thread and release the key.
+
+        void start(uint32_t) throw(std::string);           // Loads the private key of a general and starts the presigner thread.
+        void request(uint32_t, const uint8_t *);           // Asks for the signature of a digest in an instance.
+        bool take(uint32_t, const uint8_t *, struct sig *); // Takes the signature of a digest in an instance, if it was signed ahead.
+        void forget(uint32_t);                             // Drops what is left of an instance.
+        void stop();                                       // Stops the presigner thread.
+};
+
+#endif
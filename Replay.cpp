@@ -0,0 +1,129 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the replay of a packet capture. |
++----------------------------------------------------------------------+
+*/
+
+#include <cerrno>
+#include <cstring>
+#include <set>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "Replay.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+Replay::Replay() {
+    memset(&(this->header), 0, sizeof(this->header));
+    this->next = 0;
+    this->paced = false;
+    this->virtualTime = 0;
+    this->offset = 0;
+    this->numFed = 0;
+}
+
+// Reads a capture to replay.
+void Replay::load(const string &path) throw(string) {
+    this->datagrams.clear();
+    this->bytes.clear();
+    if(!PacketCapture::load(path, &(this->header), this->datagrams, this->bytes)) {
+        throw string("\nCould not read the packet capture " + path + ".");
+    }
+    this->next = 0;
+    this->numFed = 0;
+}
+
+// Starts the clock at the time of the first record: paced, it runs from there at the pace of the time of day;
+// otherwise it is virtual, and only moves on when the general waits.
+void Replay::start(bool paced) {
+    this->paced = paced;
+    this->virtualTime = this->datagrams.empty() ? timeOfDay() : this->datagrams[0].time;
+    this->offset = this->virtualTime - timeOfDay();
+}
+
+// Returns the time, in microseconds.
+int64_t Replay::now() const {
+    return this->paced ? timeOfDay() + this->offset : this->virtualTime;
+}
+
+// Feeds the next datagram received (like recv(), flags MSG_DONTWAIT or 0), and who sent it, once it is due.
+// Virtual time that finds none due moves on, by REPLAY_IDLE_STEP at most, or straight to the next one if
+// the general blocks. Once they are all fed, nothing comes any more: a general that blocks is told so,
+// rather than kept waiting forever, and waits out his rounds.
+ssize_t Replay::receive(char *buffer, size_t bufferLen, int flags, uint32_t *peerId) {
+    const CapturedDatagram *datagram = pending();
+    if(datagram != NULL && datagram->time > now()) {
+        if(!(flags & MSG_DONTWAIT)) {
+            wait(-1);
+        } else if(!this->paced) {
+            this->virtualTime += (datagram->time - this->virtualTime < REPLAY_IDLE_STEP) ? datagram->time - this->virtualTime : REPLAY_IDLE_STEP;
+        }
+    } else if(datagram == NULL) {
+        wait(REPLAY_IDLE_STEP / 1000);
+    }
+    if(datagram == NULL || datagram->time > now()) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    size_t length = (datagram->length < bufferLen) ? datagram->length : bufferLen;
+    memcpy(buffer, &(this->bytes[datagram->offset]), length);
+    *peerId = datagram->peerId;
+    this->next++;
+    this->numFed++;
+    return length;
+}
+
+// Waits till a datagram is due or a timeout (in milliseconds, -1 for none) passes.
+// Virtual time moves on to then; paced, the time of day is slept through.
+void Replay::wait(int timeout) {
+    const CapturedDatagram *datagram = pending();
+    int64_t until = now() + ((timeout < 0) ? REPLAY_IDLE_STEP : (int64_t) timeout * 1000);
+    if(datagram != NULL && (timeout < 0 || datagram->time < until)) {
+        until = datagram->time;
+    }
+    if(until <= now()) {
+        return;
+    }
+
+    if(this->paced) {
+        usleep((useconds_t) (until - now()));
+    } else {
+        this->virtualTime = until;
+    }
+}
+
+// Returns the instances in the capture, in the order they appear (the second word of every datagram).
+void Replay::getInstances(vector<uint32_t> &instances) const {
+    set<uint32_t> seen;
+    for(size_t i = 0; i < this->datagrams.size(); i++) {
+        const CapturedDatagram &datagram = this->datagrams[i];
+        if(datagram.length < 2 * sizeof(uint32_t)) {
+            continue;
+        }
+        uint32_t instance;
+        memcpy(&instance, &(this->bytes[datagram.offset + sizeof(uint32_t)]), sizeof(instance));
+        instance = ntohl(instance);
+        if(seen.insert(instance).second) {
+            instances.push_back(instance);
+        }
+    }
+}
+
+// Returns the next received datagram to feed, skipping those that were sent (NULL if there are no more).
+const CapturedDatagram *Replay::pending() {
+    while(this->next < this->datagrams.size() && this->datagrams[this->next].direction != CAPTURE_RECEIVED) {
+        this->next++;
+    }
+    return (this->next < this->datagrams.size()) ? &(this->datagrams[this->next]) : NULL;
+}
+
+// Returns the time of day, in microseconds.
+int64_t Replay::timeOfDay() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_usec;
+}
@@ -0,0 +1,60 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class Replay. |
+|
+| A replay feeds the datagrams a general received, read from a packet |
+| capture, back to a general in place of his socket, and stands in |
+| for the clock he reads. Paced, the datagrams come at the times they |
+| were recorded at, shifted to now. Otherwise time is virtual: it |
+| stands still while the general works and only moves on when he |
+| waits for a datagram, straight to the next one, so that a capture |
+| is replayed as fast as the general can go and the same way on every |
+| run, whatever the machine. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+#include "PacketCapture.h"
+
+#define REPLAY_IDLE_STEP 1000 // Microseconds virtual time moves on by at most when a general finds no datagram.
+
+// Class definition.
+class Replay {
+
+    private:
+        CaptureHeader header;                    // Header of the capture (in host byte order).
+        std::vector<CapturedDatagram> datagrams; // The records of the capture.
+        std::vector<char> bytes;                 // Their bytes.
+        size_t next;                             // Next record to feed (sent ones are skipped).
+        bool paced;                              // Are the datagrams fed at the times they were recorded at?
+        int64_t virtualTime;                     // The time, when it is virtual (in microseconds).
+        int64_t offset;                          // Recorded time less time of day, when paced (in microseconds).
+        uint64_t numFed;                         // Number of datagrams fed.
+
+        const CapturedDatagram *pending();       // Returns the next received datagram (NULL if there are no more).
+        static int64_t timeOfDay();              // Returns the time of day, in microseconds.
+        Replay(const Replay &);                  // Not copyable.
+        Replay &operator=(const Replay &);       // Not assignable.
+
+    public:
+        Replay(); // Constructor to initialize variables.
+
+        void load(const std::string &) throw(std::string);    // Reads a capture to replay.
+        void start(bool);                                     // Starts the clock at the first record, paced or virtual.
+        int64_t now() const;                                  // Returns the time, in microseconds.
+        ssize_t receive(char *, size_t, int, uint32_t *);     // Feeds the next datagram received (like recv()), and who sent it.
+        void wait(int);                                       // Waits till a datagram is due or a timeout (in milliseconds, -1 for none) passes.
+        void getInstances(std::vector<uint32_t> &) const;     // Returns the instances in the capture, in the order they appear.
+        const CaptureHeader &getHeader() const { return this->header; } // Returns the header of the capture.
+        size_t getNumRecords() const { return this->datagrams.size(); } // Returns the number of records in the capture.
+        uint64_t getNumFed() const { return this->numFed; }             // Returns the number of datagrams fed.
+        bool isOver() { return pending() == NULL; }                     // Have all the datagrams received been fed?
+};
+
+#endif
@@ -0,0 +1,301 @@
+/*
++----------------------------------------------------------------------+
+| This class implements a shard: a pinned worker thread with a socket |
+| of its own, that runs its share of the agreement instances. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstdio>
+#include <sched.h>
+#include <linux/filter.h>
+#include <openssl/crypto.h>
+#include "Shard.h"
+#include "Commander.h"
+#include "Lieutenant.h"
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51 // Linux 4.5 and later.
+#endif
+
+using namespace std;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static pthread_mutex_t *cryptoLocks = NULL; // The locks OpenSSL asks for (before 1.1.0 it does not lock by itself).
+
+// Takes or releases one of the locks of OpenSSL.
+static void lockCrypto(int mode, int n, const char *file, int line) {
+    if(mode & CRYPTO_LOCK) {
+        pthread_mutex_lock(&cryptoLocks[n]);
+    } else {
+        pthread_mutex_unlock(&cryptoLocks[n]);
+    }
+}
+
+// Tells OpenSSL which thread is calling.
+static unsigned long cryptoThreadId() {
+    return (unsigned long) pthread_self();
+}
+#endif
+
+// Constructor to initialize variables.
+Shard::Shard() {
+    this->index = 0;
+    this->numShards = 1;
+    this->numInstances = 0;
+    this->socketFD = -1;
+    this->log = NULL;
+    this->feed = NULL;
+    this->interrupted = false;
+    this->isCommander = false;
+    this->colocated = false;
+    this->started = false;
+    this->copiesReceived = 0;
+    this->messagesReceived = 0;
+}
+
+// Destructor to close the socket of the shard.
+Shard::~Shard() {
+    if(this->socketFD != -1) {
+        close(this->socketFD);
+    }
+}
+
+// Opens the socket of the shard. The decisions are appended to the given log, if any.
+// With a feed, the shard runs instances for as long as the feed hands out values, and the general is the
+// commander if his id is COMMANDER_ID. Without, he is the commander if he is given a value to propose.
+// The shards must be initialized in the order of their index: the kernel numbers the sockets
+// sharing a port in the order they were bound, and steer() relies on it.
+void Shard::init(uint32_t index, uint32_t numShards, uint32_t numInstances, const GeneralInfo &generalInfo, const vector<uint8_t> &value, DecisionLog *log, InstanceFeed *feed) throw(string) {
+    this->index = index;
+    this->numShards = numShards;
+    this->numInstances = numInstances;
+    this->generalInfo = generalInfo;
+    this->value = value;
+    this->log = log;
+    this->feed = feed;
+    this->isCommander = (feed != NULL) ? (generalInfo.myId == COMMANDER_ID) : !value.empty();
+    if(!value.empty()) {
+        PayloadStore::digest(&value[0], value.size(), this->valueDigest);
+    }
+    this->latency.init(generalInfo.numGenerals);
+
+    // A commander sends its payload to every lieutenant. A lieutenant does not know what payload will come in.
+    size_t payloadBytes = value.empty() ? MAX_PAYLOAD_SIZE : (value.size() + sizeof(PayloadMessage)) * (generalInfo.numGenerals - 1);
+    int bufferSize = General::socketBufferSize(generalInfo.numGenerals, generalInfo.maxFailures, payloadBytes);
+
+    // Generals on the same host share the port: each binds his own address, and they talk through shared memory.
+    string host;
+    this->colocated = LocalTransport::isColocated(generalInfo.addresses, generalInfo.myId);
+    if(this->colocated) {
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &(generalInfo.addresses[generalInfo.myId - 1].sin_addr), address, sizeof(address));
+        host = address;
+    }
+    this->socketFD = General::openSocket(host, generalInfo.port, numShards > 1, bufferSize);
+    if(this->colocated) {
+        this->local.init(generalInfo.myId, index, numShards, generalInfo.port, generalInfo.addresses);
+    }
+
+    // The keys are read, and the peer table and the trie built, once for all the instances of the shard.
+    this->workspace.init(generalInfo.myId, generalInfo.addresses, generalInfo.hugePages, generalInfo.cryptoOff);
+    if(!this->isCommander) {
+        this->workspace.loadPublicKeys();
+    }
+
+    // Every shard captures to a file of its own, written only by its thread.
+    if(!generalInfo.capturePath.empty()) {
+        stringstream path;
+        path<<generalInfo.capturePath;
+        if(numShards > 1) {
+            path<<"."<<index;
+        }
+        CaptureHeader header;
+        header.general = generalInfo.myId;
+        header.num_generals = generalInfo.numGenerals;
+        header.max_failures = generalInfo.maxFailures;
+        header.fanout = generalInfo.fanout;
+        header.blind_copies = generalInfo.blindCopies;
+        header.shard = index;
+        header.num_shards = numShards;
+        this->capture.open(path.str(), header);
+    }
+}
+
+// Starts the worker thread, and the presigner of a commander.
+void Shard::start() throw(string) {
+    if(this->isCommander) {
+        this->presigner.start(this->generalInfo.myId);
+    }
+    if(pthread_create(&(this->thread), NULL, Shard::worker, this) != 0) {
+        throw string("\nCould not start the thread of a shard.");
+    }
+    this->started = true;
+}
+
+// Wakes up a lieutenant waiting for a commander that will not come, so that the shard can stop.
+// Nothing is received on the socket of the shard afterwards, and the instance it is running is given up.
+void Shard::interrupt() {
+    this->interrupted = true;
+    if(this->socketFD != -1) {
+        shutdown(this->socketFD, SHUT_RD);
+    }
+}
+
+// Waits for the worker thread to run all its instances.
+void Shard::join() {
+    if(this->started) {
+        pthread_join(this->thread, NULL);
+        this->started = false;
+    }
+    this->presigner.stop();
+    this->capture.close();
+}
+
+// Has the order for a value in an instance of the shard signed ahead (on the commander).
+// A feed calls it when it learns the value, so that the order is signed before the shard gets to the instance.
+void Shard::presign(uint32_t instance, const vector<uint8_t> &value) {
+    if(this->isCommander && !value.empty()) {
+        uint8_t digest[DIGEST_SIZE];
+        PayloadStore::digest(&value[0], value.size(), digest);
+        this->presigner.request(instance, digest);
+    }
+}
+
+// Runs the instances of a shard on its pinned thread.
+void *Shard::worker(void *arg) {
+    Shard *shard = (Shard *) arg;
+    shard->pin();
+    shard->runInstances();
+    return NULL;
+}
+
+// Runs the instances of the shard (index, index + numShards, ...) one after the other.
+// Every instance gets a general of its own, on the socket and in the workspace of the shard.
+// Decisions are handed to the log without waiting for them to be synced.
+// Without a feed the value is known up front, and the commander has it signed PRESIGN_AHEAD instances ahead.
+void Shard::runInstances() {
+    for(uint32_t ahead = 0; ahead < PRESIGN_AHEAD; ahead++) {
+        presignAhead(this->index + ahead * this->numShards);
+    }
+    for(uint32_t instance = this->index; instance < this->numInstances; instance += this->numShards) {
+        vector<uint8_t> value = this->value;
+        if(this->feed != NULL && !this->feed->nextValue(instance, value)) {
+            break;
+        }
+
+        GeneralInfo info = this->generalInfo;
+        info.instance = instance;
+        info.socketFD = this->socketFD;
+        info.latency = info.timeLatency ? &(this->latency) : NULL;
+        info.interrupted = &(this->interrupted);
+        info.presigner = this->isCommander ? &(this->presigner) : NULL;
+        info.local = this->colocated ? &(this->local) : NULL;
+        info.capture = this->capture.isOpen() ? &(this->capture) : NULL;
+        info.workspace = &(this->workspace);
+
+        Outcome outcome;
+        outcome.instance = instance;
+        outcome.done = false;
+        outcome.decision = NO_ORDER;
+        outcome.havePayload = false;
+
+        General *generalObj = NULL;
+        try {
+            if(this->isCommander) {
+                generalObj = new Commander(&info, value); // It's a Commander.
+            } else {
+                generalObj = new Lieutenant(&info);       // It's a Lieutenant.
+            }
+            outcome.decision = generalObj->run();
+            outcome.done = true;
+            outcome.havePayload = generalObj->getDecision(outcome.digest) && generalObj->getPayload(outcome.digest, outcome.payload);
+            if(this->log != NULL && generalObj->getDecision(outcome.digest)) {
+                vector<vector<char> > chains;
+                generalObj->getEvidence(chains);
+                this->log->append(info.myId, instance, outcome.decision, outcome.digest, chains);
+            }
+        } catch(string msg) {
+            if(!this->interrupted) {
+                cerr<<msg;
+            }
+        }
+        if(generalObj != NULL) {
+            uint64_t copies, messages;
+            generalObj->getDelivery(copies, messages);
+            this->copiesReceived += copies;
+            this->messagesReceived += messages;
+        }
+        delete generalObj;
+        this->presigner.forget(instance);
+        presignAhead(instance + PRESIGN_AHEAD * this->numShards);
+        if(this->interrupted && !outcome.done) {
+            break; // The instance was given up.
+        }
+
+        if(this->feed != NULL) {
+            this->feed->decided(outcome);
+        } else {
+            this->outcomes.push_back(outcome);
+        }
+    }
+}
+
+// Has the order of an instance of the shard signed ahead, if the value is known up front and it is one to run.
+void Shard::presignAhead(uint32_t instance) {
+    if(this->isCommander && this->feed == NULL && instance < this->numInstances) {
+        this->presigner.request(instance, this->valueDigest);
+    }
+}
+
+// Pins the calling thread to the core of the shard.
+void Shard::pin() {
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(numCores <= 0) {
+        return;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(this->index % numCores, &cpus);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        cerr<<"\nCould not pin shard "<<this->index<<" to a core.";
+    }
+}
+
+// Steers the datagrams of each instance to the socket of its shard.
+// A classic BPF program attached to the port's group picks socket (instance % numShards),
+// reading the instance from the second word of the datagram.
+void Shard::steer(Shard *shards, uint32_t numShards) throw(string) {
+    if(numShards <= 1) {
+        return;
+    }
+
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, sizeof(uint32_t)), // A = instance (in host byte order).
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, numShards),       // A = A % numShards.
+        BPF_STMT(BPF_RET | BPF_A, 0),                         // Socket A of the group takes it.
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+    if(setsockopt(shards[0].socketFD, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+        perror("Failed to steer datagrams to the shards: setsockopt() failed");
+        throw string("\nCould not steer the instances to their shards.");
+    }
+}
+
+// Makes OpenSSL safe to use from the shard threads.
+// Every general holds keys of his own, but OpenSSL before 1.1.0 shares its internal state without locking it.
+void Shard::initCrypto() {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    if(cryptoLocks == NULL) {
+        cryptoLocks = new pthread_mutex_t[CRYPTO_num_locks()];
+        for(int i = 0; i < CRYPTO_num_locks(); i++) {
+            pthread_mutex_init(&cryptoLocks[i], NULL);
+        }
+        CRYPTO_set_id_callback(cryptoThreadId);
+        CRYPTO_set_locking_callback(lockCrypto);
+    }
+#endif
+}
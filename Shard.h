@@ -0,0 +1,96 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class Shard. |
+|
+| A shard is a worker thread pinned to a core, with a socket of its |
+| own that shares the port of the general with the other shards |
+| (SO_REUSEPORT). Instance i is run by shard i % numShards on every |
+| general, and the kernel steers the datagrams of an instance to the |
+| socket of its shard, so the shards share no mutable state. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "General.h"
+#include "DecisionLog.h"
+
+#define MAX_SHARDS 256 // Sockets a port can be shared by.
+
+// What a general ended up with in one agreement instance.
+typedef struct {
+    uint32_t instance;            // The agreement instance.
+    bool done;                    // Did the instance run to the end?
+    int decision;                 // ATTACK, RETREAT or OPAQUE_VALUE.
+    uint8_t digest[DIGEST_SIZE];  // Digest of the value decided on.
+    bool havePayload;             // Was the payload of the value retrieved?
+    std::vector<uint8_t> payload; // The payload of the value.
+} Outcome;
+
+// Hands the values of the instances to the shards and takes back what was decided, as they run.
+// Without a feed, a shard runs a fixed number of instances on one value and keeps the outcomes.
+class InstanceFeed {
+
+    public:
+        virtual ~InstanceFeed() {}
+        virtual bool nextValue(uint32_t, std::vector<uint8_t> &) = 0; // Waits for the value of an instance (none for a lieutenant). Returns false to stop.
+        virtual void decided(const Outcome &) = 0;                    // Takes what was decided in an instance.
+};
+
+// Class definition.
+class Shard {
+
+    private:
+        uint32_t index;                // Index of the shard (and of its socket in the port's group).
+        uint32_t numShards;            // Number of shards of the general.
+        uint32_t numInstances;         // Number of instances run by all the shards together.
+        int socketFD;                  // Socket of the shard.
+        GeneralInfo generalInfo;       // Information to create the general of an instance from.
+        std::vector<uint8_t> value;    // The value proposed in every instance, if the general is the commander.
+        uint8_t valueDigest[DIGEST_SIZE]; // Digest of that value.
+        std::vector<Outcome> outcomes; // What was decided in the instances of the shard.
+        DecisionLog *log;              // Log the decisions are appended to (NULL for none).
+        LatencyStats latency;          // Latencies timed in the instances of the shard.
+        uint64_t copiesReceived;       // Blind copies received in the instances of the shard.
+        uint64_t messagesReceived;     // Distinct messages among them.
+        InstanceFeed *feed;            // Hands out the values and takes the outcomes (NULL to run numInstances on value).
+        volatile bool interrupted;     // Was the shard interrupted?
+        bool isCommander;              // Is the general the commander?
+        Presigner presigner;           // Signs the orders of the commander ahead.
+        bool colocated;                // Are other generals on this host?
+        LocalTransport local;          // Rings to them, from and to the shards of the same index.
+        PacketCapture capture;         // Where the datagrams of the shard are captured (if they are).
+        Workspace workspace;           // Keys, peer table and trie of the generals of the shard, built once.
+        pthread_t thread;              // The worker thread.
+        bool started;                  // Was the worker thread started?
+
+        static void *worker(void *); // Runs the instances of a shard on its pinned thread.
+        void runInstances();         // Runs the instances of the shard one after the other.
+        void presignAhead(uint32_t); // Has the order of an instance of the shard signed ahead, if it is one to run.
+        void pin();                  // Pins the calling thread to the core of the shard.
+        Shard(const Shard &);            // Not copyable.
+        Shard &operator=(const Shard &); // Not assignable.
+
+    public:
+        Shard();  // Constructor to initialize variables.
+        ~Shard(); // Destructor to close the socket of the shard.
+
+        void init(uint32_t, uint32_t, uint32_t, const GeneralInfo &, const std::vector<uint8_t> &, DecisionLog *, InstanceFeed *) throw(std::string); // Opens the socket of the shard.
+        void start() throw(std::string);                   // Starts the worker thread.
+        void join();                                       // Waits for the worker thread to run all its instances.
+        void interrupt();                                  // Wakes up a lieutenant waiting for a commander that will not come.
+        void presign(uint32_t, const std::vector<uint8_t> &); // Has the order for a value in an instance of the shard signed ahead.
+        const std::vector<Outcome> &getOutcomes() const { return this->outcomes; } // Returns what was decided in the instances of the shard.
+        const LatencyStats &getLatency() const { return this->latency; }          // Returns the latencies timed in the instances of the shard.
+        uint64_t getCopiesReceived() const { return this->copiesReceived; }       // Returns the blind copies received in the instances of the shard.
+        uint64_t getMessagesReceived() const { return this->messagesReceived; }   // Returns the distinct messages among them.
+
+        static void steer(Shard *, uint32_t) throw(std::string); // Steers the datagrams of each instance to the socket of its shard.
+        static void initCrypto();                                // Makes OpenSSL safe to use from the shard threads.
+};
+
+#endif
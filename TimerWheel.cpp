@@ -0,0 +1,135 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the hierarchical timer wheel. |
++----------------------------------------------------------------------+
+*/
+
+#include <cstddef>
+#include "TimerWheel.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+TimerWheel::TimerWheel() {
+    this->origin = 0;
+    this->current = 0;
+    this->numArmed = 0;
+}
+
+// Makes room for the timers of ids below a bound, none armed, with tick 0 at the given time (microseconds).
+void TimerWheel::init(uint32_t numIds, int64_t now) {
+    TimerNode empty;
+    empty.next = NULL;
+    empty.prev = NULL;
+    empty.expiry = 0;
+    empty.armed = false;
+    this->timers.assign(numIds, empty);
+    this->slots.assign(TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS, empty);
+    this->origin = now;
+    this->current = 0;
+    this->numArmed = 0;
+}
+
+// Arms the timer of an id to expire at a time (microseconds), rounded up to a tick. An armed timer is moved.
+// A time already past expires at the next call to expire().
+void TimerWheel::arm(uint32_t id, int64_t at) {
+    TimerNode *timer = &(this->timers[id]);
+    if(timer->armed) {
+        unlink(timer);
+    } else {
+        this->numArmed++;
+    }
+
+    int64_t ticks = (at - this->origin + TIMER_TICK_USEC - 1) / TIMER_TICK_USEC;
+    timer->expiry = (ticks > (int64_t) this->current) ? (uint64_t) ticks : this->current;
+    timer->armed = true;
+    link(timer);
+}
+
+// Disarms the timer of an id.
+void TimerWheel::cancel(uint32_t id) {
+    TimerNode *timer = &(this->timers[id]);
+    if(timer->armed) {
+        unlink(timer);
+        timer->armed = false;
+        this->numArmed--;
+    }
+}
+
+// Disarms every timer.
+void TimerWheel::cancelAll() {
+    for(uint32_t id = 0; id < this->timers.size() && this->numArmed > 0; id++) {
+        cancel(id);
+    }
+}
+
+// Disarms the timers due by a time (microseconds) and appends their ids, tick by tick.
+// A wheel whose slots have all come up has the next slot of the wheel above spread over it.
+void TimerWheel::expire(int64_t now, vector<uint32_t> &due) {
+    int64_t ticks = (now - this->origin) / TIMER_TICK_USEC;
+    if(ticks < 0) {
+        return;
+    }
+    uint64_t last = (uint64_t) ticks;
+    if(this->numArmed == 0) {
+        this->current = last + 1;
+        return;
+    }
+
+    for(; this->current <= last && this->numArmed > 0; this->current++) {
+        uint32_t slot = this->current & (TIMER_WHEEL_SLOTS - 1);
+        for(int level = 1; slot == 0 && level < TIMER_WHEEL_LEVELS; level++) {
+            slot = (this->current >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+            TimerNode *head = &(this->slots[level * TIMER_WHEEL_SLOTS + slot]);
+            TimerNode *timer = head->next;
+            head->next = NULL;
+            while(timer != NULL) {
+                TimerNode *next = timer->next;
+                link(timer);
+                timer = next;
+            }
+        }
+
+        TimerNode *head = &(this->slots[this->current & (TIMER_WHEEL_SLOTS - 1)]);
+        while(head->next != NULL) {
+            TimerNode *timer = head->next;
+            unlink(timer);
+            timer->armed = false;
+            this->numArmed--;
+            due.push_back((uint32_t) (timer - &(this->timers[0])));
+        }
+    }
+    if(this->current <= last) {
+        this->current = last + 1;
+    }
+}
+
+// Puts a timer in the slot of its deadline: in the lowest wheel whose span from the current tick covers it.
+void TimerWheel::link(TimerNode *timer) {
+    uint64_t delta = timer->expiry - this->current;
+    int level = 0;
+    while(level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TIMER_WHEEL_BITS))) {
+        level++;
+    }
+    if(delta >= (1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS))) {
+        timer->expiry = this->current + (1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1; // Out of range: as late as it goes.
+    }
+
+    TimerNode *head = &(this->slots[level * TIMER_WHEEL_SLOTS + ((timer->expiry >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1))]);
+    timer->next = head->next;
+    timer->prev = head;
+    if(head->next != NULL) {
+        head->next->prev = timer;
+    }
+    head->next = timer;
+}
+
+// Takes a timer out of its slot.
+void TimerWheel::unlink(TimerNode *timer) {
+    timer->prev->next = timer->next;
+    if(timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+}
@@ -0,0 +1,60 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class TimerWheel. |
+|
+| A timer wheel keeps a timer per id (a general) in a hierarchy of |
+| wheels of TIMER_WHEEL_SLOTS slots each: the first a tick per slot, |
+| every next one the span of the wheel below per slot. A timer is put |
+| in the wheel its deadline is in range of, and moved down a wheel as |
+| its slot comes up. Arming, cancelling and expiring a timer are O(1), |
+| however many are armed. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <vector>
+#include <stdint.h>
+
+#define TIMER_TICK_USEC 1000   // Granularity of the timers, in microseconds.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS) // Slots of a wheel.
+#define TIMER_WHEEL_LEVELS 4   // Wheels (64^4 ticks, over 4 hours, are in range).
+
+// A timer, linked into the slot its deadline falls in.
+typedef struct TimerNode {
+    struct TimerNode *next; // Next timer of the slot.
+    struct TimerNode *prev; // Timer before it (the head of the slot for the first).
+    uint64_t expiry;        // Tick the timer expires at.
+    bool armed;             // Is the timer armed?
+} TimerNode;
+
+// Class definition.
+class TimerWheel {
+
+    private:
+        std::vector<TimerNode> timers; // The timer of every id.
+        std::vector<TimerNode> slots;  // Heads of the slots, TIMER_WHEEL_SLOTS per wheel.
+        int64_t origin;                // Time of tick 0, in microseconds.
+        uint64_t current;              // Next tick to expire the timers of.
+        uint32_t numArmed;             // Timers armed.
+
+        void link(TimerNode *);                    // Puts a timer in the slot of its deadline.
+        static void unlink(TimerNode *);           // Takes a timer out of its slot.
+        TimerWheel(const TimerWheel &);            // Not copyable.
+        TimerWheel &operator=(const TimerWheel &); // Not assignable.
+
+    public:
+        TimerWheel(); // Constructor to initialize variables.
+
+        void init(uint32_t, int64_t);                   // Makes room for the timers of ids below a bound, starting at a time.
+        void arm(uint32_t, int64_t);                    // Arms the timer of an id to expire at a time (microseconds).
+        void cancel(uint32_t);                          // Disarms the timer of an id.
+        void cancelAll();                               // Disarms every timer.
+        void expire(int64_t, std::vector<uint32_t> &);  // Disarms the timers due by a time and appends their ids.
+        bool isArmed(uint32_t id) const { return this->timers[id].armed; } // Is the timer of an id armed?
+        uint32_t getNumArmed() const { return this->numArmed; }            // Returns the number of timers armed.
+};
+
+#endif
@@ -0,0 +1,103 @@
+/*
++----------------------------------------------------------------------+
+| This class implements the workspace a general keeps across |
+| instances. |
++----------------------------------------------------------------------+
+*/
+
+#include "Workspace.h"
+#include "General.h"
+#include "KeyBundle.h"
+
+using namespace std;
+
+// Constructor to initialize variables.
+Workspace::Workspace() {
+    this->myId = 0;
+    this->cryptoOff = false;
+    this->ready = false;
+    this->publicKeys = false;
+    this->pvtKey = NULL;
+}
+
+// Destructor to release the keys.
+Workspace::~Workspace() {
+    for(uint32_t id = 1; id <= this->peers.size(); id++) {
+        EVP_PKEY_free(this->peers[id].pubKey);
+    }
+    EVP_PKEY_free(this->pvtKey);
+}
+
+// Reads the private key of a general and builds the peer table from the addresses of generals 1..n,
+// and the chain trie (backed by huge pages or not).
+void Workspace::init(uint32_t myId, const vector<struct sockaddr_in> &addresses, bool hugePages, bool cryptoOff) throw(string) {
+    this->myId = myId;
+    this->cryptoOff = cryptoOff;
+    this->peers.init(addresses);
+    this->chains.init(hugePages ? HUGE_PAGE_SIZE : ARENA_BLOCK_SIZE, hugePages);
+    this->pvtKey = General::readPrivateKey(myId);
+    this->ready = true;
+}
+
+// Loads the public keys of the other generals into the peer table, the first time a lieutenant asks for them.
+// The keys are taken from the key bundle if there is one, otherwise from the certificate files.
+void Workspace::loadPublicKeys() throw(string) {
+    if(this->publicKeys || this->cryptoOff) {
+        return; // Loaded already, or signatures are not verified, so the keys are not needed.
+    }
+    uint32_t numGenerals = this->peers.size();
+
+    KeyBundle bundle;
+    if(bundle.open(KEY_BUNDLE_FILE)) {
+        vector<EVP_PKEY *> keys(numGenerals + 1, (EVP_PKEY *) NULL);
+        bundle.loadKeys(&keys[0], numGenerals, this->myId);
+        for(uint32_t id = 1; id <= numGenerals; id++) {
+            if(id != this->myId) {
+                this->peers[id].pubKey = keys[id];
+            }
+        }
+        this->publicKeys = true;
+        return;
+    }
+
+    for(uint32_t id = 1; id <= numGenerals; id++) {
+        if(id != this->myId) {
+            // Read the file containig the certificate.
+            stringstream certFile, name;
+            certFile<<"./generals/host_"<<id<<"_cert.pem";
+            name<<id;
+            FILE *fp = fopen(certFile.str().c_str(), "r");
+            if(fp == NULL) {
+                throw string("\nCertificate file for " + name.str() + " could not be opened.\n");
+            }
+
+            // Read the certificate.
+            X509 *x509 = PEM_read_X509(fp, NULL, NULL, NULL);
+            fclose (fp);
+
+            if(x509 == NULL) {
+                ERR_print_errors_fp(stderr);
+                throw string("\nPublic key for " + name.str() + " could not be read.\n");
+            }
+
+            // Read the public key.
+            EVP_PKEY *pkey = X509_get_pubkey(x509);
+            X509_free(x509);
+            if(pkey == NULL) {
+                ERR_print_errors_fp(stderr);
+                throw string("\nPublic key for " + name.str() + " could not be fetched.\n");
+            }
+
+            // Store public key (or digital certificate) in the peer table.
+            this->peers[id].pubKey = pkey;
+        }
+    }
+    this->publicKeys = true;
+}
+
+// Makes the peer table and the trie as new, for an instance: what was sent and received, and the chains, are
+// forgotten, and the keys, the addresses and the memory of the nodes stay.
+void Workspace::reset() {
+    this->peers.reset();
+    this->chains.reset();
+}
@@ -0,0 +1,52 @@
+/*
++----------------------------------------------------------------------+
+| This header file contains the definition of class Workspace. |
+|
+| A workspace holds what a general keeps from one instance to the |
+| next: his private key, the public keys of the others, the peer table |
+| and the chain trie. A shard builds it once, at startup, and every |
+| general it runs starts by resetting it, so that a new instance reads |
+| no key and allocates nothing for them. |
++----------------------------------------------------------------------+
+*/
+
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <openssl/evp.h>
+#include "PeerTable.h"
+#include "ChainTrie.h"
+
+// Class definition.
+class Workspace {
+
+    private:
+        uint32_t myId;       // Identifier of the general.
+        bool cryptoOff;      // Is signature verification turned off (and the public keys not needed)?
+        bool ready;          // Was the workspace built?
+        bool publicKeys;     // Were the public keys loaded?
+        EVP_PKEY *pvtKey;    // Private key of the general.
+        PeerTable peers;     // Addresses, keys and send status of the generals, indexed by id.
+        ChainTrie chains;    // The signature chains held.
+
+        Workspace(const Workspace &);            // Not copyable.
+        Workspace &operator=(const Workspace &); // Not assignable.
+
+    public:
+        Workspace();  // Constructor to initialize variables.
+        ~Workspace(); // Destructor to release the keys.
+
+        void init(uint32_t, const std::vector<struct sockaddr_in> &, bool, bool) throw(std::string); // Reads the private key and builds the peer table and the trie.
+        void loadPublicKeys() throw(std::string); // Loads the public keys of the other generals, unless they are loaded or not needed.
+        void reset();                             // Makes the peer table and the trie as new, for an instance.
+        bool isReady() const { return this->ready; }              // Was the workspace built?
+        EVP_PKEY *getPrivateKey() const { return this->pvtKey; }  // Returns the private key of the general.
+        PeerTable &getPeers() { return this->peers; }             // Returns the peer table.
+        ChainTrie &getChains() { return this->chains; }           // Returns the chain trie.
+};
+
+#endif
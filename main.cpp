@@ -14,8 +14,8 @@
 
 #include <cstring>
 #include <fstream>
-#include "Commander.h"
-#include "Lieutenant.h"
+#include <iterator>
+#include "Shard.h"
 
 #define NOP 0
 
@@ -23,6 +23,18 @@
 #define HOSTFILE 2
 #define FAULTY 3
 #define ORDER 4
+#define VALUE 5
+#define OUTPUT 6
+#define INSTANCES 7
+#define SHARDS 8
+#define RATE 9
+#define FANOUT 10
+#define LOG 11
+#define ADVERSARY 12
+#define SEED 13
+#define BLIND 14
+#define CAPTURE 15
+#define ID 16
 
 #define MIN_PORT_NUM 1024
 #define MAX_PORT_NUM 65535
@@ -34,19 +46,44 @@
 
 using namespace std;
 
-General *bootstrap(string, char *, int, bool, uint32_t, uint32_t *); // Bootstraps the application.
+bool bootstrap(GeneralInfo *, char *);                               // Bootstraps the application.
+void report(uint32_t, const Outcome &, bool, const char *);           // Prints (and writes out) what was decided in an instance.
+bool readFile(const char *, vector<uint8_t> &);                      // Reads a payload from a file.
+bool writeFile(const char *, const vector<uint8_t> &);               // Writes a payload to a file.
 void printUsage();                                                   // Prints the usage.
 
 // The show starts here!
 int main(int argc, char **argv) {
-	int nextArg, maxFailures, portNum;
+	int nextArg, portNum;
+	int numInstances = 1, numShards = 1;
 	uint32_t order;
 	char *hostFilePath;
-	string port;
-	bool proceed = true, cryptoOff = false;
+	char *outputPath = NULL;
+	char *logPath = NULL;
+	vector<uint8_t> value;   // The value proposed, if this general is the commander.
+	bool proceed = true;
+	GeneralInfo generalInfo; // Collects the options; bootstrap() fills in the rest.
 
 	nextArg = NOP;
 	order = NO_ORDER;
+	generalInfo.myId = 0; // Found in the hostfile by host name, unless given with -i.
+	generalInfo.maxFailures = 0;
+	generalInfo.cryptoOff = false;
+	generalInfo.hugePages = false;
+	generalInfo.instance = 0;
+	generalInfo.socketFD = -1;
+	generalInfo.pacingRate = 0;
+	generalInfo.fanout = 0;
+	generalInfo.blindCopies = 0;
+	Adversary::clear(&(generalInfo.adversary));
+	generalInfo.timeLatency = false;
+	generalInfo.latency = NULL;
+	generalInfo.interrupted = NULL;
+	generalInfo.presigner = NULL;
+	generalInfo.local = NULL;
+	generalInfo.capture = NULL;
+	generalInfo.replay = NULL;
+	generalInfo.workspace = NULL;
 
     // Parses the command line arguments and reads the values passed.
 	for(int i = 1; i < argc && proceed; i++) {
@@ -70,13 +107,69 @@ int main(int argc, char **argv) {
 					break;
 
 				case 'c':
-					cryptoOff = true;
+					generalInfo.cryptoOff = true;
+					break;
+
+				case 'L':
+					generalInfo.hugePages = true;
 					break;
 
 				case 'o':
 					nextArg = ORDER;
 					break;
 
+				case 'v':
+					nextArg = VALUE;
+					break;
+
+				case 'w':
+					nextArg = OUTPUT;
+					break;
+
+				case 'n':
+					nextArg = INSTANCES;
+					break;
+
+				case 't':
+					nextArg = SHARDS;
+					break;
+
+				case 'r':
+					nextArg = RATE;
+					break;
+
+				case 'g':
+					nextArg = FANOUT;
+					break;
+
+				case 'l':
+					nextArg = LOG;
+					break;
+
+				case 'a':
+					nextArg = ADVERSARY;
+					break;
+
+				case 'k':
+					generalInfo.timeLatency = true;
+					break;
+
+				case 's':
+					nextArg = SEED;
+					break;
+
+				case 'u':
+					nextArg = BLIND;
+					break;
+
+				case 'd':
+					nextArg = CAPTURE;
+					break;
+
+				case 'i':
+					nextArg = ID;
+					break;
+
 				default:
 					printUsage();
 					proceed = false;
@@ -84,7 +177,7 @@ int main(int argc, char **argv) {
 		} else {
 			switch(nextArg) {
 				case PORT:
-					port = string(argv[i]);
+					generalInfo.port = string(argv[i]);
 					portNum = atoi(argv[i]);
 					if(portNum < MIN_PORT_NUM || portNum > MAX_PORT_NUM) {
 						cerr<<"The port number should lie between 1024 and 65535 including both.";
@@ -98,7 +191,7 @@ int main(int argc, char **argv) {
 					break;
 
 				case FAULTY:
-					maxFailures = atoi(argv[i]);
+					generalInfo.maxFailures = atoi(argv[i]);
 					break;
 
 				case ORDER:
@@ -111,6 +204,93 @@ int main(int argc, char **argv) {
 						proceed = false;
 						continue;
 					}
+					General::orderPayload(order, value);
+					break;
+
+				case VALUE:
+					if(!readFile(argv[i], value) || value.empty() || value.size() > MAX_PAYLOAD_SIZE) {
+						cerr<<"The value file must be readable and hold 1 byte up to 8 MB.";
+						proceed = false;
+						continue;
+					}
+					break;
+
+				case OUTPUT:
+					outputPath = argv[i];
+					break;
+
+				case INSTANCES:
+					numInstances = atoi(argv[i]);
+					if(numInstances < 1) {
+						cerr<<"The number of instances should be at least 1.";
+						proceed = false;
+						continue;
+					}
+					break;
+
+				case RATE:
+					if(atof(argv[i]) <= 0) {
+						cerr<<"The sending rate should be a positive number of Mbit/s.";
+						proceed = false;
+						continue;
+					}
+					generalInfo.pacingRate = (uint64_t) (atof(argv[i]) * 1000000 / 8);
+					break;
+
+				case FANOUT:
+					generalInfo.fanout = atoi(argv[i]);
+					if(generalInfo.fanout < 1) {
+						cerr<<"The fanout should be at least 1.";
+						proceed = false;
+						continue;
+					}
+					break;
+
+				case LOG:
+					logPath = argv[i];
+					break;
+
+				case ADVERSARY:
+					if(!Adversary::parse(argv[i], &(generalInfo.adversary))) {
+						cerr<<"The adversary should be a comma separated list of equivocate, drop, delay[=<ms>], forge, flood[=<chains>], loss=<%>, dup=<%> and reorder=<%>.";
+						proceed = false;
+						continue;
+					}
+					break;
+
+				case SEED:
+					generalInfo.adversary.seed = strtoul(argv[i], NULL, 10);
+					break;
+
+				case BLIND:
+					generalInfo.blindCopies = atoi(argv[i]);
+					if(generalInfo.blindCopies < 1 || generalInfo.blindCopies > MAX_BLIND_COPIES) {
+						cerr<<"The number of blind copies should lie between 1 and "<<MAX_BLIND_COPIES<<" including both.";
+						proceed = false;
+						continue;
+					}
+					break;
+
+				case CAPTURE:
+					generalInfo.capturePath = argv[i];
+					break;
+
+				case ID:
+					if(atoi(argv[i]) < 1) {
+						cerr<<"The id should be the line of the general in the hostfile, from 1.";
+						proceed = false;
+						continue;
+					}
+					generalInfo.myId = atoi(argv[i]);
+					break;
+
+				case SHARDS:
+					numShards = atoi(argv[i]);
+					if(numShards < 1 || numShards > MAX_SHARDS) {
+						cerr<<"The number of threads should lie between 1 and "<<MAX_SHARDS<<" including both.";
+						proceed = false;
+						continue;
+					}
 					break;
 
 				case NOP:
@@ -122,21 +302,106 @@ int main(int argc, char **argv) {
 	}
 
     // All OK. The command line arguments were fine.
-	if(proceed) {
-		uint32_t myId;
-		General *generalObj = bootstrap(port, hostFilePath, maxFailures, cryptoOff, order, &myId);
-		if(generalObj) {
-			try {
-				int decision = generalObj->run();
-				if(decision != NO_ORDER) {
-					const char *decisionStr = (decision == ATTACK) ? ATTACK_STRING : RETREAT_STRING;
-					cout<<"\n"<<myId<<": Agreed on "<<decisionStr;
-                    cout.flush();
-				}
-			} catch(string msg) {
-				cerr<<msg;
+	if(proceed && bootstrap(&generalInfo, hostFilePath)) {
+		// Instance i is run by shard i % numShards. More shards than instances would idle.
+		if(numShards > numInstances) {
+			numShards = numInstances;
+		}
+		Shard::initCrypto();
+		Shard *shards = new Shard[numShards];
+		DecisionLog decisionLog;
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+
+		try {
+			if(logPath) {
+				decisionLog.open(logPath);
+			}
+			for(int s = 0; s < numShards; s++) {
+				shards[s].init(s, numShards, numInstances, generalInfo, value, logPath ? &decisionLog : NULL, NULL);
+			}
+			Shard::steer(shards, numShards);
+			for(int s = 0; s < numShards; s++) {
+				shards[s].start();
+			}
+		} catch(string msg) {
+			cerr<<msg;
+			proceed = false;
+		}
+		for(int s = 0; s < numShards; s++) {
+			shards[s].join();
+		}
+		decisionLog.close(); // Decisions are reported once they are durable.
+		gettimeofday(&end, NULL);
+
+		// Report the instances in order: instance i is the (i / numShards)th one of its shard.
+		for(int i = 0; i < numInstances && proceed; i++) {
+			report(generalInfo.myId, shards[i % numShards].getOutcomes()[i / numShards], numInstances > 1, outputPath);
+		}
+		if(numInstances > 1 && proceed) {
+			double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+			cout<<"\n"<<generalInfo.myId<<": "<<numInstances<<" instances on "<<numShards<<" threads in "<<secs<<" s ("<<numInstances / secs<<" decisions/s)";
+			if(logPath) {
+				cout<<", logged in "<<decisionLog.getNumBatches()<<" syncs";
+			}
+			cout.flush();
+		}
+		if(generalInfo.timeLatency && proceed) {
+			LatencyStats latency;
+			for(int s = 0; s < numShards; s++) {
+				latency.merge(shards[s].getLatency());
+			}
+			latency.print(cout, generalInfo.myId);
+			cout.flush();
+		}
+		if(generalInfo.blindCopies > 0 && proceed) {
+			uint64_t copies = 0, messages = 0;
+			for(int s = 0; s < numShards; s++) {
+				copies += shards[s].getCopiesReceived();
+				messages += shards[s].getMessagesReceived();
+			}
+			if(messages > 0) {
+				cout<<"\n"<<generalInfo.myId<<": "<<copies<<" of "<<messages * generalInfo.blindCopies<<" blind copies received ("
+				    <<100.0 * copies / (messages * generalInfo.blindCopies)<<"% delivered) for "<<messages<<" messages";
+				cout.flush();
 			}
-			delete generalObj;
+		}
+		delete[] shards;
+	}
+}
+
+// Prints (and writes out) what was decided in an instance.
+// With several instances, each line names its instance and the payload of instance i goes to <output file>.i.
+void report(uint32_t myId, const Outcome &outcome, bool manyInstances, const char *outputPath) {
+	if(!outcome.done) {
+		return;
+	}
+
+	cout<<"\n"<<myId<<": ";
+	if(manyInstances) {
+		cout<<"["<<outcome.instance<<"] ";
+	}
+	if(outcome.decision == ATTACK || outcome.decision == RETREAT) {
+		const char *decisionStr = (outcome.decision == ATTACK) ? ATTACK_STRING : RETREAT_STRING;
+		cout<<"Agreed on "<<decisionStr;
+	} else if(outcome.decision == OPAQUE_VALUE) {
+		cout<<"Agreed on value "<<PayloadStore::toHex(outcome.digest);
+		if(outcome.havePayload) {
+			cout<<" ("<<outcome.payload.size()<<" bytes)";
+		} else {
+			cout<<" (payload not retrieved)";
+		}
+	}
+	cout.flush();
+
+	if(outputPath && outcome.havePayload) {
+		stringstream path;
+		path<<outputPath;
+		if(manyInstances) {
+			path<<"."<<outcome.instance;
+		}
+		if(!writeFile(path.str().c_str(), outcome.payload)) {
+			cerr<<"Could not write the payload to "<<path.str();
 		}
 	}
 }
@@ -144,20 +409,70 @@ int main(int argc, char **argv) {
 // Prints the usage.
 void printUsage() {
 	cout<<"Incorrect usage.";
-	cout<<"\nUsage: general -p <port number> -h <hostfile> -f <#faulty generals> [-c] [-o <order>]";
+	cout<<"\nUsage: general -p <port number> -h <hostfile> -f <#faulty generals> [-c] [-L] [-o <order> | -v <value file>] [-w <output file>] [-n <#instances>] [-t <#threads>] [-r <Mbit/s>] [-g <fanout>] [-l <log file>] [-a <adversary>] [-s <seed>] [-k] [-u <copies>] [-d <capture file>] [-i <id>]";
     cout<<"\n-c option asks the crypto to be turned off.";
+    cout<<"\n-L option backs the signature chains with huge pages.";
+    cout<<"\n-v option proposes the contents of a file (up to 8 MB) instead of an order.";
+    cout<<"\n-w option writes the payload agreed on to a file (<output file>.<instance> with several instances).";
+    cout<<"\n-n option runs that many agreement instances, all on the same value.";
+    cout<<"\n-t option runs the instances on that many threads, each pinned to a core with a socket of its own.";
+    cout<<"\n   All generals must be given the same -n and -t: instance i is run by thread i % t everywhere, in step.";
+    cout<<"\n-g option relays every value to that many generals picked at random (at least f + 1 and ln(n - 1) + 1),";
+    cout<<"\n   with rounds added for it to spread, instead of to all of them. All generals must be given the same -g.";
+    cout<<"\n-l option appends every decision, with the signature chains it rests on, to a log (read it with decisionlog).";
+    cout<<"\n-a option makes the general misbehave, as a comma separated list of:";
+    cout<<"\n   equivocate (a commander signs the other order for odd lieutenants), drop, delay[=<ms>] and forge (what is relayed),";
+    cout<<"\n   flood[=<chains>] (made up chains sent to everyone every round), loss=<%>, dup=<%> and reorder=<%> (datagrams sent).";
+    cout<<"\n-s option seeds the random choices of the adversary (1 by default): a seed injects the same faults every run.";
+    cout<<"\n-k option times every datagram with kernel timestamps and prints, per general heard from, the time on the wire,";
+    cout<<"\n   in the socket queue and in the handler (median, 99th percentile and maximum).";
+    cout<<"\n-u option sends every message that many times, spread over the first half of the round, and nothing is ACKed:";
+    cout<<"\n   relays make up for the copies lost. Every lieutenant prints the share of the copies it received.";
+    cout<<"\n   All generals must be given the same -u.";
+    cout<<"\n-d option captures every datagram sent and received to a file (<capture file>.<thread> with several threads),";
+    cout<<"\n   to be fed back to a lieutenant offline with replay.";
+    cout<<"\n-i option gives the id of the general (his line in the hostfile) instead of looking his host name up in it,";
+    cout<<"\n   for several generals on one host, each listed by an address of its own (127.0.0.1, 127.0.0.2, ...).";
+    cout<<"\n-r option paces the messages each thread sends to that rate (they go out as fast as possible otherwise).";
+}
+
+// Reads a payload from a file.
+bool readFile(const char *path, vector<uint8_t> &payload) {
+	ifstream file(path, ios::in | ios::binary);
+	if(!file.is_open()) {
+		return false;
+	}
+	payload.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+	return !file.bad();
+}
+
+// Writes a payload to a file.
+bool writeFile(const char *path, const vector<uint8_t> &payload) {
+	ofstream file(path, ios::out | ios::binary | ios::trunc);
+	if(!file.is_open()) {
+		return false;
+	}
+	if(!payload.empty()) {
+		file.write((const char *) &payload[0], payload.size());
+	}
+	return file.good();
 }
 
 // Reads the host file and builds the required data structures.
-// Instantiates the appropriate object (Commander or Lieutenant) depending on the role in the system.
-General *bootstrap(string port, char *hostFilePath, int maxFailures, bool cryptoOff, uint32_t order, uint32_t *myId) {
+// The options parsed from the command line are passed in generalInfo, which is completed here.
+// The id of the general is the line of his host name, unless it was given (-i).
+// The shards create the appropriate object (Commander or Lieutenant) for every instance from it.
+// Returns false if this general can not take part.
+bool bootstrap(GeneralInfo *generalInfo, char *hostFilePath) {
 	int status, numGenerals = 0;
-	uint32_t commanderId;
+	int maxFailures = generalInfo->maxFailures;
+	uint32_t *myId = &(generalInfo->myId);
+	uint32_t givenId = *myId;
 	char myHostName[HOST_NAME_LEN];
 	vector<string> hostNames;
-	map<unsigned long, uint32_t> ipToId;
+	vector<struct sockaddr_in> addresses;
 	ifstream hostfile(hostFilePath);
-	General *generalObj = NULL;
+	bool ready = false;
 
 	*myId = 0;
 
@@ -173,54 +488,39 @@ General *bootstrap(string port, char *hostFilePath, int maxFailures, bool crypto
 			if(!hostName.empty()) {
 				numGenerals++;
 				hostNames.push_back(hostName);
-				struct hostent *host = gethostbyname(hostName.c_str()); // Get the host address from host name.
-
-				if(host != NULL) {
-					struct in_addr hostAddress;
-					memcpy(&hostAddress, host->h_addr_list[0], sizeof(struct in_addr)); // Extract the IP adress from hostent structure.
-					ipToId[hostAddress.s_addr] = numGenerals;                           // IP address : General id.
-				}
 
                 // Determine my id number.
-				if(strcmp(myHostName, hostName.c_str()) == 0) {
+				if(givenId == 0 && strcmp(myHostName, hostName.c_str()) == 0) {
 					*myId = numGenerals;
 				}
 			}
 		}
 		hostfile.close();
+		if(givenId > 0 && givenId <= (uint32_t) numGenerals) {
+			*myId = givenId;
+		}
+
+		// Get the host addresses from the host names, all of them at once.
+		PeerTable::resolve(hostNames, generalInfo->port, addresses);
 	}
 	
 	// Check if the total number of generals must be no less than (maxFailures + 2).
 	if(numGenerals < maxFailures + 2) {
 		cout<<"The total number of generals must be no less than (faulty + 2). Number of generals: "<<numGenerals<<" and number of faulty ones: "<<maxFailures;
+	} else if(numGenerals > MAX_GENERALS) {
+		cout<<"This build supports up to "<<MAX_GENERALS<<" generals (rebuild with CPPFLAGS=-DMAX_GENERALS=<n> for more). Number of generals: "<<numGenerals;
 	} else if(*myId > 0) {
-        // Prepare the object with the required information to be passed to the constructors.
-		GeneralInfo *generaInfo = new GeneralInfo;
-		generaInfo->myId = *myId;
-		generaInfo->port = port;
-		generaInfo->maxFailures = maxFailures;
-		generaInfo->numGenerals = numGenerals;
-		generaInfo->cryptoOff = cryptoOff;
-		generaInfo->myHostName = string(myHostName);
-		generaInfo->hostNames = hostNames;
-		generaInfo->ipToId = ipToId;
-		
-		try {
-			if(order == ATTACK || order == RETREAT) {
-				generalObj = new Commander(generaInfo, order); // It's a Commander.
-			} else {
-				generalObj = new Lieutenant(generaInfo);       // It's a Lieutenant.
-			}
-		} catch(string msg) {
-			cerr<<msg;
-		}
-
-		if(generaInfo) {
-			delete generaInfo;
-		}
+        // Complete the object with the required information to be passed to the constructors.
+		generalInfo->numGenerals = numGenerals;
+		generalInfo->myHostName = string(myHostName);
+		generalInfo->hostNames = hostNames;
+		generalInfo->addresses = addresses;
+		ready = true;
+	} else if(givenId > 0) {
+		cerr<<"There is no general "<<givenId<<" in the file: "<<hostFilePath;
 	} else {
-		cerr<<"My hostname was not found in the file: "<<hostFilePath;
+		cerr<<"My hostname was not found in the file (give my id with -i): "<<hostFilePath;
 	}
 
-	return generalObj;
+	return ready;
 }
@@ -1,6 +1,10 @@
 /*
 +----------------------------------------------------------------------+
 | This header file contains the definition of the message formats. |
+|
+| Every message starts with its type and the agreement instance it |
+| belongs to, in network byte order. The kernel steers datagrams to |
+| the shard that runs the instance by the second word. |
 +----------------------------------------------------------------------+
 */
 
@@ -9,21 +13,73 @@
 
 #include <stdint.h>
 
+#define DIGEST_SIZE 32 // SHA-256.
+
+// The signature scheme is fixed at build time (make CPPFLAGS=-DSIG_ED25519), and so is the layout of a chain.
+// All generals must be built for the same scheme, with keys made for it (see mkcrypto.sh).
+#ifdef SIG_ED25519
+#define SIG_SIZE 64  /* Ed25519 */
+#else
+#define SIG_SIZE 256 /* For 2048 bit RSA private key */
+#endif
+
 struct sig {
-    uint32_t id;            // The identifier of the signer.
-    uint8_t signature[256]; // Since we are using 2048 bits RSA private key.
+    uint32_t id;                 // The identifier of the signer.
+    uint8_t signature[SIG_SIZE]; // Signature of the signer.
 };
 
 typedef struct {
-    uint32_t type;       // Must be equal to 1.
-    uint32_t total_sigs; // Total number of signatures on the message (also indicates the round number).
-    uint32_t order;      // The order (retreat = 0 and attack = 1).
-    struct sig sigs[];   // Contains total_sigs signatures.
+    uint32_t type;               // Must be equal to 1.
+    uint32_t instance;           // Agreement instance the message belongs to.
+    uint32_t total_sigs;         // Total number of signatures on the message (also indicates the round number).
+    uint32_t payload_len;        // Length of the payload proposed by the commander.
+    uint8_t digest[DIGEST_SIZE]; // SHA-256 digest of the payload. The commander signs it together with the instance.
+    struct sig sigs[];           // Contains total_sigs signatures.
 } SignedMessage;
 
 typedef struct {
-    uint32_t type;  // Must be equal to 2.
-    uint32_t round; // Round number.
+    uint32_t type;      // Must be equal to 2.
+    uint32_t instance;  // Agreement instance the message belongs to.
+    uint32_t round;     // Round number.
+    uint32_t hold_usec; // Microseconds from the kernel receiving the message to the ACK (0 if not timed).
 } Ack;
 
+typedef struct {
+    uint32_t type;      // Must be equal to 3.
+    uint32_t instance;  // Agreement instance the message belongs to.
+    uint32_t msg_id;    // Identifier the sender assigned to the fragmented message.
+    uint32_t index;     // Index of this fragment (0 to count - 1).
+    uint32_t count;     // Total number of fragments of the message.
+    uint32_t total_len; // Length of the whole message.
+    uint8_t data[];     // The bytes of the message starting at index * MAX_FRAGMENT_DATA.
+} Fragment;
+
+typedef struct {
+    uint32_t type;     // Must be equal to 4.
+    uint32_t instance; // Agreement instance the message belongs to.
+    uint32_t msg_id;   // Identifier of the fragmented message.
+    uint32_t index;    // Index of the fragment received.
+} FragmentAck;
+
+typedef struct {
+    uint32_t type;               // Must be equal to 5.
+    uint32_t instance;           // Agreement instance the message belongs to.
+    uint32_t payload_len;        // Length of the payload.
+    uint8_t digest[DIGEST_SIZE]; // SHA-256 digest of the payload.
+    uint8_t payload[];           // The payload (an order is the 4 byte order in network byte order).
+} PayloadMessage;
+
+typedef struct {
+    uint32_t type;               // Must be equal to 6.
+    uint32_t instance;           // Agreement instance the message belongs to.
+    uint8_t digest[DIGEST_SIZE]; // Digest of the payload asked for.
+} PayloadRequest;
+
+typedef struct {
+    uint32_t type;     // Must be equal to 7.
+    uint32_t instance; // Agreement instance the messages belong to.
+    uint32_t count;    // Number of messages carried.
+    uint8_t records[]; // count records: the length of a message (uint32_t), then the message, padded to 4 bytes.
+} Bundle;
+
 #endif
@@ -33,7 +33,12 @@ do
         i=$(($i+1))
         
         # Generate private key for host with id = $i
-        openssl genrsa -out ./generals/host_"$i"_key.pem 2048
+        # Of the signature scheme the generals are built for: SCHEME=ed25519 for a build made with CPPFLAGS=-DSIG_ED25519.
+        if [ "$SCHEME" = "ed25519" ]; then
+                openssl genpkey -algorithm ed25519 -out ./generals/host_"$i"_key.pem
+        else
+                openssl genrsa -out ./generals/host_"$i"_key.pem 2048
+        fi
 
         # Generate certificate (public key) for host with id = $i
         openssl req -batch -new -extensions v3_ca -key ./generals/host_"$i"_key.pem -out ./generals/host_"$i"_req.pem -days 365
@@ -41,3 +46,8 @@ do
         # Sign the certificate by the CA
         openssl ca -batch -out ./generals/host_"$i"_cert.pem -keyfile ./ca/ca_key.pem -cert ./ca/ca_cert.pem -config $config -infiles ./generals/host_"$i"_req.pem
 done
+
+# Pack the public keys of all hosts into a single key bundle for fast startup
+if [ -x ./keybundle ]; then
+        ./keybundle $1
+fi
@@ -0,0 +1,114 @@
+/*
++----------------------------------------------------------------------+
+| This program checks the digests of every engine of DigestBatch the |
+| CPU has against known answers and against OpenSSL's SHA256(). It |
+| exits with a non-zero status if one differs (make check). |
++----------------------------------------------------------------------+
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <openssl/sha.h>
+#include "../DigestBatch.h"
+
+#define MAX_MESSAGE_LEN 600 // Long enough for messages of many blocks, and for every length of padding.
+#define NUM_ROUNDS 200      // Batches of random messages hashed per engine.
+
+using namespace std;
+
+// A message and its digest, from FIPS 180-2.
+typedef struct {
+    const char *message;
+    const char *digest;
+} KnownAnswer;
+
+static const KnownAnswer KNOWN_ANSWERS[] = {
+    {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"}
+};
+
+static const char *ENGINE_NAMES[] = {"scalar", "AVX2", "SHA-NI"};
+
+// Writes a digest in hexadecimal.
+static string toHex(const uint8_t *digest) {
+    static const char digits[] = "0123456789abcdef";
+    string hex;
+    for(int i = 0; i < DIGEST_SIZE; i++) {
+        hex += digits[digest[i] >> 4];
+        hex += digits[digest[i] & 0xf];
+    }
+    return hex;
+}
+
+// Checks the known answers, hashed one at a time and all in one batch. Returns the number of mismatches.
+static int checkKnownAnswers() {
+    int numKnown = sizeof(KNOWN_ANSWERS) / sizeof(KNOWN_ANSWERS[0]);
+    uint8_t single[DIGEST_SIZE], batched[sizeof(KNOWN_ANSWERS) / sizeof(KNOWN_ANSWERS[0])][DIGEST_SIZE];
+    DigestBatch batch;
+    int numBad = 0;
+
+    for(int i = 0; i < numKnown; i++) {
+        batch.add(KNOWN_ANSWERS[i].message, strlen(KNOWN_ANSWERS[i].message), batched[i]);
+    }
+    batch.compute();
+
+    for(int i = 0; i < numKnown; i++) {
+        DigestBatch::digest(KNOWN_ANSWERS[i].message, strlen(KNOWN_ANSWERS[i].message), single);
+        if(toHex(single) != KNOWN_ANSWERS[i].digest || toHex(batched[i]) != KNOWN_ANSWERS[i].digest) {
+            cerr<<"\""<<KNOWN_ANSWERS[i].message<<"\": expected "<<KNOWN_ANSWERS[i].digest<<", got "<<toHex(single)<<" alone and "<<toHex(batched[i])<<" in a batch.\n";
+            numBad++;
+        }
+    }
+    return numBad;
+}
+
+// Checks batches of random messages of random lengths against SHA256(), with more messages in some than a batch holds.
+// Returns the number of mismatches.
+static int checkRandomMessages() {
+    static uint8_t messages[MAX_DIGEST_BATCH + DIGEST_BATCH_LANES][MAX_MESSAGE_LEN];
+    static uint8_t digests[MAX_DIGEST_BATCH + DIGEST_BATCH_LANES][DIGEST_SIZE];
+    size_t lengths[MAX_DIGEST_BATCH + DIGEST_BATCH_LANES];
+    DigestBatch batch;
+    int numBad = 0;
+
+    for(int round = 0; round < NUM_ROUNDS; round++) {
+        int numMessages = 1 + rand() % ((round % 10 == 0) ? MAX_DIGEST_BATCH + DIGEST_BATCH_LANES : 2 * DIGEST_BATCH_LANES);
+        for(int i = 0; i < numMessages; i++) {
+            lengths[i] = rand() % MAX_MESSAGE_LEN;
+            for(size_t j = 0; j < lengths[i]; j++) {
+                messages[i][j] = rand();
+            }
+            batch.add(messages[i], lengths[i], digests[i]);
+        }
+        batch.compute();
+
+        for(int i = 0; i < numMessages; i++) {
+            uint8_t expected[DIGEST_SIZE];
+            SHA256(messages[i], lengths[i], expected);
+            if(memcmp(expected, digests[i], DIGEST_SIZE) != 0) {
+                cerr<<"A message of "<<lengths[i]<<" bytes: expected "<<toHex(expected)<<", got "<<toHex(digests[i])<<".\n";
+                numBad++;
+            }
+        }
+    }
+    return numBad;
+}
+
+int main() {
+    int engines[] = {DIGEST_ENGINE_SCALAR, DIGEST_ENGINE_AVX2, DIGEST_ENGINE_SHA_NI};
+    int numBad = 0;
+
+    srand(1);
+    for(int i = 0; i < (int) (sizeof(engines) / sizeof(engines[0])); i++) {
+        if(!DigestBatch::setEngine(engines[i])) {
+            cout<<ENGINE_NAMES[i]<<": not on this CPU, skipped.\n";
+            continue;
+        }
+        int engineBad = checkKnownAnswers() + checkRandomMessages();
+        cout<<ENGINE_NAMES[i]<<": "<<(engineBad == 0 ? "ok" : "FAILED")<<"\n";
+        numBad += engineBad;
+    }
+    return (numBad == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,70 @@
+/*
++----------------------------------------------------------------------+
+| This source file is the entry point of the decisionlog tool. |
+|
+| It reads a decision log and prints every decision in it, with the |
+| generals that signed the chains it rests on, for audit. Reading |
+| stops at the first torn or corrupt record. |
++----------------------------------------------------------------------+
+*/
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <arpa/inet.h>
+#include "../General.h"
+#include "../DecisionLog.h"
+
+using namespace std;
+
+// Prints the decisions in a decision log.
+int main(int argc, char **argv) {
+	if(argc != 2) {
+		cout<<"Incorrect usage.";
+		cout<<"\nUsage: decisionlog <log file>\n";
+		return 1;
+	}
+
+	vector<vector<char> > records;
+	if(!DecisionLog::read(argv[1], records)) {
+		cerr<<"Could not open the decision log: "<<argv[1]<<"\n";
+		return 1;
+	}
+
+	for(size_t i = 0; i < records.size(); i++) {
+		const DecisionRecord *record = (const DecisionRecord *) &(records[i][0]);
+		uint32_t decision = ntohl(record->decision);
+		char when[32], digest[2 * DIGEST_SIZE + 1];
+		sprintf(when, "%u.%06u", ntohl(record->time_sec), ntohl(record->time_usec));
+		for(int b = 0; b < DIGEST_SIZE; b++) {
+			sprintf(digest + 2 * b, "%02x", record->digest[b]);
+		}
+
+		cout<<when<<" general "<<ntohl(record->general)<<" instance "<<ntohl(record->instance)<<": ";
+		cout<<(decision == ATTACK ? "attack" : decision == RETREAT ? "retreat" : "value")<<" "<<digest;
+
+		// Every chain is listed by its signers, the commander first.
+		const char *next = (const char *) (record + 1);
+		const char *end = &(records[i][0]) + records[i].size();
+		for(uint32_t c = 0; c < ntohl(record->num_chains) && next + sizeof(uint32_t) <= end; c++) {
+			uint32_t chainLen;
+			memcpy(&chainLen, next, sizeof(chainLen));
+			chainLen = ntohl(chainLen);
+			next += sizeof(chainLen);
+			if(chainLen < sizeof(SignedMessage) || next + chainLen > end) {
+				break;
+			}
+
+			const SignedMessage *chain = (const SignedMessage *) next;
+			uint32_t numSigs = (chainLen - sizeof(SignedMessage)) / sizeof(struct sig);
+			cout<<"\n    chain:";
+			for(uint32_t s = 0; s < numSigs; s++) {
+				cout<<" "<<ntohl(chain->sigs[s].id);
+			}
+			next += chainLen;
+		}
+		cout<<"\n";
+	}
+	cout<<records.size()<<" decisions.\n";
+	return 0;
+}
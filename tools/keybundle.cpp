@@ -0,0 +1,94 @@
+/*
++----------------------------------------------------------------------+
+| This source file is the entry point of the keybundle tool. |
+|
+| It reads the certificates of all the generals listed in a hostfile |
+| and packs their public keys into a single key bundle, which the |
+| generals map at startup instead of parsing every certificate. |
++----------------------------------------------------------------------+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/err.h>
+#include "../KeyBundle.h"
+
+using namespace std;
+
+// Packs the public keys of the generals into a key bundle.
+int main(int argc, char **argv) {
+	if(argc < 2 || argc > 3) {
+		cout<<"Incorrect usage.";
+		cout<<"\nUsage: keybundle <hostfile> [<bundle file>]";
+		cout<<"\nThe bundle file defaults to "<<KEY_BUNDLE_FILE<<"\n";
+		return 1;
+	}
+
+	// Count the generals in the hostfile.
+	int numGenerals = 0;
+	ifstream hostfile(argv[1]);
+	if(!hostfile.is_open()) {
+		cerr<<"Could not open the hostfile: "<<argv[1]<<"\n";
+		return 1;
+	}
+	while(hostfile.good()) {
+		string hostName;
+		getline(hostfile, hostName);
+		if(!hostName.empty()) {
+			numGenerals++;
+		}
+	}
+	hostfile.close();
+
+	ERR_load_crypto_strings();
+
+	// Read the public key out of the certificate of every general.
+	vector<EVP_PKEY *> keys;
+	bool ok = true;
+	for(int id = 1; id <= numGenerals && ok; id++) {
+		stringstream certFile;
+		certFile << "./generals/host_" << id << "_cert.pem";
+
+		FILE *fp = fopen(certFile.str().c_str(), "r");
+		if(fp == NULL) {
+			cerr<<"Could not open the certificate file: "<<certFile.str()<<"\n";
+			ok = false;
+			continue;
+		}
+
+		X509 *x509 = PEM_read_X509(fp, NULL, NULL, NULL);
+		fclose(fp);
+
+		EVP_PKEY *pkey = (x509 != NULL) ? X509_get_pubkey(x509) : NULL;
+		if(x509) {
+			X509_free(x509);
+		}
+		if(pkey == NULL) {
+			ERR_print_errors_fp(stderr);
+			cerr<<"Public key for "<<id<<" could not be read.\n";
+			ok = false;
+			continue;
+		}
+		keys.push_back(pkey);
+	}
+
+	if(ok) {
+		string bundleFile = (argc == 3) ? string(argv[2]) : string(KEY_BUNDLE_FILE);
+		try {
+			KeyBundle::write(bundleFile, keys);
+			cout<<"Packed "<<keys.size()<<" public keys into "<<bundleFile<<"\n";
+		} catch(string msg) {
+			cerr<<msg<<"\n";
+			ok = false;
+		}
+	}
+
+	for(size_t i = 0; i < keys.size(); i++) {
+		EVP_PKEY_free(keys[i]);
+	}
+	return ok ? 0 : 1;
+}
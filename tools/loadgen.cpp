@@ -0,0 +1,475 @@
+/*
++----------------------------------------------------------------------+
+| This source file is the entry point of the loadgen tool. |
+|
+| It runs a node of libbyzgen under load. The commander proposes |
+| values at a fixed rate, on a schedule that does not wait for the |
+| instances before to be decided (an open loop), so that a slow |
+| instance can not hide the latency of the ones queued behind it. |
+| Every value carries the time it was scheduled for, and every node |
+| times its decisions from it into a high dynamic range histogram. |
+| A sweep doubles the rate step by step till the decisions no longer |
+| keep up with it: the saturation point of the system. |
++----------------------------------------------------------------------+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "../Node.h"
+#include "../HdrHistogram.h"
+
+#define NOP 0
+
+#define PORT 1
+#define HOSTFILE 2
+#define FAULTY 3
+#define THREADS 4
+#define FANOUT 5
+#define BLIND 6
+#define RATE 7
+#define MAX_RATE 8
+#define STEP 9
+#define VALUE_SIZE 10
+#define IDLE 11
+
+#define LOAD_MAGIC 0x4c4f4144     // Marks a value of the load generator ("LOAD").
+#define LATENCY_DIGITS 3          // Significant digits of the latency histograms.
+#define LATENCY_HIGHEST 600000000 // Largest latency tracked, in microseconds.
+#define SUSTAINED_FRACTION 0.95   // A rate is sustained if the decisions keep up with this much of it.
+#define MIN_DRAIN_SECS 10         // Time given to the instances of a step to be decided, past its length if that is longer.
+
+#define HOST_NAME_LEN 256
+
+using namespace std;
+
+// What a value of the load generator starts with, in network byte order. The rest is padding.
+typedef struct {
+	uint32_t magic;     // LOAD_MAGIC.
+	uint32_t step;      // Step of the sweep the value was proposed in.
+	uint32_t rate;      // Values per second proposed in that step.
+	uint32_t sequence;  // Position of the value in its step.
+	uint32_t sched_sec; // When the value was scheduled to be proposed.
+	uint32_t sched_usec;
+} LoadHeader;
+
+// The decisions of a step of the sweep.
+typedef struct {
+	uint32_t rate;          // Values per second proposed.
+	uint64_t decided;       // Instances decided.
+	int64_t firstDecided;   // When the first instance was decided, in microseconds.
+	int64_t lastDecided;    // When the last instance was decided, in microseconds.
+	HdrHistogram latency;   // Time from a value being scheduled to its instance being decided.
+} StepStats;
+
+// Collects the decisions, as the shards of the node take them.
+typedef struct {
+	uint32_t myId;
+	map<uint32_t, StepStats> steps; // By step.
+	uint64_t foreign;               // Instances given up, or not on a value of the load generator.
+	int64_t lastDecision;           // When the last decision was taken, in microseconds (0 before the first).
+	pthread_mutex_t lock;
+	pthread_cond_t decisionTaken;
+} Collector;
+
+int64_t now();                                                  // Returns the time in microseconds.
+void decided(const Outcome &, void *);                          // Records a decision.
+bool readHostFile(const char *, vector<string> &, uint32_t *); // Reads the host file and finds the id of this host.
+void runCommander(Node &, Collector &, uint32_t, uint32_t, int, size_t); // Proposes values step by step and reports every step.
+void runLieutenant(Collector &, int);                           // Waits for the decisions till they stop coming.
+bool printStep(uint32_t, uint32_t, const StepStats &, uint64_t); // Prints the throughput and latency of a step. Returns whether its rate was sustained.
+void printUsage();                                              // Prints the usage.
+
+// Runs a node under load.
+int main(int argc, char **argv) {
+	NodeConfig config;
+	const char *hostFilePath = NULL;
+	uint32_t rate = 0, maxRate = 0;
+	int stepSecs = 10, idleSecs = 30;
+	size_t valueSize = 64;
+	int nextArg = NOP;
+	bool proceed = true;
+
+	config.maxFailures = 0;
+	config.numThreads = 1;
+	config.cryptoOff = false;
+	config.hugePages = false;
+	config.pacingRate = 0;
+	config.fanout = 0;
+	config.blindCopies = 0;
+	// Parses the command line arguments and reads the values passed.
+	for(int i = 1; i < argc && proceed; i++) {
+		if(argv[i][0] == '-') {
+			if(strlen(argv[i]) != 2) {
+				proceed = false;
+				continue;
+			}
+
+			switch(argv[i][1]) {
+				case 'p':
+					nextArg = PORT;
+					break;
+
+				case 'h':
+					nextArg = HOSTFILE;
+					break;
+
+				case 'f':
+					nextArg = FAULTY;
+					break;
+
+				case 't':
+					nextArg = THREADS;
+					break;
+
+				case 'c':
+					config.cryptoOff = true;
+					break;
+
+				case 'L':
+					config.hugePages = true;
+					break;
+
+				case 'g':
+					nextArg = FANOUT;
+					break;
+
+				case 'u':
+					nextArg = BLIND;
+					break;
+
+				case 'q':
+					nextArg = RATE;
+					break;
+
+				case 'Q':
+					nextArg = MAX_RATE;
+					break;
+
+				case 'd':
+					nextArg = STEP;
+					break;
+
+				case 'b':
+					nextArg = VALUE_SIZE;
+					break;
+
+				case 'i':
+					nextArg = IDLE;
+					break;
+
+				default:
+					proceed = false;
+			}
+		} else {
+			switch(nextArg) {
+				case PORT:
+					config.port = argv[i];
+					break;
+
+				case HOSTFILE:
+					hostFilePath = argv[i];
+					break;
+
+				case FAULTY:
+					config.maxFailures = atoi(argv[i]);
+					break;
+
+				case THREADS:
+					config.numThreads = atoi(argv[i]);
+					break;
+
+				case FANOUT:
+					config.fanout = atoi(argv[i]);
+					break;
+
+				case BLIND:
+					config.blindCopies = atoi(argv[i]);
+					break;
+
+				case RATE:
+					rate = strtoul(argv[i], NULL, 10);
+					break;
+
+				case MAX_RATE:
+					maxRate = strtoul(argv[i], NULL, 10);
+					break;
+
+				case STEP:
+					stepSecs = atoi(argv[i]);
+					break;
+
+				case VALUE_SIZE:
+					valueSize = strtoul(argv[i], NULL, 10);
+					break;
+
+				case IDLE:
+					idleSecs = atoi(argv[i]);
+					break;
+
+				default:
+					proceed = false; // A value that follows no option.
+			}
+			nextArg = NOP;
+		}
+	}
+	if(!proceed || nextArg != NOP || config.port.empty() || hostFilePath == NULL) {
+		printUsage();
+		return 1;
+	}
+	if(!readHostFile(hostFilePath, config.hostNames, &(config.myId))) {
+		return 1;
+	}
+	if(config.myId == COMMANDER_ID && (rate == 0 || stepSecs < 1 || (maxRate != 0 && maxRate < rate))) {
+		cerr<<"The commander needs a rate of at least 1 value/s (-q), no larger than the rate the sweep ends at (-Q), and steps of at least 1 s (-d).\n";
+		return 1;
+	}
+	if(valueSize < sizeof(LoadHeader) || valueSize > MAX_PAYLOAD_SIZE) {
+		cerr<<"A value must hold "<<sizeof(LoadHeader)<<" bytes up to 8 MB.\n";
+		return 1;
+	}
+
+	Collector collector;
+	collector.myId = config.myId;
+	collector.foreign = 0;
+	collector.lastDecision = 0;
+	pthread_mutex_init(&(collector.lock), NULL);
+	pthread_cond_init(&(collector.decisionTaken), NULL);
+
+	Node node;
+	try {
+		node.start(config, decided, &collector);
+		if(config.myId == COMMANDER_ID) {
+			runCommander(node, collector, rate, (maxRate != 0) ? maxRate : rate, stepSecs, valueSize);
+		} else {
+			runLieutenant(collector, idleSecs);
+		}
+		node.stop();
+	} catch(string msg) {
+		cerr<<msg<<"\n";
+		return 1;
+	}
+
+	// A lieutenant reports the steps he heard of once the load is over.
+	if(config.myId != COMMANDER_ID) {
+		for(map<uint32_t, StepStats>::const_iterator it = collector.steps.begin(); it != collector.steps.end(); ++it) {
+			printStep(config.myId, it->first, it->second, 0);
+		}
+		if(collector.foreign > 0) {
+			cout<<config.myId<<": "<<collector.foreign<<" instances not decided on a value of the load generator.\n";
+		}
+	}
+	pthread_cond_destroy(&(collector.decisionTaken));
+	pthread_mutex_destroy(&(collector.lock));
+	return 0;
+}
+
+// Proposes values at rate, then twice that, and so on up to maxRate, for stepSecs each.
+// A value is proposed at the time it is scheduled for, or as soon as the one before is if that is late:
+// latencies are timed from the schedule, so the time a value waits to be proposed counts too.
+// The sweep stops at the first rate that is not sustained.
+void runCommander(Node &node, Collector &collector, uint32_t rate, uint32_t maxRate, int stepSecs, size_t valueSize) {
+	uint32_t sustained = 0;
+	bool saturated = false;
+	vector<uint8_t> value(valueSize, 0);
+
+	for(uint32_t step = 0; ; step++) {
+		uint64_t numValues = (uint64_t) rate * stepSecs;
+		int64_t start = now();
+
+		pthread_mutex_lock(&(collector.lock));
+		StepStats &stats = collector.steps[step];
+		stats.rate = rate;
+		stats.decided = 0;
+		stats.firstDecided = 0;
+		stats.lastDecided = 0;
+		stats.latency.init(LATENCY_HIGHEST, LATENCY_DIGITS);
+		pthread_mutex_unlock(&(collector.lock));
+
+		for(uint64_t i = 0; i < numValues; i++) {
+			int64_t scheduled = start + (int64_t) (i * 1000000 / rate);
+			int64_t wait = scheduled - now();
+			if(wait > 0) {
+				usleep((useconds_t) wait);
+			}
+
+			LoadHeader header;
+			header.magic = htonl(LOAD_MAGIC);
+			header.step = htonl(step);
+			header.rate = htonl(rate);
+			header.sequence = htonl((uint32_t) i);
+			header.sched_sec = htonl((uint32_t) (scheduled / 1000000));
+			header.sched_usec = htonl((uint32_t) (scheduled % 1000000));
+			memcpy(&value[0], &header, sizeof(header));
+			node.submit(value);
+		}
+
+		// Give the instances of the step time to be decided before the next one loads the system more.
+		int64_t deadline = start + (int64_t) ((stepSecs > MIN_DRAIN_SECS) ? 2 * stepSecs : stepSecs + MIN_DRAIN_SECS) * 1000000;
+		pthread_mutex_lock(&(collector.lock));
+		while(stats.decided < numValues && now() < deadline) {
+			struct timespec until;
+			until.tv_sec = (time_t) (deadline / 1000000);
+			until.tv_nsec = (long) (deadline % 1000000) * 1000;
+			pthread_cond_timedwait(&(collector.decisionTaken), &(collector.lock), &until);
+		}
+		bool kept = printStep(collector.myId, step, stats, numValues);
+		pthread_mutex_unlock(&(collector.lock));
+
+		if(kept) {
+			sustained = rate;
+		}
+		saturated = !kept;
+		if(saturated || rate >= maxRate) {
+			break;
+		}
+		rate = (2 * (uint64_t) rate > maxRate) ? maxRate : 2 * rate;
+	}
+
+	if(saturated) {
+		cout<<collector.myId<<": saturated at "<<rate<<" values/s; the largest rate sustained was "<<sustained<<" values/s.\n";
+	} else {
+		cout<<collector.myId<<": sustained every rate up to "<<sustained<<" values/s.\n";
+	}
+}
+
+// Waits till no decision has come for idleSecs, after the first one.
+void runLieutenant(Collector &collector, int idleSecs) {
+	pthread_mutex_lock(&(collector.lock));
+	for(;;) {
+		int64_t deadline = (collector.lastDecision != 0) ? collector.lastDecision + (int64_t) idleSecs * 1000000 : 0;
+		if(deadline != 0 && now() >= deadline) {
+			break;
+		}
+
+		struct timespec until;
+		if(deadline == 0) {
+			pthread_cond_wait(&(collector.decisionTaken), &(collector.lock));
+			continue;
+		}
+		until.tv_sec = (time_t) (deadline / 1000000);
+		until.tv_nsec = (long) (deadline % 1000000) * 1000;
+		pthread_cond_timedwait(&(collector.decisionTaken), &(collector.lock), &until);
+	}
+	pthread_mutex_unlock(&(collector.lock));
+}
+
+// Records a decision, timed from when its value was scheduled. Called on the threads of the shards.
+// A lieutenant times it against the clock of the commander, so the clocks of the hosts must be in sync.
+void decided(const Outcome &outcome, void *context) {
+	Collector *collector = (Collector *) context;
+	int64_t decidedAt = now();
+	LoadHeader header;
+	bool ours = outcome.done && outcome.havePayload && outcome.payload.size() >= sizeof(LoadHeader);
+	if(ours) {
+		memcpy(&header, &(outcome.payload[0]), sizeof(header));
+		ours = (ntohl(header.magic) == LOAD_MAGIC);
+	}
+
+	pthread_mutex_lock(&(collector->lock));
+	collector->lastDecision = decidedAt;
+	if(!ours) {
+		collector->foreign++;
+	} else {
+		int64_t scheduled = (int64_t) ntohl(header.sched_sec) * 1000000 + ntohl(header.sched_usec);
+		map<uint32_t, StepStats>::iterator it = collector->steps.find(ntohl(header.step));
+		if(it == collector->steps.end()) {
+			StepStats &stats = collector->steps[ntohl(header.step)];
+			stats.rate = ntohl(header.rate);
+			stats.decided = 0;
+			stats.firstDecided = 0;
+			stats.lastDecided = 0;
+			stats.latency.init(LATENCY_HIGHEST, LATENCY_DIGITS);
+			it = collector->steps.find(ntohl(header.step));
+		}
+
+		StepStats &stats = it->second;
+		if(stats.decided++ == 0 || decidedAt < stats.firstDecided) {
+			stats.firstDecided = decidedAt;
+		}
+		if(decidedAt > stats.lastDecided) {
+			stats.lastDecided = decidedAt;
+		}
+		stats.latency.record(decidedAt - scheduled);
+	}
+	pthread_cond_broadcast(&(collector->decisionTaken));
+	pthread_mutex_unlock(&(collector->lock));
+}
+
+// Prints the throughput and latency percentiles of a step. numValues is the number of values proposed
+// in it (0 if it is not known). Returns whether its rate was sustained: every value was decided, at no
+// less than SUSTAINED_FRACTION of the rate. The throughput is the rate the decisions were taken at, from
+// the first to the last, which a system that keeps up takes at the rate the values were proposed.
+bool printStep(uint32_t myId, uint32_t step, const StepStats &stats, uint64_t numValues) {
+	double secs = (stats.lastDecided - stats.firstDecided) / 1000000.0;
+	double throughput = (stats.decided > 1 && secs > 0) ? (stats.decided - 1) / secs : 0;
+	bool kept = (numValues == 0 || stats.decided == numValues) && (stats.decided < 2 || throughput >= SUSTAINED_FRACTION * stats.rate);
+
+	char line[512];
+	snprintf(line, sizeof(line), "%u: step %u at %u values/s: %llu decided in %.2f s (%.1f decisions/s)%s, latency (us) p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu",
+			 myId, step, stats.rate, (unsigned long long) stats.decided, secs, throughput,
+			 (numValues != 0 && stats.decided < numValues) ? " of those proposed, not all" : "",
+			 (unsigned long long) stats.latency.percentile(50.0), (unsigned long long) stats.latency.percentile(90.0),
+			 (unsigned long long) stats.latency.percentile(99.0), (unsigned long long) stats.latency.percentile(99.9),
+			 (unsigned long long) stats.latency.getMax());
+	cout<<line<<"\n";
+	cout.flush();
+	return kept;
+}
+
+// Reads the host file and finds the id of this host: the position of its host name in the file.
+bool readHostFile(const char *path, vector<string> &hostNames, uint32_t *myId) {
+	char myHostName[HOST_NAME_LEN];
+	ifstream hostFile(path);
+	if(!hostFile.is_open()) {
+		cerr<<"Could not open the host file: "<<path<<"\n";
+		return false;
+	}
+	if(gethostname(myHostName, HOST_NAME_LEN) != 0) {
+		perror("Error encountered in fetching my host name.");
+		return false;
+	}
+
+	*myId = 0;
+	string hostName;
+	while(getline(hostFile, hostName)) {
+		if(!hostName.empty()) {
+			hostNames.push_back(hostName);
+			if(hostName == myHostName) {
+				*myId = hostNames.size();
+			}
+		}
+	}
+	if(*myId == 0) {
+		cerr<<"My hostname was not found in the file: "<<path<<"\n";
+		return false;
+	}
+	return true;
+}
+
+// Returns the time in microseconds.
+int64_t now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Prints the usage.
+void printUsage() {
+	cout<<"Incorrect usage.";
+	cout<<"\nUsage: loadgen -p <port number> -h <hostfile> -f <#faulty generals> [-t <#threads>] [-c] [-L] [-g <fanout>] [-u <copies>]";
+	cout<<"\n               [-q <values/s> [-Q <values/s>] [-d <seconds>] [-b <bytes>]] [-i <seconds>]";
+	cout<<"\n-u option sends every message that many times, unacknowledged (see general).";
+	cout<<"\n-q option has the commander propose values at that rate, open loop: on schedule, decided or not.";
+	cout<<"\n-Q option doubles the rate every step up to that rate, and stops at the first rate not sustained.";
+	cout<<"\n-d option runs every step for that long (10 s by default).";
+	cout<<"\n-b option pads every value to that many bytes (64 by default).";
+	cout<<"\n-i option has a lieutenant report once no decision has come for that long (30 s by default).";
+	cout<<"\nEvery node reports, per step, the decisions per second and the latency percentiles from the time a value";
+	cout<<"\nwas scheduled to its decision. A lieutenant times against the clock of the commander: keep the clocks in sync.\n";
+}
@@ -0,0 +1,230 @@
+/*
++----------------------------------------------------------------------+
+| This source file is the entry point of the replay tool. |
+|
+| It feeds a packet capture of a lieutenant (general -d) back to a |
+| lieutenant of its own, instance after instance as they were run, |
+| without the other generals: what he sends goes to sockets on the |
+| loopback that are never read. As fast as possible, on the virtual |
+| time of the replay, it benchmarks the receive, verify and forward |
+| path on the traffic captured, the same way on every run, so that a |
+| regression can be bisected offline. At the recorded pace, it reruns |
+| it as it was. |
+| The keys of the generals captured must be in ./generals (or -c). |
++----------------------------------------------------------------------+
+*/
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "../Lieutenant.h"
+#include "../PacketCapture.h"
+#include "../Replay.h"
+
+#define NOP 0
+
+#define OUTPUT 1
+
+#define SINK_BUFFER_SIZE 4096 // Receive buffer of a socket that stands for a general: what he is sent is dropped.
+#define SINK_NETWORK (INADDR_LOOPBACK + 0x10000) // Loopback address general i is given i past (generals are told apart by address).
+
+using namespace std;
+
+int64_t now();                                           // Returns the time in microseconds.
+int openSinks(uint32_t, uint32_t, vector<int> &, vector<struct sockaddr_in> &); // Opens a socket for every general. Returns that of the lieutenant.
+void printUsage();                                       // Prints the usage.
+
+// Replays a capture to a lieutenant.
+int main(int argc, char **argv) {
+	int nextArg = NOP;
+	bool paced = false, cryptoOff = false;
+	const char *outputPath = NULL;
+	const char *capturePath = NULL;
+	bool proceed = true;
+
+	// Parses the command line arguments and reads the values passed.
+	for(int i = 1; i < argc && proceed; i++) {
+		if(argv[i][0] == '-') {
+			if(strlen(argv[i]) != 2) {
+				proceed = false;
+				continue;
+			}
+
+			switch(argv[i][1]) {
+				case 'r':
+					paced = true;
+					break;
+
+				case 'c':
+					cryptoOff = true;
+					break;
+
+				case 'w':
+					nextArg = OUTPUT;
+					break;
+
+				default:
+					proceed = false;
+			}
+		} else {
+			switch(nextArg) {
+				case OUTPUT:
+					outputPath = argv[i];
+					break;
+
+				default:
+					if(capturePath != NULL) {
+						proceed = false; // Only one capture is replayed.
+					}
+					capturePath = argv[i];
+			}
+			nextArg = NOP;
+		}
+	}
+	if(!proceed || nextArg != NOP || capturePath == NULL) {
+		printUsage();
+		return 1;
+	}
+
+	Replay replay;
+	PacketCapture output;
+	Workspace workspace; // Keys, peer table and trie of the lieutenant, for all the instances.
+	vector<int> sinks;
+	try {
+		replay.load(capturePath);
+		const CaptureHeader &header = replay.getHeader();
+		if(header.general == COMMANDER_ID || header.general > header.num_generals || header.num_generals > MAX_GENERALS) {
+			cerr<<"Only the capture of a lieutenant, of a system this build supports, can be replayed.\n";
+			return 1;
+		}
+
+		// The lieutenant has a socket of his own, and every other general one that is never read.
+		GeneralInfo info;
+		int socketFD = openSinks(header.num_generals, header.general, sinks, info.addresses);
+		if(socketFD == -1) {
+			return 1;
+		}
+		info.myId = header.general;
+		info.instance = 0;
+		info.socketFD = socketFD;
+		info.maxFailures = header.max_failures;
+		info.numGenerals = header.num_generals;
+		info.cryptoOff = cryptoOff;
+		info.hugePages = false;
+		info.pacingRate = 0;
+		info.fanout = header.fanout;
+		info.blindCopies = header.blind_copies;
+		Adversary::clear(&(info.adversary));
+		info.timeLatency = false;
+		info.latency = NULL;
+		info.interrupted = NULL;
+		info.presigner = NULL;
+		info.local = NULL;
+		info.capture = NULL;
+		info.replay = &replay;
+		info.workspace = &workspace;
+		info.port = "0";
+		info.myHostName = "replay";
+		for(uint32_t id = 1; id <= header.num_generals; id++) {
+			stringstream name;
+			name<<"general "<<id;
+			info.hostNames.push_back(name.str());
+		}
+		if(outputPath != NULL) {
+			output.open(outputPath, header);
+			output.setClock(&replay);
+			info.capture = &output;
+		}
+
+		vector<uint32_t> instances;
+		replay.getInstances(instances);
+		cout<<"Replaying "<<replay.getNumRecords()<<" datagrams of "<<instances.size()<<" instances to lieutenant "<<header.general
+			<<" of "<<header.num_generals<<(paced ? ", at the recorded pace" : ", as fast as possible")<<".";
+
+		int64_t wallStart = now(), clockStart;
+		replay.start(paced);
+		clockStart = replay.now();
+		uint32_t numDecided = 0;
+		for(size_t i = 0; i < instances.size(); i++) {
+			info.instance = instances[i];
+			Lieutenant lieutenant(&info);
+			int decision = lieutenant.run();
+			uint8_t digest[DIGEST_SIZE];
+			if(lieutenant.getDecision(digest)) {
+				numDecided++;
+			}
+			cout<<"\n"<<header.general<<": ["<<instances[i]<<"] ";
+			if(decision == ATTACK || decision == RETREAT) {
+				cout<<"Agreed on "<<(decision == ATTACK ? "attack" : "retreat");
+			} else {
+				cout<<"Agreed on value "<<PayloadStore::toHex(digest);
+			}
+		}
+		int64_t wallTime = now() - wallStart, clockTime = replay.now() - clockStart;
+
+		double secs = wallTime / 1000000.0;
+		cout<<"\n"<<numDecided<<" instances decided, "<<replay.getNumFed()<<" datagrams fed in "<<secs<<" s ("
+			<<replay.getNumFed() / (secs > 0 ? secs : 1e-6)<<" datagrams/s), "<<clockTime / 1000000.0<<" s of replayed time";
+		if(outputPath != NULL) {
+			output.close();
+			cout<<", "<<output.getNumRecords()<<" datagrams captured to "<<outputPath;
+		}
+		cout<<".\n";
+	} catch(string msg) {
+		cerr<<msg<<"\n";
+		return 1;
+	}
+	for(size_t i = 0; i < sinks.size(); i++) {
+		close(sinks[i]);
+	}
+	return 0;
+}
+
+// Opens a socket on a loopback address of its own for every general, and fills in their addresses.
+// Those of the others are sent to and never read: what they are sent is dropped. The sockets are
+// closed by the caller. Returns the socket of the lieutenant (-1 if one could not be opened).
+int openSinks(uint32_t numGenerals, uint32_t myId, vector<int> &sinks, vector<struct sockaddr_in> &addresses) {
+	int socketFD = -1;
+	addresses.resize(numGenerals);
+	for(uint32_t id = 1; id <= numGenerals; id++) {
+		struct sockaddr_in &name = addresses[id - 1];
+		memset(&name, 0, sizeof(name));
+		name.sin_family = AF_INET;
+		name.sin_addr.s_addr = htonl(SINK_NETWORK + id);
+
+		int fd, size = (id == myId) ? MIN_SOCKET_BUFFER_SIZE : SINK_BUFFER_SIZE;
+		if((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1 || setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == -1 ||
+		   bind(fd, (struct sockaddr *) &name, sizeof(name)) == -1) {
+			perror("Failed to open a socket for a general: socket() or bind() failed");
+			return -1;
+		}
+		sinks.push_back(fd);
+		if(id == myId) {
+			socketFD = fd;
+		}
+
+		socklen_t nameLen = sizeof(name);
+		getsockname(fd, (struct sockaddr *) &name, &nameLen);
+	}
+	return socketFD;
+}
+
+// Returns the time in microseconds.
+int64_t now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Prints the usage.
+void printUsage() {
+	cout<<"Incorrect usage.";
+	cout<<"\nUsage: replay [-r] [-c] [-w <output capture>] <capture file>";
+	cout<<"\n-r option feeds the datagrams at the pace they were captured at (as fast as possible otherwise, on virtual time).";
+	cout<<"\n-c option turns the crypto off (for a capture of generals run with -c).";
+	cout<<"\n-w option captures what the lieutenant sends in the replay, to be compared with what he sent.\n";
+}